@@ -0,0 +1,225 @@
+/* Microbenchmark of glyph mask blending.
+ *
+ * It fills a console-sized image with glyphs using every blending kernel
+ * supported by the processor and, for comparison, with cairo the way the
+ * console used to draw glyphs: one clipped cairo_mask_surface per cell.
+ *
+ * Usage: bench_raster [columns rows frames]
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include <cairo.h>
+
+#include "raster.h"
+
+#define CELL_WIDTH      10
+#define CELL_HEIGHT     20
+#define GLYPH_WIDTH     8
+#define GLYPH_HEIGHT    14
+#define GLYPH_LEFT      1
+#define GLYPH_TOP       3
+
+/* Foreground and background colors of the benchmark.
+ */
+#define FG_COLOR        0x00839496
+#define BG_COLOR        0x00002b36
+
+static gint columns = 200;
+static gint rows = 60;
+static gint frames = 50;
+
+/* This helper makes an antialiased ring looking like an `O' glyph.
+ */
+static guint8*
+make_glyph (gint stride)
+{
+  guint8 *mask;
+  gdouble cx, cy, r;
+  gint x, y;
+
+  mask = g_malloc0 (stride * GLYPH_HEIGHT);
+
+  cx = GLYPH_WIDTH / 2.0;
+  cy = GLYPH_HEIGHT / 2.0;
+  r = GLYPH_WIDTH / 2.0 - 0.5;
+
+  for (y = 0; y < GLYPH_HEIGHT; y++)
+    {
+      for (x = 0; x < GLYPH_WIDTH; x++)
+        {
+          gdouble dx, dy, d, coverage;
+
+          dx = (x + 0.5 - cx) / r;
+          dy = (y + 0.5 - cy) / (r * GLYPH_HEIGHT / GLYPH_WIDTH);
+          d = fabs (sqrt (dx*dx + dy*dy) - 0.8) * r;
+
+          coverage = CLAMP (1.5 - d, 0.0, 1.0);
+          mask[y*stride + x] = coverage * 255.0 + 0.5;
+        }
+    }
+
+  return mask;
+}
+
+static void
+clear_image (RasterImage *image)
+{
+  raster_fill_rect (image, 0, 0, image->width, image->height, BG_COLOR);
+}
+
+static gdouble
+bench_raster (RasterImage *image, const guint8 *mask, gint mask_stride, gint n_frames)
+{
+  GTimer *timer;
+  gdouble elapsed;
+  gint i, x, y;
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < n_frames; i++)
+    {
+      for (y = 0; y < rows; y++)
+        {
+          for (x = 0; x < columns; x++)
+            {
+              raster_blend_mask (image, x*CELL_WIDTH + GLYPH_LEFT, y*CELL_HEIGHT + GLYPH_TOP,
+                                 mask, mask_stride, GLYPH_WIDTH, GLYPH_HEIGHT, FG_COLOR);
+            }
+        }
+    }
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  return elapsed;
+}
+
+static gdouble
+bench_cairo (cairo_surface_t *surface, cairo_surface_t *glyph)
+{
+  GTimer *timer;
+  gdouble elapsed;
+  cairo_t *cr;
+  gint i, x, y;
+
+  cr = cairo_create (surface);
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < frames; i++)
+    {
+      for (y = 0; y < rows; y++)
+        {
+          for (x = 0; x < columns; x++)
+            {
+              gdouble gx = x*CELL_WIDTH + GLYPH_LEFT;
+              gdouble gy = y*CELL_HEIGHT + GLYPH_TOP;
+
+              cairo_save (cr);
+              cairo_rectangle (cr, gx, gy, GLYPH_WIDTH, GLYPH_HEIGHT);
+              cairo_clip (cr);
+              cairo_set_source_rgb (cr, 0x83 / 255.0, 0x94 / 255.0, 0x96 / 255.0);
+              cairo_mask_surface (cr, glyph, gx, gy);
+              cairo_restore (cr);
+            }
+        }
+    }
+
+  cairo_surface_flush (surface);
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  cairo_destroy (cr);
+
+  return elapsed;
+}
+
+static void
+report (const gchar *name, gdouble elapsed)
+{
+  gdouble cells = (gdouble) columns * rows * frames;
+
+  g_print ("%-8s %8.2f ms/frame %8.1f ns/glyph\n",
+           name, elapsed * 1000.0 / frames, elapsed * 1e9 / cells);
+}
+
+int
+main (int argc, char *argv[])
+{
+  cairo_surface_t *surface, *glyph;
+  RasterImage image;
+  guint8 *mask, *reference;
+  gint mask_stride, impl;
+  gsize size;
+
+  if (argc == 4)
+    {
+      columns = atoi (argv[1]);
+      rows = atoi (argv[2]);
+      frames = atoi (argv[3]);
+    }
+
+  if (columns <= 0 || rows <= 0 || frames <= 0)
+    {
+      g_printerr ("usage: %s [columns rows frames]\n", argv[0]);
+      return 1;
+    }
+
+  g_print ("%dx%d console, %dx%d cells, %d frames\n",
+           columns, rows, CELL_WIDTH, CELL_HEIGHT, frames);
+
+  mask_stride = cairo_format_stride_for_width (CAIRO_FORMAT_A8, GLYPH_WIDTH);
+  mask = make_glyph (mask_stride);
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, columns * CELL_WIDTH, rows * CELL_HEIGHT);
+
+  image.data = cairo_image_surface_get_data (surface);
+  image.width = cairo_image_surface_get_width (surface);
+  image.height = cairo_image_surface_get_height (surface);
+  image.stride = cairo_image_surface_get_stride (surface);
+
+  size = image.stride * image.height;
+  reference = NULL;
+
+  for (impl = RASTER_IMPL_SCALAR; impl <= RASTER_IMPL_AVX2; impl++)
+    {
+      gdouble elapsed;
+
+      if (!raster_set_impl (impl))
+        {
+          g_print ("%-8s not supported\n", raster_impl_name (impl));
+          continue;
+        }
+
+      clear_image (&image);
+      elapsed = bench_raster (&image, mask, mask_stride, frames);
+      report (raster_impl_name (impl), elapsed);
+
+      /* all kernels must produce the same pixels */
+      clear_image (&image);
+      bench_raster (&image, mask, mask_stride, 1);
+
+      if (reference == NULL)
+        reference = g_memdup (image.data, size);
+      else if (memcmp (reference, image.data, size) != 0)
+        g_print ("%-8s result differs from %s\n", raster_impl_name (impl),
+                 raster_impl_name (RASTER_IMPL_SCALAR));
+    }
+
+  glyph = cairo_image_surface_create_for_data (mask, CAIRO_FORMAT_A8, GLYPH_WIDTH, GLYPH_HEIGHT, mask_stride);
+
+  clear_image (&image);
+  cairo_surface_mark_dirty (surface);
+  report ("cairo", bench_cairo (surface, glyph));
+
+  cairo_surface_destroy (glyph);
+  cairo_surface_destroy (surface);
+
+  g_free (reference);
+  g_free (mask);
+
+  return 0;
+}
@@ -0,0 +1,424 @@
+/* Boxdraw -- procedural rendering of box drawing, block and shade characters.
+ *
+ * Pseudographics is drawn with rectangles sized to the character cell rather
+ * than taken from the font, so lines and blocks of neighbouring cells always
+ * join without gaps whatever the font size is. Line characters are described
+ * by the weight of their four arms going from the cell centre to the edges.
+ */
+#include <glib.h>
+
+#include "raster.h"
+#include "boxdraw.h"
+
+/* Arm weights.
+ */
+#define NONE            0
+#define LIGHT           1
+#define HEAVY           2
+#define DOUBLE          3
+
+/* These macros pack and unpack weights of the left, right, up and down arms.
+ */
+#define ARMS(l, r, u, d)        ((l) | ((r) << 2) | ((u) << 4) | ((d) << 6))
+
+#define ARM_LEFT(a)             ((a) & 3)
+#define ARM_RIGHT(a)            (((a) >> 2) & 3)
+#define ARM_UP(a)               (((a) >> 4) & 3)
+#define ARM_DOWN(a)             (((a) >> 6) & 3)
+
+#define L_ LIGHT
+#define H_ HEAVY
+#define D_ DOUBLE
+
+/* Arms of line characters U+2500..U+257F. Dashed lines are described by
+ * their solid counterparts, rounded corners by the square ones. Diagonals
+ * have no arms.
+ */
+static const guint8 line_arms[] =
+{
+  /* 2500 */ ARMS (L_, L_, 0, 0),   ARMS (H_, H_, 0, 0),   ARMS (0, 0, L_, L_),   ARMS (0, 0, H_, H_),
+  /* 2504 */ ARMS (L_, L_, 0, 0),   ARMS (H_, H_, 0, 0),   ARMS (0, 0, L_, L_),   ARMS (0, 0, H_, H_),
+  /* 2508 */ ARMS (L_, L_, 0, 0),   ARMS (H_, H_, 0, 0),   ARMS (0, 0, L_, L_),   ARMS (0, 0, H_, H_),
+  /* 250C */ ARMS (0, L_, 0, L_),   ARMS (0, H_, 0, L_),   ARMS (0, L_, 0, H_),   ARMS (0, H_, 0, H_),
+  /* 2510 */ ARMS (L_, 0, 0, L_),   ARMS (H_, 0, 0, L_),   ARMS (L_, 0, 0, H_),   ARMS (H_, 0, 0, H_),
+  /* 2514 */ ARMS (0, L_, L_, 0),   ARMS (0, H_, L_, 0),   ARMS (0, L_, H_, 0),   ARMS (0, H_, H_, 0),
+  /* 2518 */ ARMS (L_, 0, L_, 0),   ARMS (H_, 0, L_, 0),   ARMS (L_, 0, H_, 0),   ARMS (H_, 0, H_, 0),
+  /* 251C */ ARMS (0, L_, L_, L_),  ARMS (0, H_, L_, L_),  ARMS (0, L_, H_, L_),  ARMS (0, L_, L_, H_),
+  /* 2520 */ ARMS (0, L_, H_, H_),  ARMS (0, H_, H_, L_),  ARMS (0, H_, L_, H_),  ARMS (0, H_, H_, H_),
+  /* 2524 */ ARMS (L_, 0, L_, L_),  ARMS (H_, 0, L_, L_),  ARMS (L_, 0, H_, L_),  ARMS (L_, 0, L_, H_),
+  /* 2528 */ ARMS (L_, 0, H_, H_),  ARMS (H_, 0, H_, L_),  ARMS (H_, 0, L_, H_),  ARMS (H_, 0, H_, H_),
+  /* 252C */ ARMS (L_, L_, 0, L_),  ARMS (H_, L_, 0, L_),  ARMS (L_, H_, 0, L_),  ARMS (H_, H_, 0, L_),
+  /* 2530 */ ARMS (L_, L_, 0, H_),  ARMS (H_, L_, 0, H_),  ARMS (L_, H_, 0, H_),  ARMS (H_, H_, 0, H_),
+  /* 2534 */ ARMS (L_, L_, L_, 0),  ARMS (H_, L_, L_, 0),  ARMS (L_, H_, L_, 0),  ARMS (H_, H_, L_, 0),
+  /* 2538 */ ARMS (L_, L_, H_, 0),  ARMS (H_, L_, H_, 0),  ARMS (L_, H_, H_, 0),  ARMS (H_, H_, H_, 0),
+  /* 253C */ ARMS (L_, L_, L_, L_), ARMS (H_, L_, L_, L_), ARMS (L_, H_, L_, L_), ARMS (H_, H_, L_, L_),
+  /* 2540 */ ARMS (L_, L_, H_, L_), ARMS (L_, L_, L_, H_), ARMS (L_, L_, H_, H_), ARMS (H_, L_, H_, L_),
+  /* 2544 */ ARMS (L_, H_, H_, L_), ARMS (H_, L_, L_, H_), ARMS (L_, H_, L_, H_), ARMS (H_, H_, H_, L_),
+  /* 2548 */ ARMS (H_, H_, L_, H_), ARMS (H_, L_, H_, H_), ARMS (L_, H_, H_, H_), ARMS (H_, H_, H_, H_),
+  /* 254C */ ARMS (L_, L_, 0, 0),   ARMS (H_, H_, 0, 0),   ARMS (0, 0, L_, L_),   ARMS (0, 0, H_, H_),
+  /* 2550 */ ARMS (D_, D_, 0, 0),   ARMS (0, 0, D_, D_),   ARMS (0, D_, 0, L_),   ARMS (0, L_, 0, D_),
+  /* 2554 */ ARMS (0, D_, 0, D_),   ARMS (D_, 0, 0, L_),   ARMS (L_, 0, 0, D_),   ARMS (D_, 0, 0, D_),
+  /* 2558 */ ARMS (0, D_, L_, 0),   ARMS (0, L_, D_, 0),   ARMS (0, D_, D_, 0),   ARMS (D_, 0, L_, 0),
+  /* 255C */ ARMS (L_, 0, D_, 0),   ARMS (D_, 0, D_, 0),   ARMS (0, D_, L_, L_),  ARMS (0, L_, D_, D_),
+  /* 2560 */ ARMS (0, D_, D_, D_),  ARMS (D_, 0, L_, L_),  ARMS (L_, 0, D_, D_),  ARMS (D_, 0, D_, D_),
+  /* 2564 */ ARMS (D_, D_, 0, L_),  ARMS (L_, L_, 0, D_),  ARMS (D_, D_, 0, D_),  ARMS (D_, D_, L_, 0),
+  /* 2568 */ ARMS (L_, L_, D_, 0),  ARMS (D_, D_, D_, 0),  ARMS (D_, D_, L_, L_), ARMS (L_, L_, D_, D_),
+  /* 256C */ ARMS (D_, D_, D_, D_), ARMS (0, L_, 0, L_),   ARMS (L_, 0, 0, L_),   ARMS (L_, 0, L_, 0),
+  /* 2570 */ ARMS (0, L_, L_, 0),   0,                     0,                     0,
+  /* 2574 */ ARMS (L_, 0, 0, 0),    ARMS (0, 0, L_, 0),    ARMS (0, L_, 0, 0),    ARMS (0, 0, 0, L_),
+  /* 2578 */ ARMS (H_, 0, 0, 0),    ARMS (0, 0, H_, 0),    ARMS (0, H_, 0, 0),    ARMS (0, 0, 0, H_),
+  /* 257C */ ARMS (L_, H_, 0, 0),   ARMS (0, 0, L_, H_),   ARMS (H_, L_, 0, 0),   ARMS (0, 0, H_, L_),
+};
+
+/* Quadrants of the cell filled by block elements.
+ */
+#define QUAD_UL         (1 << 0)
+#define QUAD_UR         (1 << 1)
+#define QUAD_LL         (1 << 2)
+#define QUAD_LR         (1 << 3)
+
+/* Quadrants filled by characters U+2596..U+259F.
+ */
+static const guint8 quadrants[] =
+{
+  QUAD_LL, QUAD_LR, QUAD_UL, QUAD_UL | QUAD_LL | QUAD_LR,
+  QUAD_UL | QUAD_LR, QUAD_UL | QUAD_UR | QUAD_LL, QUAD_UL | QUAD_UR | QUAD_LR, QUAD_UR,
+  QUAD_UR | QUAD_LL, QUAD_UR | QUAD_LL | QUAD_LR,
+};
+
+/* Cell being drawn.
+ */
+typedef struct _BoxdrawCell
+{
+  RasterImage *image;           /* image the cell is drawn to */
+  gint x;                       /* left position of the cell in the image */
+  gint y;                       /* top position of the cell in the image */
+  gint width;                   /* cell width in pixels */
+  gint height;                  /* cell height in pixels */
+  gint light;                   /* light line thickness in pixels */
+  guint32 color;                /* drawing color */
+} BoxdrawCell;
+
+/* This helper fills a rectangle given relative to the cell.
+ */
+static void
+fill (BoxdrawCell *cell, gint x, gint y, gint width, gint height)
+{
+  raster_fill_rect (cell->image, cell->x + x, cell->y + y, width, height, cell->color);
+}
+
+/* This helper returns thickness of a single line of the weight.
+ */
+static gint
+thickness (BoxdrawCell *cell, gint weight)
+{
+  return (weight == HEAVY) ? cell->light * 2 : cell->light;
+}
+
+/* This helper draws a line character from its arms. Lines of the double
+ * arms turn to the parallel lines of the double arms meeting them, so
+ * corners and tees of double lines come out as in the code page 866.
+ * Single lines stop at the nearest of double lines they meet unless they
+ * cross them.
+ */
+static void
+draw_lines (BoxdrawCell *cell, guint8 arms)
+{
+  gint l, r, u, d;
+  gint w, h, t;
+  gint vx, vt, hy, ht;          /* single vertical and horizontal stems */
+  gint xl, xr, yt, yb;          /* double vertical and horizontal stems */
+  gboolean vd, hd;
+
+  l = ARM_LEFT (arms);
+  r = ARM_RIGHT (arms);
+  u = ARM_UP (arms);
+  d = ARM_DOWN (arms);
+
+  w = cell->width;
+  h = cell->height;
+  t = cell->light;
+
+  vd = (u == DOUBLE || d == DOUBLE);
+  hd = (l == DOUBLE || r == DOUBLE);
+
+  xl = (w - 3*t) / 2;
+  xr = xl + 2*t;
+  yt = (h - 3*t) / 2;
+  yb = yt + 2*t;
+
+  /* Without a stem across, arms end at the cell centre.
+   */
+  vt = (u || d) ? thickness (cell, MAX (u, d)) : t;
+  vx = (w - vt) / 2;
+  ht = (l || r) ? thickness (cell, MAX (l, r)) : t;
+  hy = (h - ht) / 2;
+
+  if (l == DOUBLE)
+    {
+      fill (cell, 0, yt, vd ? ((u ? xl : xr) + t) : (vx + vt), t);
+      fill (cell, 0, yb, vd ? ((d ? xl : xr) + t) : (vx + vt), t);
+    }
+  else if (l)
+    {
+      gint at = thickness (cell, l);
+      gint end = vd ? ((u == DOUBLE && d == DOUBLE && !r) ? xl + t : xr + t) : ((u || d) ? vx + vt : (w - at)/2 + at);
+
+      fill (cell, 0, (h - at) / 2, end, at);
+    }
+
+  if (r == DOUBLE)
+    {
+      gint top = vd ? (u ? xr : xl) : vx;
+      gint bottom = vd ? (d ? xr : xl) : vx;
+
+      fill (cell, top, yt, w - top, t);
+      fill (cell, bottom, yb, w - bottom, t);
+    }
+  else if (r)
+    {
+      gint at = thickness (cell, r);
+      gint start = vd ? ((u == DOUBLE && d == DOUBLE && !l) ? xr : xl) : ((u || d) ? vx : (w - at)/2);
+
+      fill (cell, start, (h - at) / 2, w - start, at);
+    }
+
+  if (u == DOUBLE)
+    {
+      fill (cell, xl, 0, t, hd ? ((l ? yt : yb) + t) : (hy + ht));
+      fill (cell, xr, 0, t, hd ? ((r ? yt : yb) + t) : (hy + ht));
+    }
+  else if (u)
+    {
+      gint at = thickness (cell, u);
+      gint end = hd ? ((l == DOUBLE && r == DOUBLE && !d) ? yt + t : yb + t) : ((l || r) ? hy + ht : (h - at)/2 + at);
+
+      fill (cell, (w - at) / 2, 0, at, end);
+    }
+
+  if (d == DOUBLE)
+    {
+      gint left = hd ? (l ? yb : yt) : hy;
+      gint right = hd ? (r ? yb : yt) : hy;
+
+      fill (cell, xl, left, t, h - left);
+      fill (cell, xr, right, t, h - right);
+    }
+  else if (d)
+    {
+      gint at = thickness (cell, d);
+      gint start = hd ? ((l == DOUBLE && r == DOUBLE && !u) ? yb : yt) : ((l || r) ? hy : (h - at)/2);
+
+      fill (cell, (w - at) / 2, start, at, h - start);
+    }
+}
+
+/* This helper draws a line broken into n dashes.
+ */
+static void
+draw_dashes (BoxdrawCell *cell, guint8 arms, gint n)
+{
+  gint i, weight, size, at;
+  gboolean horizontal;
+
+  horizontal = (ARM_LEFT (arms) != NONE);
+  weight = horizontal ? ARM_LEFT (arms) : ARM_UP (arms);
+  size = horizontal ? cell->width : cell->height;
+  at = thickness (cell, weight);
+
+  for (i = 0; i < n; i++)
+    {
+      gint start = i * size / n;
+      gint end = (i + 1) * size / n;
+      gint gap = MAX ((end - start) / 3, 1);
+
+      start += gap / 2;
+      end -= gap - gap / 2;
+
+      if (horizontal)
+        fill (cell, start, (cell->height - at) / 2, end - start, at);
+      else
+        fill (cell, (cell->width - at) / 2, start, at, end - start);
+    }
+}
+
+/* This helper draws diagonals, rising (/) and/or falling (\).
+ */
+static void
+draw_diagonals (BoxdrawCell *cell, gboolean rising, gboolean falling)
+{
+  gint w, h, t, y;
+
+  w = cell->width;
+  h = cell->height;
+  t = cell->light;
+
+  for (y = 0; y < h; y++)
+    {
+      /* x of the falling diagonal at the middle of the pixel row */
+      gint x = (2*y + 1) * w / (2*h);
+
+      if (rising)
+        fill (cell, w - 1 - x - (t - 1)/2, y, t, 1);
+
+      if (falling)
+        fill (cell, x - (t - 1)/2, y, t, 1);
+    }
+}
+
+/* This helper fills every pixel of the cell whose screen coordinates match
+ * the shade pattern: 1 of 4 pixels for the light, 2 of 4 for the medium and
+ * 3 of 4 for the dark shade. The pattern is aligned to the screen, so shaded
+ * areas have no seams between cells of odd sizes.
+ */
+static void
+draw_shade (BoxdrawCell *cell, gint phase_x, gint phase_y, gint level)
+{
+  RasterImage *image = cell->image;
+  gint x, y, x1, y1, x2, y2;
+
+  x1 = MAX (cell->x, 0);
+  y1 = MAX (cell->y, 0);
+  x2 = MIN (cell->x + cell->width, image->width);
+  y2 = MIN (cell->y + cell->height, image->height);
+
+  for (y = y1; y < y2; y++)
+    {
+      guint32 *row = (guint32 *) (image->data + y*image->stride);
+      gint sy = (y + phase_y) & 1;
+
+      for (x = x1; x < x2; x++)
+        {
+          gint sx = (x + phase_x) & 1;
+          gboolean set;
+
+          switch (level)
+            {
+            case 1:
+              set = (sx == 0 && sy == 0);
+              break;
+            case 2:
+              set = (sx == sy);
+              break;
+            default:
+              set = (sx != 0 || sy != 0);
+              break;
+            }
+
+          if (set)
+            row[x] = cell->color;
+        }
+    }
+}
+
+/* This helper draws block elements U+2580..U+259F.
+ */
+static void
+draw_block (BoxdrawCell *cell, gint phase_x, gint phase_y, gunichar chr)
+{
+  gint w, h, mx, my;
+
+  w = cell->width;
+  h = cell->height;
+
+  /* Halves are rounded the same way everywhere, so e.g. the upper half
+   * block and the lower half block put together fill the whole cell.
+   */
+  mx = (w*4 + 4) / 8;
+  my = h - (h*4 + 4) / 8;
+
+  if (chr == 0x2580)
+    fill (cell, 0, 0, w, my);
+  else if (chr >= 0x2581 && chr <= 0x2588)
+    {
+      /* lower one eighth .. full block */
+      gint size = (h * (chr - 0x2580) + 4) / 8;
+
+      fill (cell, 0, h - size, w, size);
+    }
+  else if (chr >= 0x2589 && chr <= 0x258f)
+    {
+      /* left seven eighths .. left one eighth */
+      gint size = (w * (0x2590 - chr) + 4) / 8;
+
+      fill (cell, 0, 0, size, h);
+    }
+  else if (chr == 0x2590)
+    fill (cell, mx, 0, w - mx, h);
+  else if (chr >= 0x2591 && chr <= 0x2593)
+    draw_shade (cell, phase_x, phase_y, chr - 0x2590);
+  else if (chr == 0x2594)
+    fill (cell, 0, 0, w, MAX ((h + 4) / 8, 1));
+  else if (chr == 0x2595)
+    {
+      gint size = MAX ((w + 4) / 8, 1);
+
+      fill (cell, w - size, 0, size, h);
+    }
+  else
+    {
+      guint8 quads = quadrants[chr - 0x2596];
+
+      if (quads & QUAD_UL)
+        fill (cell, 0, 0, mx, my);
+      if (quads & QUAD_UR)
+        fill (cell, mx, 0, w - mx, my);
+      if (quads & QUAD_LL)
+        fill (cell, 0, my, mx, h - my);
+      if (quads & QUAD_LR)
+        fill (cell, mx, my, w - mx, h - my);
+    }
+}
+
+/* Draws the character chr with the color into the cell at [x,y] of the image,
+ * the cell background is expected to be filled already. Parts of the cell
+ * outside of the image are clipped. The phase is the screen position of the
+ * image origin, it aligns shade patterns of different images to each other.
+ */
+void
+boxdraw_render (RasterImage   *image,
+                gint           x,
+                gint           y,
+                gint           width,
+                gint           height,
+                gint           phase_x,
+                gint           phase_y,
+                gunichar       chr,
+                guint32        color)
+{
+  BoxdrawCell cell;
+  gint index;
+
+  g_return_if_fail (image != NULL);
+  g_return_if_fail (BOXDRAW_IS_BOX_CHAR (chr));
+
+  if (width <= 0 || height <= 0)
+    return;
+
+  cell.image = image;
+  cell.x = x;
+  cell.y = y;
+  cell.width = width;
+  cell.height = height;
+  cell.light = MAX (width / 8, 1);
+  cell.color = color;
+
+  if (chr >= 0x2580)
+    {
+      draw_block (&cell, phase_x, phase_y, chr);
+      return;
+    }
+
+  index = chr - BOXDRAW_FIRST_CHAR;
+
+  if (chr >= 0x2504 && chr <= 0x2507)
+    draw_dashes (&cell, line_arms[index], 3);
+  else if (chr >= 0x2508 && chr <= 0x250b)
+    draw_dashes (&cell, line_arms[index], 4);
+  else if (chr >= 0x254c && chr <= 0x254f)
+    draw_dashes (&cell, line_arms[index], 2);
+  else if (chr >= 0x2571 && chr <= 0x2573)
+    draw_diagonals (&cell, chr != 0x2572, chr != 0x2571);
+  else
+    draw_lines (&cell, line_arms[index]);
+}
@@ -0,0 +1,34 @@
+/* Boxdraw -- procedural rendering of box drawing, block and shade characters.
+ */
+#ifndef __BOXDRAW_H__
+#define __BOXDRAW_H__
+
+#include <glib.h>
+
+#include "raster.h"
+
+G_BEGIN_DECLS
+
+
+/* Characters drawn procedurally: box drawing (U+2500..U+257F) and
+ * block elements (U+2580..U+259F).
+ */
+#define BOXDRAW_FIRST_CHAR      0x2500
+#define BOXDRAW_LAST_CHAR       0x259f
+
+#define BOXDRAW_IS_BOX_CHAR(c)  ((c) >= BOXDRAW_FIRST_CHAR && (c) <= BOXDRAW_LAST_CHAR)
+
+void    boxdraw_render  (RasterImage   *image,
+                         gint           x,
+                         gint           y,
+                         gint           width,
+                         gint           height,
+                         gint           phase_x,
+                         gint           phase_y,
+                         gunichar       chr,
+                         guint32        color);
+
+
+G_END_DECLS
+
+#endif /* __BOXDRAW_H__ */
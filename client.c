@@ -9,7 +9,6 @@
 #include <errno.h>
 
 #include "console.h"
-#include "colors.h"
 #include "internal.h"
 #include "chn.h"
 #include "fiorw.h"
@@ -160,6 +159,8 @@ static void
 client_write_console (guchar *buf, guint len)
 {
   gchar *p, *end;
+  gunichar *chars;
+  gint n;
 
   g_return_if_fail (console != NULL);
   g_return_if_fail (IS_CONSOLE (console));
@@ -167,6 +168,10 @@ client_write_console (guchar *buf, guint len)
   p = (gchar *)buf;
   end = p + len;
 
+  /* there are no more characters than bytes */
+  chars = g_new (gunichar, len);
+  n = 0;
+
   while (*p != '\0' && p < end)
   {
     gunichar uc;
@@ -175,49 +180,40 @@ client_write_console (guchar *buf, guint len)
         && (g_unichar_isprint (uc) || g_unichar_isspace (uc)
             || uc == DEL || uc == BS || uc == BEL))
       {
-        console_put_char (CONSOLE (console), uc);
+        chars[n++] = uc;
       }
     p = g_utf8_next_char (p);
   }
+
+  console_put_chars (CONSOLE (console), chars, n);
+
+  g_free (chars);
 }
 
 static void
 client_change_color (gint foreground, gint background)
 {
-  static gchar *color_list[] =
-    {
-      COLOR_BLACK, COLOR_BLUE, COLOR_GREEN, COLOR_CYAN,
-      COLOR_RED, COLOR_MAGENTA, COLOR_YELLOW, COLOR_WHITE,
-      COLOR_BRBLACK, COLOR_BRBLUE, COLOR_BRGREEN, COLOR_BRCYAN,
-      COLOR_BRRED, COLOR_BRMAGENTA, COLOR_BRYELLOW, COLOR_BRWHITE
-    };
-
-  GdkColor fg_color, bg_color;
-
-  g_return_if_fail (foreground >= 0 && foreground < G_N_ELEMENTS (color_list));
-  g_return_if_fail (background >= 0 && background < G_N_ELEMENTS (color_list));
+  g_return_if_fail (foreground >= 0 && foreground < CONSOLE_PALETTE_SIZE);
+  g_return_if_fail (background >= 0 && background < CONSOLE_PALETTE_SIZE);
   g_return_if_fail (console != NULL);
   g_return_if_fail (IS_CONSOLE (console));
 
-  gdk_color_parse (color_list[foreground], &fg_color);
-  gdk_color_parse (color_list[background], &bg_color);
-
-  console_set_foreground_color (CONSOLE (console), &fg_color);
-  console_set_background_color (CONSOLE (console), &bg_color);
+  console_set_foreground_index (CONSOLE (console), foreground);
+  console_set_background_index (CONSOLE (console), background);
 }
 
 static void
 client_scroll_box_up (guint x1, guint y1, guint x2, guint y2, guint color, guint nr)
 {
-  GdkColor fg_color, bg_color;
+  gint fg_color, bg_color;
   guint box_width, box_height;
 
   g_return_if_fail (console != NULL && IS_CONSOLE (console));
 
   DEBUG (">> C_SCROLL_BOX_UP x1=%d y1=%d x2=%d y2=%d color=0x%02x nr=%d", x1, y1, x2, y2, color, nr);
 
-  console_get_foreground_color (CONSOLE (console), &fg_color);
-  console_get_background_color (CONSOLE (console), &bg_color);
+  fg_color = console_get_foreground_index (CONSOLE (console));
+  bg_color = console_get_background_index (CONSOLE (console));
 
   client_change_color (FG_COLOR (color), BG_COLOR (color));
 
@@ -226,22 +222,22 @@ client_scroll_box_up (guint x1, guint y1, guint x2, guint y2, guint color, guint
 
   console_scroll_box_up (CONSOLE (console), x1, y1, box_width, box_height, nr);
 
-  console_set_foreground_color (CONSOLE (console), &fg_color);
-  console_set_background_color (CONSOLE (console), &bg_color);
+  console_set_foreground_index (CONSOLE (console), fg_color);
+  console_set_background_index (CONSOLE (console), bg_color);
 }
 
 static void
 client_scroll_box_down (guint x1, guint y1, guint x2, guint y2, guint color, guint nr)
 {
-  GdkColor fg_color, bg_color;
+  gint fg_color, bg_color;
   guint box_width, box_height;
 
   g_return_if_fail (console != NULL && IS_CONSOLE (console));
 
   DEBUG (">> C_SCROLL_BOX_DOWN x1=%d y1=%d x2=%d y2=%d color=0x%02x nr=%d", x1, y1, x2, y2, color, nr);
 
-  console_get_foreground_color (CONSOLE (console), &fg_color);
-  console_get_background_color (CONSOLE (console), &bg_color);
+  fg_color = console_get_foreground_index (CONSOLE (console));
+  bg_color = console_get_background_index (CONSOLE (console));
 
   client_change_color (FG_COLOR (color), BG_COLOR (color));
 
@@ -250,8 +246,8 @@ client_scroll_box_down (guint x1, guint y1, guint x2, guint y2, guint color, gui
 
   console_scroll_box_down (CONSOLE (console), x1, y1, box_width, box_height, nr);
 
-  console_set_foreground_color (CONSOLE (console), &fg_color);
-  console_set_background_color (CONSOLE (console), &bg_color);
+  console_set_foreground_index (CONSOLE (console), fg_color);
+  console_set_background_index (CONSOLE (console), bg_color);
 }
 
 static void
@@ -756,6 +752,9 @@ client_do_input (guchar *buf, gsize len)
   inleft = 0;
   inptr = (gchar *)buf;
 
+  /* changes made by a chunk of input are painted together */
+  console_freeze (CONSOLE (console));
+
   for (i = 0; i < len; i++)
     {
       guchar c;
@@ -1191,5 +1190,7 @@ client_do_input (guchar *buf, gsize len)
       else
         client_write_console (buffer, sizeof (buffer)-outleft);
     }
+
+  console_thaw (CONSOLE (console));
 }
 
@@ -11,6 +11,12 @@
 #include "console_marshal.h"
 #include "colors.h"
 #include "fc.h"
+#include "glyph.h"
+#include "glyphcache.h"
+#include "ftcache.h"
+#include "raster.h"
+#include "boxdraw.h"
+#include "scrollback.h"
 
 /* ASCII control characters treated specially by console window.
  */
@@ -40,7 +46,13 @@ typedef enum
   PROP_FONT_STYLE,
   PROP_FONT_SIZE,
   PROP_CURSOR_SHAPE,
-  PROP_CURSOR_TIMER
+  PROP_CURSOR_TIMER,
+  PROP_MAX_FPS,
+  PROP_RENDER_THREADS,
+  PROP_ROW_CACHE_SIZE,
+  PROP_FONT_CACHE_SIZE,
+  PROP_SCROLLBACK_LINES,
+  PROP_SCROLLBACK_SPILL
 } ConsolePropertyId;
 
 /* Enumeration of the console property change mask.
@@ -64,10 +76,26 @@ enum {
 
 static guint        console_signals[LAST_SIGNAL] = { 0 };
 
+/* Memory budget of the FreeType cache in kilobytes, see
+ * console_set_freetype_cache_size().
+ */
+static gint         freetype_cache_size = 0;
+
 /* This macro rounds up x to multiples of a.
  */
 #define ROUND_UP(x, a) ((((x) + 1) / (a)) * (a))
 
+/* This macro returns characters of the screen row y.
+ */
+#define SCREEN_ROW(priv, y) ((priv)->rows[((priv)->rows_head + (y)) % (priv)->height])
+
+/* This macro returns characters displayed in the row y, the view shows
+ * history lines above the screen when it is scrolled back.
+ */
+#define VIEW_ROW(priv, y)   ((y) < (priv)->view_offset ?                                \
+                             (priv)->view + (y)*(priv)->width :                         \
+                             SCREEN_ROW (priv, (y) - (priv)->view_offset))
+
 /* Console widget property constants.
  */
 #define CONSOLE_WIDTH_MIN       1
@@ -80,8 +108,17 @@ static guint        console_signals[LAST_SIGNAL] = { 0 };
 
 #define FONT_FAMILY_DEFAULT     "Andale Mono"
 #define FONT_STYLE_DEFAULT      "normal"
+#define FONT_SIZE_MIN           6
+#define FONT_SIZE_MAX           72
 #define FONT_SIZE_DEFAULT       12
 
+/* Font sizes console zoom steps through.
+ */
+static const gint zoom_sizes[] =
+{
+  6, 7, 8, 9, 10, 11, 12, 13, 14, 16, 18, 20, 22, 24, 28, 32, 36, 40, 48, 56, 64, 72
+};
+
 /* GDK color scale to convert to cairo colorspace.
  */
 #define GDK_COLOR_SCALE         65535.0
@@ -90,6 +127,29 @@ static guint        console_signals[LAST_SIGNAL] = { 0 };
  */
 #define UTF8_CHAR_LEN_MAX       6
 
+/* Number of entries in the character to glyph index map, the map covers
+ * the basic multilingual plane.
+ */
+#define CHAR_MAP_SIZE           0x10000
+
+/* Glyphs of fallback faces are kept in the atlas under ids made of the
+ * fallback face number, starting from one, and the glyph index. The ids
+ * are beyond glyph indices of any font.
+ */
+#define FALLBACK_SHIFT          16
+#define FALLBACK_FACES_MAX      255
+#define FALLBACK_ID(n, index)   (((n) << FALLBACK_SHIFT) | (index))
+#define FALLBACK_FACE(id)       ((id) >> FALLBACK_SHIFT)
+#define FALLBACK_GLYPH(id)      ((id) & ((1 << FALLBACK_SHIFT) - 1))
+
+/* Coverage entry of a character no font has, which was already reported.
+ */
+#define COVERAGE_MISSING        (1u << 31)
+
+/* FreeType flags glyphs are loaded with.
+ */
+#define GLYPH_LOAD_FLAGS        (FT_LOAD_RENDER | FT_LOAD_DEFAULT)
+
 /* Size of console tab bitmap table.
  */
 #define TABMAP_SIZE             8
@@ -98,6 +158,51 @@ static guint        console_signals[LAST_SIGNAL] = { 0 };
  */
 #define CURSOR_BLINKING_TIMER   250
 
+/* Frame rate limits, zero means the frame rate is not limited.
+ */
+#define MAX_FPS_MIN             0
+#define MAX_FPS_MAX             1000
+#define MAX_FPS_DEFAULT         60
+
+/* Number of threads rendering large screen updates, zero means the
+ * screen is always rendered by the main thread.
+ */
+#define RENDER_THREADS_MIN      0
+#define RENDER_THREADS_MAX      64
+#define RENDER_THREADS_DEFAULT  0
+
+/* Minimum number of characters in an update to render it in parallel
+ * bands, smaller updates aren't worth the threading overhead.
+ */
+#define BAND_RENDER_MIN_CELLS   2048
+
+/* Memory budget in kilobytes of rendered rows kept in the row cache, zero
+ * disables the cache.
+ */
+#define ROW_CACHE_SIZE_MIN      0
+#define ROW_CACHE_SIZE_MAX      (1024 * 1024)
+#define ROW_CACHE_SIZE_DEFAULT  (8 * 1024)
+
+/* Memory budget in kilobytes of fonts kept to switch back to them without
+ * loading, zero disables the font cache.
+ */
+#define FONT_CACHE_SIZE_MIN     0
+#define FONT_CACHE_SIZE_MAX     (1024 * 1024)
+#define FONT_CACHE_SIZE_DEFAULT (16 * 1024)
+
+/* Memory budget in kilobytes of the FreeType cache shared by consoles,
+ * zero means the FreeType default.
+ */
+#define FREETYPE_CACHE_SIZE_MIN 0
+#define FREETYPE_CACHE_SIZE_MAX (1024 * 1024)
+
+/* Number of lines scrolled off the screen kept in the history, zero
+ * disables the history.
+ */
+#define SCROLLBACK_LINES_MIN    0
+#define SCROLLBACK_LINES_MAX    1000000
+#define SCROLLBACK_LINES_DEFAULT 10000
+
 typedef struct _ConsoleColor
 {
   double red;
@@ -120,14 +225,150 @@ typedef struct {
   gdouble y2;                   /* stop y coordinate in pixels */
 } ConsoleTextSelection;
 
+/* Screen character cell packed into 8 bytes. Colors are kept as palette
+ * indices and resolved to RGB values at draw time. The layout is the one
+ * of ScrollbackCell, rows are moved to the history as they are.
+ */
 typedef struct _ConsoleChar
 {
   gunichar chr;                 /* unicode symbol */
-  ConsoleCharAttr attr;         /* character attributes */
-  ConsoleColor color;           /* foreground character color */
-  ConsoleColor bg_color;        /* background character color */
+  guint8 color;                 /* foreground and background palette indices */
+  guint8 attr;                  /* character attributes */
+  guint16 reserved;             /* unused, always zero */
 } ConsoleChar;
 
+G_STATIC_ASSERT (sizeof (ConsoleChar) == sizeof (ScrollbackCell));
+
+/* These macros pack and unpack palette indices of foreground (low nibble)
+ * and background (high nibble) colors of a character cell.
+ */
+#define CHAR_COLOR(fg, bg)      (((fg) & 0x0f) | (((bg) & 0x0f) << 4))
+#define CHAR_FG(color)          ((color) & 0x0f)
+#define CHAR_BG(color)          (((color) >> 4) & 0x0f)
+
+/* This macro returns TRUE if the cell already keeps the character with the
+ * colors and attributes given.
+ */
+#define CHAR_EQUAL(cell, c, col, at) ((cell)->chr == (c) && (cell)->color == (col) && (cell)->attr == (at))
+
+/* Palette indices of the default foreground and background colors.
+ */
+#define PALETTE_FG_DEFAULT      9
+#define PALETTE_BG_DEFAULT      8
+
+/* Default palette ordered the same way as PC text mode colors.
+ */
+static const gchar *default_palette[CONSOLE_PALETTE_SIZE] =
+{
+  COLOR_BLACK, COLOR_BLUE, COLOR_GREEN, COLOR_CYAN,
+  COLOR_RED, COLOR_MAGENTA, COLOR_YELLOW, COLOR_WHITE,
+  COLOR_BRBLACK, COLOR_BRBLUE, COLOR_BRGREEN, COLOR_BRCYAN,
+  COLOR_BRRED, COLOR_BRMAGENTA, COLOR_BRYELLOW, COLOR_BRWHITE
+};
+
+/* Range of characters in a screen row which need to be redrawn.
+ */
+typedef struct _ConsoleDirtySpan
+{
+  gint x1;                      /* leftmost dirty column, -1 if the row is clean */
+  gint x2;                      /* rightmost dirty column */
+} ConsoleDirtySpan;
+
+/* Screen box rendered by the band renderer. The main thread fills it in,
+ * the render threads only read it.
+ */
+typedef struct _ConsoleBandJob
+{
+  ConsolePrivate *priv;         /* console the screen belongs to */
+  gint x1;                      /* leftmost column of the box */
+  gint y1;                      /* top row of the box */
+  gint x2;                      /* column right after the box */
+  gint y2;                      /* row right below the box */
+  GdkRectangle selection;       /* text selection area in pixels */
+  gboolean cursor;              /* TRUE to draw the cursor over its character */
+  const GlyphSlot **slots;      /* glyphs of box characters, NULL for blanks */
+  const guint8 *atlas_data;     /* pixels of the glyph atlas */
+  gint atlas_stride;            /* distance between atlas rows in bytes */
+  guint32 palette[CONSOLE_PALETTE_SIZE]; /* palette in the raster color format */
+} ConsoleBandJob;
+
+/* Horizontal band of the box, rendered by one thread.
+ */
+typedef struct _ConsoleBand
+{
+  ConsoleBandJob *job;          /* box the band belongs to */
+  gint y1;                      /* top row of the band */
+  gint y2;                      /* row right below the band */
+  cairo_surface_t *surface;     /* rendered band pixels */
+  RasterImage image;            /* pixel buffer of the surface */
+} ConsoleBand;
+
+/* Rendered screen row kept in the row cache.
+ */
+typedef struct _ConsoleRowCacheEntry
+{
+  guint64 hash;                 /* hash of the row contents, the cache key */
+  ConsoleChar *cells;           /* copy of the row contents */
+  gint width;                   /* row width in characters */
+  gdouble dpi;                  /* screen resolution the row was rendered at */
+  gint phase;                   /* vertical phase of shade patterns in the row */
+  cairo_surface_t *surface;     /* rendered row pixels */
+  gsize size;                   /* memory size of the entry */
+  GList link;                   /* position in the LRU list */
+} ConsoleRowCacheEntry;
+
+/* Face characters missing in the console font are rendered from.
+ */
+typedef struct _ConsoleFallback
+{
+  FtFace *face;                 /* face in the FreeType cache */
+  gint font_size;               /* font size char_size was calculated for */
+  gdouble dpi;                  /* screen resolution char_size was calculated for */
+  gint char_width;              /* character cell width char_size was calculated for */
+  gint char_height;             /* character cell height char_size was calculated for */
+  FT_F26Dot6 char_size;         /* size glyphs are rendered at to fit character cells */
+} ConsoleFallback;
+
+/* Font loaded for another size or family than the current one, kept to
+ * switch back to it without loading.
+ */
+typedef struct _ConsoleFont
+{
+  gchar *font_file;             /* path to font file */
+  gint face_index;              /* font face index in the file */
+  gint font_size;               /* font size in points */
+  gdouble dpi;                  /* screen resolution */
+  gint char_width;              /* character width in pixels */
+  gint char_height;             /* character height in pixels */
+  gint baseline;                /* baseline position in pixels */
+  guint32 *char_map;            /* glyph indices of BMP characters */
+  gboolean char_map_complete;   /* FALSE if char_map keeps cached characters only */
+  GlyphAtlas *atlas;            /* rasterised glyphs */
+  gsize size;                   /* memory size of the font in bytes */
+  GList link;                   /* position in the LRU list */
+} ConsoleFont;
+
+/* Font prepared by the background font loader. The first group of fields
+ * is filled in by the main thread, the second one by the loader thread.
+ */
+typedef struct _ConsoleFontJob
+{
+  Console *console;             /* console the font is prepared for */
+  gchar *font_file;             /* path to font file */
+  gint face_index;              /* font face index in the file */
+  gint font_size;               /* font size in points */
+  gdouble dpi;                  /* screen resolution */
+  GArray *chars;                /* characters to rasterise */
+  volatile gint cancelled;      /* TRUE if the font isn't wanted any more */
+
+  gint char_width;              /* character width in pixels */
+  gint char_height;             /* character height in pixels */
+  gint baseline;                /* baseline position in pixels */
+  guint32 *char_map;            /* glyph indices of BMP characters */
+  gboolean char_map_complete;   /* FALSE if char_map keeps cached characters only */
+  GlyphAtlas *atlas;            /* rasterised glyphs, NULL if the font failed to load */
+} ConsoleFontJob;
+
 /* Private structure for a console widget instance.
  */
 struct _ConsolePrivate {
@@ -138,6 +379,12 @@ struct _ConsolePrivate {
   gint height;                  /* screen height in characters */
 
   ConsoleChar *scr;             /* console screen buffer */
+  ConsoleChar **rows;           /* screen rows in the buffer, starting from rows_head */
+  gint rows_head;               /* index of the top screen row in rows */
+
+  Scrollback *scrollback;       /* lines scrolled off the screen */
+  gint view_offset;             /* number of history lines the view is scrolled back */
+  ConsoleChar *view;            /* history lines displayed above the screen */
 
   gint char_width;              /* character width in pixels */
   gint char_height;             /* character height in pixels */
@@ -150,11 +397,35 @@ struct _ConsolePrivate {
   gchar *font_style;            /* name of the font family (`italic', 'roman', etc) */
   gint font_size;               /* font size in points (1/72 inches) */
   gint face_index;              /* font face index used by FT_Face_New */
+  gint face_size;               /* font size the face is rendered at, differs from
+                                   font_size until a new font is loaded */
+  gdouble face_dpi;             /* screen resolution the font is loaded for */
+
+  FtCache *ftcache;             /* FreeType cache shared by consoles */
+  FtFace *face;                 /* current font face in the cache, NULL until used */
+  FcFallback *fallback_chain;   /* fonts searched for characters missing in the font */
+  GPtrArray *fallbacks;         /* fallback faces used so far, never removed */
+  guint32 *coverage;            /* fallback glyph ids of BMP characters missing in
+                                   the font, 0 if not looked up yet */
+  GHashTable *coverage_astral;  /* fallback glyph ids of characters out of the BMP */
+  guint32 *char_map;            /* glyph indices of BMP characters, 0 if missing */
+  gboolean char_map_complete;   /* FALSE if char_map keeps cached characters only */
+  GlyphAtlas *atlas;            /* rasterised glyphs of the current font */
+  gdouble atlas_dpi;            /* screen resolution the atlas was rendered at */
+  guint font_changes;           /* font properties changed since the font was
+                                   loaded, see ConsolePropertyMask */
+
+  /* background font loader
+   */
+  GThreadPool *font_pool;       /* thread loading fonts */
+  ConsoleFontJob *font_job;     /* font being loaded, NULL if none */
+  guint font_job_id;            /* idle source starting the font loader */
 
-  FT_Library ftlib;             /* FreeType library instance */
-  FTC_Manager manager;          /* FreeType cache manager */
-  FTC_CMapCache cmapcache;      /* character map cache */
-  FTC_SBitCache sbitcache;      /* small bitmap cache */
+  /* fonts used recently
+   */
+  gint font_cache_size;         /* memory budget of the font cache in kilobytes */
+  GQueue font_lru;              /* cached fonts, most recently used first */
+  gsize font_cache_bytes;       /* memory size of cached fonts */
 
   /* state variables
    */
@@ -163,12 +434,57 @@ struct _ConsolePrivate {
   gint cursor_shape;            /* cursor appearance */
   gboolean cursor_toggle;       /* cursor on/off blinker  */
   guint cursor_timer_id;        /* cursor blink timer */
-  ConsoleColor color;           /* character foreground color */
-  ConsoleColor bg_color;        /* character background color */
+  guint8 color;                 /* character colors, see CHAR_COLOR */
   ConsoleCharAttr attr;         /* character attributes */
+  ConsoleColor palette[CONSOLE_PALETTE_SIZE]; /* colors referenced by characters */
 
   ConsoleTextSelection text_selection; /* text selection area structure */
 
+  /* damage accumulated since the last flush
+   */
+  ConsoleDirtySpan *dirty;      /* per-row dirty spans */
+  gint dirty_y1;                /* topmost dirty row */
+  gint dirty_y2;                /* bottommost dirty row, less than dirty_y1 if clean */
+  guint damage_flush_id;        /* idle source flushing the damage */
+  gboolean cursor_moved;        /* TRUE if the cursor moved since the last frame */
+  gint cursor_old_x;            /* cursor position displayed by the last frame */
+  gint cursor_old_y;
+  gint freeze_count;            /* number of console_freeze() calls not thawed yet */
+
+  /* frame scheduler
+   */
+  gint max_fps;                 /* maximum number of frames per second, 0 if unlimited */
+  gint64 last_frame_time;       /* monotonic time of the last frame in microseconds */
+  guint frame_timer_id;         /* timer painting the deferred frame */
+  ConsoleStats stats;           /* rendering statistics */
+
+  /* offscreen copy of the rendered screen
+   */
+  GdkPixmap *backing;           /* rendered screen, exposes are copied from it */
+  GdkGC *backing_gc;            /* graphics context to copy the backing pixmap */
+  gboolean backing_valid;       /* FALSE if the whole backing pixmap is stale */
+
+  /* cursor overlay
+   */
+  GdkPixmap *cursor_pixmap;     /* character under the cursor with the cursor drawn */
+  gint cursor_pixmap_x;         /* x coordinate of the character in the cursor pixmap */
+  gint cursor_pixmap_y;         /* y coordinate of the character in the cursor pixmap */
+  gboolean cursor_valid;        /* FALSE if the cursor pixmap is stale */
+
+  /* parallel band renderer
+   */
+  gint render_threads;          /* number of render threads, 0 if disabled */
+  GThreadPool *render_pool;     /* threads rendering bands */
+  GAsyncQueue *render_done;     /* bands rendered by the threads */
+
+  /* cache of rendered rows
+   */
+  gint row_cache_size;          /* memory budget of the row cache in kilobytes,
+                                   0 if disabled */
+  gsize row_cache_bytes;        /* memory size of cached rows */
+  GHashTable *row_cache;        /* cached rows by contents hash */
+  GQueue row_lru;               /* cached rows, most recently used first */
+
   /* horizontal TAB position bitmap
    */
   guint32 tabs[TABMAP_SIZE];
@@ -184,8 +500,8 @@ static void     console_size_request            ();
 static void     console_size_allocate           ();
 static void     console_realize                 ();
 static gboolean console_expose                  ();
-static void     console_draw                    (GtkWidget      *widget,
-                                                 GdkEventExpose *event);
+static void     console_draw                    (Console        *console,
+                                                 GdkRegion      *region);
 static void     console_set_property            (GObject        *object,
                                                  guint           prop_id,
                                                  const GValue   *value,
@@ -196,11 +512,33 @@ static void     console_get_property            (GObject        *object,
                                                  GParamSpec     *pspec);
 static void     console_finalize                (GObject        *object);
 
-static void     invalidate_char_rect            (Console        *console,
+static void     damage_box                      (Console        *console,
+                                                 gint            x,
+                                                 gint            y,
+                                                 gint            box_width,
+                                                 gint            box_height);
+static void     damage_char                     (Console        *console,
                                                  gint            x,
                                                  gint            y);
-static void     invalidate_cursor_rect          (Console        *console);
+static void     damage_cursor                   (Console        *console);
+static void     damage_all                      (Console        *console);
+static void     view_reset                      (Console        *console);
+static void     row_cache_clear                 (ConsolePrivate *priv);
+static void     row_cache_trim                  (ConsolePrivate *priv,
+                                                 gsize           budget);
+static void     damage_reset                    (Console        *console);
+static void     console_redraw                  (Console        *console);
+static void     damage_scroll                   (Console        *console,
+                                                 gint            x,
+                                                 gint            y,
+                                                 gint            box_width,
+                                                 gint            box_height,
+                                                 gint            dy);
 static gboolean console_cursor_timer            (gpointer        user_data);
+static void     expose_cursor                   (Console        *console,
+                                                 GdkRegion      *region);
+static void     render_band_func                (gpointer        data,
+                                                 gpointer        user_data);
 static gboolean console_primary_text_selected   (Console        *console,
                                                  const gchar    *str);
 static gboolean console_clipboard_text_selected (Console        *console,
@@ -266,7 +604,9 @@ update_selection_rect (Console *console)
   rect.height = cs->y2 + (char_height - (int) cs->x2 % char_height) - rect.y;
   g_debug ("update_selection_rect: (%d %d) (%d %d)", rect.x, rect.y, rect.width, rect.height);
 
-  gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, FALSE);
+  damage_box (console, rect.x / char_width, rect.y / char_height,
+              (rect.width + char_width - 1) / char_width,
+              (rect.height + char_height - 1) / char_height);
 }
 
 static gboolean
@@ -387,11 +727,7 @@ get_selected_text(Console *console)
     {
       for (j = x1; j <= x2; j++)
         {
-          int coord;
-
-          coord = i * console->priv->width + j;
-          g_string_append_unichar (res, console->priv->scr[coord].chr);
-
+          g_string_append_unichar (res, VIEW_ROW (console->priv, i)[j].chr);
         }
       if (i < y2)
         {
@@ -423,7 +759,7 @@ console_button_release_event_cb (GtkWidget *widget, GdkEventButton *event, gpoin
       s = get_selected_text (console);
 
       g_signal_emit (console, console_signals[PRIMARY_TEXT_SELECTED], 0, s->str, &ret);
-      gtk_widget_queue_draw (widget);
+      console_redraw (console);
 
       cs->x1 = cs->x2 = -1;
       cs->y1 = cs->y2 = -1;
@@ -453,7 +789,7 @@ console_motion_notify_event_cb (GtkWidget *widget, GdkEventMotion *event, gpoint
       if (event->y >= 0)
         cs->y2 = event->y;
 
-      gtk_widget_queue_draw (widget);
+      console_redraw (console);
 
       return TRUE;
     }
@@ -461,234 +797,1229 @@ console_motion_notify_event_cb (GtkWidget *widget, GdkEventMotion *event, gpoint
   return FALSE;
 }
 
-/* This helper allocates a font face and is called only by
- * the cache manager when needed. It's purpose is to let
- * cache manager to be system dependencies aware.
+/* This helper forgets fonts characters missing in the current font were
+ * found in. The fallback faces are kept, so glyph ids stay valid.
  */
-static FT_Error
-console_face_requester (FTC_FaceID id, FT_Library lib, FT_Pointer data, FT_Face *aface)
+static void
+console_coverage_reset (ConsolePrivate *priv)
 {
-  ConsolePrivate *priv;
-  FT_Face face;
-  FT_Error error;
-
-  g_assert (lib != NULL && id != NULL);
-  g_assert (aface != NULL);
-
-  *aface = NULL;
-
-  /* Face ID is a ConsolePrivate structure passed to cache lookup routines as
-   * a parameter.
-   */
-  priv = (ConsolePrivate *) id;
+  if (priv->fallback_chain != NULL)
+    fc_fallback_free (priv->fallback_chain);
 
-  g_assert (priv->face_index >= 0);
-  g_assert (priv->font_file != NULL);
-  g_assert (priv->ftlib == lib);
-
-  g_debug ("requesting font file '%s' face index %d", priv->font_file, priv->face_index);
+  if (priv->coverage_astral != NULL)
+    g_hash_table_destroy (priv->coverage_astral);
 
-  error = FT_New_Face (lib, priv->font_file, priv->face_index, &face);
+  g_free (priv->coverage);
 
-  if (error == 0)
-    *aface = face;
-
-  return error;
+  priv->fallback_chain = NULL;
+  priv->coverage = NULL;
+  priv->coverage_astral = NULL;
 }
 
-/* This helper initializes FreeType cache and library.
+/* This helper initializes FreeType cache and related data.
  */
 static void
 console_font_cache_init (ConsolePrivate *priv)
 {
-  FT_Library lib;
-  FTC_Manager manager;
-  FTC_SBitCache sbitcache;
-  FTC_CMapCache cmapcache;
-  gint error;
-
   g_assert (priv != NULL);
 
-  error = FT_Init_FreeType (&lib);
-  if (error)
-    g_error ("can't init freetype library");
-
-  error = FTC_Manager_New (lib, 0, 0, 0, console_face_requester, NULL, &manager);
-  if (error)
-    g_error ("can't create cache manager");
-
-  error = FTC_CMapCache_New (manager, &cmapcache);
-  if (error)
-    g_error ("can't create cmap cache");
-
-  error = FTC_SBitCache_New (manager, &sbitcache);
-  if (error)
-    g_error ("can't create sbit cache");
-
-  priv->ftlib = lib;
-  priv->manager = manager;
-  priv->sbitcache = sbitcache;
-  priv->cmapcache = cmapcache;
+  /* FreeType cache is shared by all consoles */
+  priv->ftcache = ft_cache_ref ();
+  priv->face = NULL;
+
+  /* fallback fonts are looked up on the first missing character */
+  priv->fallback_chain = NULL;
+  priv->fallbacks = g_ptr_array_new ();
+  priv->coverage = NULL;
+  priv->coverage_astral = NULL;
+
+  /* character map and glyph atlas are created on the first glyph lookup */
+  priv->char_map = NULL;
+  priv->char_map_complete = FALSE;
+  priv->atlas = NULL;
+  priv->atlas_dpi = 0.0;
 }
 
 /* This helper resets the cache and related data. It is invoked
- * each time the console font is changed.
+ * each time the console font file is changed.
  */
 static void
 console_font_cache_reset (ConsolePrivate *priv)
 {
   g_assert (priv != NULL);
-  g_assert (priv->manager != NULL);
+  g_assert (priv->ftcache != NULL);
 
   g_debug ("reseting font cache...");
 
-  FTC_Manager_RemoveFaceID (priv->manager, priv);
-  FTC_Manager_Reset (priv->manager);
+  /* The face is looked up again for the new font file. The old one is
+   * flushed from the shared cache unless other consoles use it.
+   */
+  if (priv->face != NULL)
+    ft_cache_face_unref (priv->face);
+
+  if (priv->atlas != NULL)
+    glyph_atlas_free (priv->atlas);
+
+  /* rows rendered with the old font are useless */
+  row_cache_clear (priv);
+
+  g_free (priv->char_map);
+
+  /* the new font may have other characters */
+  console_coverage_reset (priv);
+
+  priv->face = NULL;
+  priv->atlas = NULL;
+  priv->char_map = NULL;
+  priv->char_map_complete = FALSE;
 }
 
-/* This helper deinitializes FreeType library and deallocates the cache.
+/* This helper releases the FreeType cache and deallocates related data.
  */
 static void
 console_font_cache_deinit (ConsolePrivate *priv)
 {
+  guint i;
+
   g_assert (priv != NULL);
 
-  /* Cache manager owns all other caches. Destroying the manager
-   * destroys other caches as well.
-   */
-  if (priv->manager != NULL)
-    FTC_Manager_Done (priv->manager);
+  if (priv->face != NULL)
+    ft_cache_face_unref (priv->face);
 
-  if (priv->ftlib != NULL)
-    FT_Done_FreeType (priv->ftlib);
+  console_coverage_reset (priv);
 
-  priv->manager = NULL;
-  priv->ftlib = NULL;
+  for (i = 0; i < priv->fallbacks->len; i++)
+    {
+      ConsoleFallback *fallback = g_ptr_array_index (priv->fallbacks, i);
 
-  /* We are safe to NULLify pointers here because cache manager
-   * destruction was responsible to free them for us.
-   */
-  priv->cmapcache = NULL;
-  priv->sbitcache = NULL;
+      ft_cache_face_unref (fallback->face);
+      g_free (fallback);
+    }
+
+  g_ptr_array_free (priv->fallbacks, TRUE);
+  priv->fallbacks = NULL;
+
+  if (priv->ftcache != NULL)
+    ft_cache_unref (priv->ftcache);
+
+  if (priv->atlas != NULL)
+    glyph_atlas_free (priv->atlas);
+
+  g_free (priv->char_map);
+
+  priv->atlas = NULL;
+  priv->char_map = NULL;
+  priv->char_map_complete = FALSE;
+  priv->face = NULL;
+  priv->ftcache = NULL;
 }
 
-GType
-console_get_type (void)
+/* This helper returns the face id of the current font in the FreeType
+ * cache.
+ */
+static FTC_FaceID
+console_face_id (ConsolePrivate *priv)
 {
-  static GType type = 0;
+  g_assert (priv->font_file != NULL);
 
-  if (type == 0)
-    {
-      static const GTypeInfo info =
-        {
-          sizeof (ConsoleClass),
-          NULL,                        /* base_init */
-          NULL,                        /* base_finalize */
-          (GClassInitFunc) console_class_init,        /* class_init */
-          NULL,                        /* class_finalize */
-          NULL,                        /* class_data */
-          sizeof(Console),
-          0,                        /* n_preallocs */
-          (GInstanceInitFunc) console_init        /* instance_init */
-        };
-      type = g_type_register_static (GTK_TYPE_WIDGET,
-                                     "Console",
-                                     &info, 0);
-    }
+  if (priv->face == NULL)
+    priv->face = ft_cache_face_ref (priv->ftcache, priv->font_file, priv->face_index);
 
-  return type;
+  return (FTC_FaceID) priv->face;
 }
 
-/* Public functions available to user.
+/* This helper stores glyph indices of all BMP characters of the face
+ * in the character map.
  */
-
-GtkWidget*
-console_new()
+static void
+char_map_fill (FT_Face face, guint32 *map)
 {
-  return GTK_WIDGET (g_object_new (console_get_type (), NULL));
+  FT_ULong code;
+  FT_UInt index;
+
+  code = FT_Get_First_Char (face, &index);
+
+  while (index != 0)
+    {
+      if (code < CHAR_MAP_SIZE)
+        map[code] = index;
+
+      code = FT_Get_Next_Char (face, code, &index);
+    }
 }
 
-GtkWidget*
-console_new_with_size (gint width, gint height)
+/* This helper calculates character cell metrics of the face from its
+ * bounding box.
+ */
+static void
+font_metrics_compute (FT_Face face, gint font_size, gdouble dpi_x, gdouble dpi_y,
+                      gint *char_width, gint *char_height, gint *baseline)
 {
-  return GTK_WIDGET (g_object_new (console_get_type (), "width", width, "height", height, NULL));
+  double scale_x, scale_y;
+
+  /* Scale metrics using screen dpi and units per EM. */
+  scale_x = (font_size * dpi_x / 72.0) / (double) face->units_per_EM;
+  scale_y = (font_size * dpi_y / 72.0) / (double) face->units_per_EM;
+
+  g_debug ("scale_x = %f scale_y = %f", scale_x, scale_y);
+  g_debug ("ascender %d descender %d underline %d max_advance_width %d",
+           face->ascender >> 6, face->descender >> 6,
+           face->underline_position >> 6, face->max_advance_width >> 6);
+
+  /* Calculate font height, width and baseline position (in pixels). */
+  if (face->bbox.xMin < 0)
+    *char_width = face->bbox.xMax * scale_x + 0.5;
+  else
+    *char_width = (face->bbox.xMax + face->bbox.xMin) * scale_x + 0.5;
+
+  *char_height = (face->bbox.yMax - face->bbox.yMin) * scale_y + 0.5;
+  if (*char_height < 0)
+    *char_height = face->bbox.yMax * scale_y + 0.5;
+
+  *baseline = face->bbox.yMax * scale_y;
+
+  g_assert (*baseline >= 0);
+
+  g_debug ("xMin %d xMax %d yMax %d yMin %d", (int)face->bbox.xMin, (int)face->bbox.xMax, (int)face->bbox.yMax, (int)face->bbox.yMin);
+  g_debug ("char_width %d, char_height %d, baseline %d", *char_width, *char_height, *baseline);
 }
 
-/* This function sets up class structure, properties and registers signals. */
+/* This helper fills the character map with glyph indices of all BMP
+ * characters the current font face has. A map of cached characters is
+ * completed.
+ */
 static void
-console_class_init (ConsoleClass *klass)
+console_char_map_load (ConsolePrivate *priv)
 {
-  GtkWidgetClass *widget_class;
-  GObjectClass *object_class;
+  FT_Face face;
+  guint32 *map;
+  gint error;
 
-  g_debug ("console: class init");
+  map = priv->char_map;
+  if (map == NULL)
+    map = g_new0 (guint32, CHAR_MAP_SIZE);
 
-  widget_class = (GtkWidgetClass *) klass;
-  object_class = (GObjectClass *) klass;
+  error = FTC_Manager_LookupFace (priv->ftcache->manager, console_face_id (priv), &face);
+  if (error)
+    g_warning ("can't lookup face in the cache");
+  else
+    char_map_fill (face, map);
 
-  widget_class->realize = console_realize;
-  widget_class->size_request = console_size_request;
-  widget_class->size_allocate = console_size_allocate;
-  widget_class->expose_event = console_expose;
+  priv->char_map = map;
+  priv->char_map_complete = TRUE;
+}
 
-  object_class->set_property = console_set_property;
-  object_class->get_property = console_get_property;
+/* This helper returns the number of the fallback face, adding the face
+ * to the fallback faces if needed. It returns zero if there are too many
+ * fallback faces.
+ */
+static guint
+console_fallback_face (ConsolePrivate *priv, const gchar *file, gint face_index)
+{
+  ConsoleFallback *fallback;
+  FtFace *face;
+  guint i;
 
-  g_type_class_add_private (object_class, sizeof (ConsolePrivate));
+  face = ft_cache_face_ref (priv->ftcache, file, face_index);
 
-  g_object_class_install_property (object_class, PROP_WIDTH,
-                                   g_param_spec_int ("width",
-                                                     "Console Window Width",
-                                                     "The width of the console in characters",
-                                                     CONSOLE_WIDTH_MIN, CONSOLE_WIDTH_MAX,
-                                                     CONSOLE_WIDTH_DEFAULT,
-                                                     G_PARAM_READWRITE));
+  for (i = 0; i < priv->fallbacks->len; i++)
+    {
+      fallback = g_ptr_array_index (priv->fallbacks, i);
 
-  g_object_class_install_property (object_class, PROP_HEIGHT,
-                                   g_param_spec_int ("height",
-                                                     "Console Window Height",
-                                                     "The height of the console in characters",
-                                                     CONSOLE_HEIGHT_MIN, CONSOLE_HEIGHT_MAX,
-                                                     CONSOLE_HEIGHT_DEFAULT,
-                                                     G_PARAM_READWRITE));
+      if (fallback->face == face)
+        {
+          ft_cache_face_unref (face);
+          return i + 1;
+        }
+    }
 
-  g_object_class_install_property (object_class, PROP_FONT_SIZE,
-                                   g_param_spec_int ("font-size",
-                                                     "Console Window Font Size",
-                                                     "The size of the console font in points",
-                                                     6, 72, FONT_SIZE_DEFAULT,
-                                                     G_PARAM_READWRITE));
+  if (priv->fallbacks->len >= FALLBACK_FACES_MAX)
+    {
+      g_warning ("too many fallback fonts, ignoring font file '%s'", file);
+      ft_cache_face_unref (face);
+      return 0;
+    }
 
-  g_object_class_install_property (object_class, PROP_FONT_FAMILY,
-                                   g_param_spec_string ("font-family",
-                                                        "Console Font Family",
-                                                        "The font family name",
-                                                        FONT_FAMILY_DEFAULT,
-                                                        G_PARAM_READWRITE));
+  g_debug ("using fallback font file '%s' face index %d", file, face_index);
 
-  g_object_class_install_property (object_class, PROP_FONT_STYLE,
-                                   g_param_spec_string ("font-style",
-                                                        "Console Font Style",
-                                                        "The font style name",
-                                                        FONT_STYLE_DEFAULT,
-                                                        G_PARAM_READWRITE));
+  fallback = g_new0 (ConsoleFallback, 1);
+  fallback->face = face;
 
-  g_object_class_install_property (object_class, PROP_CURSOR_SHAPE,
-                                   g_param_spec_int ("cursor-shape",
-                                                     "Console Cursor Shape",
-                                                     "The shape of the console cursor",
-                                                     CONSOLE_CURSOR_DEFAULT, CONSOLE_CURSOR_VERT_HALF,
-                                                     CONSOLE_CURSOR_DEFAULT,
-                                                     G_PARAM_READWRITE));
+  g_ptr_array_add (priv->fallbacks, fallback);
 
-  g_object_class_install_property (object_class, PROP_CURSOR_TIMER,
-                                   g_param_spec_int ("cursor-timer",
-                                                     "Console Cursor Timer",
-                                                     "This sets the blinking timer for the cursor",
-                                                     CONSOLE_BLINK_STEADY, CONSOLE_BLINK_FAST,
-                                                     CONSOLE_BLINK_MEDIUM,
-                                                     G_PARAM_READWRITE));
-  klass->primary_text_pasted = NULL;
+  return priv->fallbacks->len;
+}
+
+/* This helper searches the fallback chain for unicode character uc and
+ * returns its fallback glyph id, or COVERAGE_MISSING if no font has it.
+ */
+static guint32
+console_fallback_resolve (ConsolePrivate *priv, gunichar uc)
+{
+  ConsoleFallback *fallback;
+  guint n, glyph_index;
+  gint face_index;
+  gchar *file;
+
+  if (priv->fallback_chain == NULL)
+    {
+      priv->fallback_chain = fc_fallback_new (priv->font_family ? priv->font_family : FONT_FAMILY_DEFAULT,
+                                              priv->font_style ? priv->font_style : FONT_STYLE_DEFAULT,
+                                              FALSE, TRUE);
+    }
+
+  if (fc_fallback_find (priv->fallback_chain, uc, &file, &face_index))
+    {
+      n = console_fallback_face (priv, file, face_index);
+      g_free (file);
+
+      if (n != 0)
+        {
+          fallback = g_ptr_array_index (priv->fallbacks, n - 1);
+          glyph_index = FTC_CMapCache_Lookup (priv->ftcache->cmapcache, (FTC_FaceID) fallback->face, -1, uc);
+
+          if (glyph_index != 0 && glyph_index < (1 << FALLBACK_SHIFT))
+            return FALLBACK_ID (n, glyph_index);
+        }
+    }
+
+  /* the miss is remembered by the caller, it is reported once */
+  g_debug ("no unicode char 0x%0x in character map", uc);
+
+  return COVERAGE_MISSING;
+}
+
+/* This helper returns the fallback glyph id of unicode character uc missing
+ * in the current font, or zero if no font has the character. Fonts are
+ * searched once per character, the result is kept in the coverage map.
+ */
+static guint
+console_fallback_index (ConsolePrivate *priv, gunichar uc)
+{
+  guint32 id;
+
+  if (uc < CHAR_MAP_SIZE)
+    {
+      if (priv->coverage == NULL)
+        priv->coverage = g_new0 (guint32, CHAR_MAP_SIZE);
+
+      id = priv->coverage[uc];
+
+      if (id == 0)
+        id = priv->coverage[uc] = console_fallback_resolve (priv, uc);
+    }
+  else
+    {
+      if (priv->coverage_astral == NULL)
+        priv->coverage_astral = g_hash_table_new (NULL, NULL);
+
+      id = GPOINTER_TO_UINT (g_hash_table_lookup (priv->coverage_astral, GUINT_TO_POINTER (uc)));
+
+      if (id == 0)
+        {
+          id = console_fallback_resolve (priv, uc);
+          g_hash_table_insert (priv->coverage_astral, GUINT_TO_POINTER (uc), GUINT_TO_POINTER (id));
+        }
+    }
+
+  return (id == COVERAGE_MISSING) ? 0 : id;
+}
+
+/* This helper returns the size glyphs of the fallback face are rendered at.
+ * Faces with larger character cells than the current font are scaled down
+ * to fit the cells.
+ */
+static FT_F26Dot6
+console_fallback_char_size (ConsolePrivate *priv, ConsoleFallback *fallback, gdouble dpi)
+{
+  FT_Face face;
+  gint char_width, char_height, baseline;
+  gdouble scale;
+
+  /* cells change with the console font, not only with its size
+   */
+  if (fallback->font_size == priv->face_size && fallback->dpi == dpi &&
+      fallback->char_width == priv->char_width && fallback->char_height == priv->char_height)
+    return fallback->char_size;
+
+  fallback->font_size = priv->face_size;
+  fallback->dpi = dpi;
+  fallback->char_width = priv->char_width;
+  fallback->char_height = priv->char_height;
+  fallback->char_size = priv->face_size << 6;
+
+  if (FTC_Manager_LookupFace (priv->ftcache->manager, (FTC_FaceID) fallback->face, &face) != 0)
+    return fallback->char_size;
+
+  font_metrics_compute (face, priv->face_size, dpi, dpi, &char_width, &char_height, &baseline);
+
+  scale = 1.0;
+
+  if (char_width > priv->char_width)
+    scale = MIN (scale, (gdouble) priv->char_width / char_width);
+
+  if (char_height > priv->char_height)
+    scale = MIN (scale, (gdouble) priv->char_height / char_height);
+
+  fallback->char_size = (priv->face_size << 6) * scale;
+
+  return fallback->char_size;
+}
+
+/* This helper returns the atlas id of the glyph of unicode character uc:
+ * its glyph index in the current font, or its fallback glyph id if the font
+ * lacks the character. It returns zero if no font has the character.
+ */
+static guint
+console_char_index (ConsolePrivate *priv, gunichar uc)
+{
+  guint glyph_index;
+
+  /* Characters out of the BMP are rare, look them up in the cache.
+   */
+  if (uc >= CHAR_MAP_SIZE)
+    glyph_index = FTC_CMapCache_Lookup (priv->ftcache->cmapcache, console_face_id (priv), 0, uc);
+  else
+    {
+      /* Characters missing in the map of cached characters may be in the font.
+       */
+      if (priv->char_map == NULL || (priv->char_map[uc] == 0 && !priv->char_map_complete))
+        console_char_map_load (priv);
+
+      glyph_index = priv->char_map[uc];
+    }
+
+  if (glyph_index == 0)
+    glyph_index = console_fallback_index (priv, uc);
+
+  return glyph_index;
+}
+
+/* This helper returns the atlas slot keeping the glyph of unicode character
+ * uc, rasterising the glyph into the atlas on its first use. It returns NULL
+ * if neither the font nor the fallback fonts have a glyph for the character.
+ */
+static const GlyphSlot*
+console_glyph_lookup (ConsolePrivate *priv, gunichar uc, gdouble dpi)
+{
+  FTC_SBit sbitmap;
+  FTC_ScalerRec scaler;
+  FTC_Node node;
+  const GlyphSlot *slot;
+  guint glyph_index, face_glyph_index;
+  gint error;
+
+  glyph_index = console_char_index (priv, uc);
+  if (glyph_index == 0)
+    return NULL;
+
+  /* The atlas keeps glyphs rendered for a single font size and resolution.
+   * Font changes reset it along with the cache, resolution changes are
+   * handled here. Atlases aren't shared by consoles: fallback glyph ids
+   * number fallback faces in the order the console met them, and fallback
+   * glyphs are scaled to the console cells. Bitmaps are shared through the
+   * FreeType cache anyway, atlases only keep copies of the ones shown.
+   */
+  if (priv->atlas != NULL && priv->atlas_dpi != dpi)
+    {
+      glyph_atlas_free (priv->atlas);
+      priv->atlas = NULL;
+    }
+
+  if (priv->atlas == NULL)
+    {
+      FT_Face face;
+
+      error = FTC_Manager_LookupFace (priv->ftcache->manager, console_face_id (priv), &face);
+      if (error)
+        {
+          g_warning ("can't lookup face in the cache");
+          return NULL;
+        }
+
+      priv->atlas = glyph_atlas_new (face->num_glyphs, priv->char_width, priv->char_height);
+      priv->atlas_dpi = dpi;
+    }
+
+  slot = glyph_atlas_lookup (priv->atlas, glyph_index);
+  if (slot != NULL)
+    return slot;
+
+  if (FALLBACK_FACE (glyph_index) != 0)
+    {
+      ConsoleFallback *fallback;
+
+      fallback = g_ptr_array_index (priv->fallbacks, FALLBACK_FACE (glyph_index) - 1);
+
+      scaler.face_id = (FTC_FaceID) fallback->face;
+      scaler.height = console_fallback_char_size (priv, fallback, dpi);
+      face_glyph_index = FALLBACK_GLYPH (glyph_index);
+    }
+  else
+    {
+      scaler.face_id = console_face_id (priv);
+      scaler.height = priv->face_size << 6;
+      face_glyph_index = glyph_index;
+    }
+
+  scaler.pixel = FALSE;
+  scaler.width = 0;
+  scaler.x_res = dpi;
+  scaler.y_res = dpi;
+
+  error = FTC_SBitCache_LookupScaler (priv->ftcache->sbitcache, &scaler, GLYPH_LOAD_FLAGS,
+                                      face_glyph_index, &sbitmap, &node);
+  if (error)
+    {
+      g_warning ("failed looking up sbitmap for glyph index %u", face_glyph_index);
+      return NULL;
+    }
+
+  /* The bitmap is copied to the atlas, so the cache node isn't needed after that.
+   */
+  slot = glyph_atlas_insert (priv->atlas, glyph_index, sbitmap->buffer,
+                             sbitmap->width, sbitmap->height, sbitmap->pitch,
+                             sbitmap->left, sbitmap->top);
+
+  FTC_Node_Unref (node, priv->ftcache->manager);
+
+  return slot;
+}
+
+/* Ranges of code page 866 characters rendered from the font, which are
+ * stored in the glyph cache. Pseudographics is drawn without the font.
+ */
+static const struct
+{
+  gunichar first;
+  gunichar last;
+} cp866_ranges[] =
+{
+  { 0x0020, 0x007e },           /* ASCII */
+  { 0x0410, 0x044f },           /* Cyrillic letters */
+  { 0x0401, 0x0401 }, { 0x0451, 0x0451 },
+  { 0x0404, 0x0404 }, { 0x0454, 0x0454 },
+  { 0x0407, 0x0407 }, { 0x0457, 0x0457 },
+  { 0x040e, 0x040e }, { 0x045e, 0x045e },
+  { 0x00a0, 0x00a0 }, { 0x00a4, 0x00a4 },
+  { 0x00b0, 0x00b0 }, { 0x00b7, 0x00b7 },
+  { 0x2116, 0x2116 }, { 0x2219, 0x221a },
+  { 0x25a0, 0x25a0 },
+};
+
+/* This helper fills in the glyph cache key of the current font.
+ */
+static void
+console_glyph_cache_info (ConsolePrivate *priv, gdouble dpi, GlyphCacheInfo *info)
+{
+  memset (info, 0, sizeof (*info));
+
+  info->font_file = priv->font_file;
+  info->face_index = priv->face_index;
+  info->font_size = priv->face_size;
+  info->dpi = dpi;
+  info->load_flags = GLYPH_LOAD_FLAGS;
+}
+
+/* This helper loads the font metrics and glyphs of the current font from
+ * the glyph cache. It returns FALSE if the font isn't cached.
+ */
+static gboolean
+console_glyph_cache_load (ConsolePrivate *priv, gdouble dpi)
+{
+  GlyphCacheInfo info;
+  GlyphAtlas *atlas;
+  guint32 *map;
+
+  console_glyph_cache_info (priv, dpi, &info);
+
+  map = g_new0 (guint32, CHAR_MAP_SIZE);
+
+  if (!glyph_cache_load (&info, &atlas, map, CHAR_MAP_SIZE))
+    {
+      g_free (map);
+      return FALSE;
+    }
+
+  if (priv->atlas != NULL)
+    glyph_atlas_free (priv->atlas);
+
+  g_free (priv->char_map);
+
+  priv->atlas = atlas;
+  priv->atlas_dpi = dpi;
+  priv->char_map = map;
+  priv->char_map_complete = FALSE;
+
+  priv->char_width = info.char_width;
+  priv->char_height = info.char_height;
+  priv->baseline = info.baseline;
+
+  return TRUE;
+}
+
+/* This helper adds character uc to the working set unless it's already
+ * there or it isn't rendered from the font.
+ */
+static void
+working_set_add (GArray *chars, guint8 *seen, gunichar uc)
+{
+  if (uc < 0x20 || uc >= CHAR_MAP_SIZE || BOXDRAW_IS_BOX_CHAR (uc))
+    return;
+
+  if (seen[uc >> 3] & (1 << (uc & 7)))
+    return;
+
+  seen[uc >> 3] |= 1 << (uc & 7);
+  g_array_append_val (chars, uc);
+}
+
+/* This helper returns characters worth rasterising ahead for a new font:
+ * the code page 866 repertoire and characters on the screen.
+ */
+static GArray*
+working_set_new (ConsolePrivate *priv)
+{
+  GArray *chars;
+  guint8 *seen;
+  gunichar uc;
+  guint i;
+
+  chars = g_array_new (FALSE, FALSE, sizeof (gunichar));
+  seen = g_new0 (guint8, CHAR_MAP_SIZE / 8);
+
+  for (i = 0; i < G_N_ELEMENTS (cp866_ranges); i++)
+    {
+      for (uc = cp866_ranges[i].first; uc <= cp866_ranges[i].last; uc++)
+        working_set_add (chars, seen, uc);
+    }
+
+  for (i = 0; i < priv->width * priv->height; i++)
+    working_set_add (chars, seen, priv->scr[i].chr);
+
+  g_free (seen);
+
+  return chars;
+}
+
+/* This helper frees the job along with the font it loaded, unless the font
+ * was taken by the console.
+ */
+static void
+font_job_free (ConsoleFontJob *job)
+{
+  if (job->atlas != NULL)
+    glyph_atlas_free (job->atlas);
+
+  g_array_free (job->chars, TRUE);
+  g_free (job->char_map);
+  g_free (job->font_file);
+  g_object_unref (job->console);
+  g_free (job);
+}
+
+static void
+console_font_free (ConsoleFont *font)
+{
+  if (font->atlas != NULL)
+    glyph_atlas_free (font->atlas);
+
+  g_free (font->char_map);
+  g_free (font->font_file);
+  g_free (font);
+}
+
+/* This helper evicts least recently used fonts from the font cache until
+ * it takes no more than budget bytes.
+ */
+static void
+font_cache_trim (ConsolePrivate *priv, gsize budget)
+{
+  while (priv->font_cache_bytes > budget)
+    {
+      ConsoleFont *font;
+
+      font = g_queue_peek_tail (&priv->font_lru);
+      g_queue_unlink (&priv->font_lru, &font->link);
+
+      priv->font_cache_bytes -= font->size;
+
+      g_debug ("evicting font size %d from the font cache", font->font_size);
+
+      console_font_free (font);
+    }
+}
+
+/* This helper moves the current font to the font cache. It leaves the
+ * console without the atlas and the character map.
+ */
+static void
+font_cache_push (ConsolePrivate *priv)
+{
+  ConsoleFont *font;
+
+  if (priv->atlas == NULL || priv->font_file == NULL || priv->atlas_dpi != priv->face_dpi)
+    {
+      if (priv->atlas != NULL)
+        glyph_atlas_free (priv->atlas);
+
+      g_free (priv->char_map);
+
+      priv->atlas = NULL;
+      priv->char_map = NULL;
+      return;
+    }
+
+  font = g_new0 (ConsoleFont, 1);
+
+  font->font_file = g_strdup (priv->font_file);
+  font->face_index = priv->face_index;
+  font->font_size = priv->face_size;
+  font->dpi = priv->face_dpi;
+  font->char_width = priv->char_width;
+  font->char_height = priv->char_height;
+  font->baseline = priv->baseline;
+  font->char_map = priv->char_map;
+  font->char_map_complete = priv->char_map_complete;
+  font->atlas = priv->atlas;
+  font->link.data = font;
+
+  font->size = sizeof (ConsoleFont) + CHAR_MAP_SIZE * sizeof (guint32) +
+               glyph_atlas_get_size (font->atlas);
+
+  priv->atlas = NULL;
+  priv->char_map = NULL;
+
+  g_queue_push_head_link (&priv->font_lru, &font->link);
+  priv->font_cache_bytes += font->size;
+
+  font_cache_trim (priv, (gsize) priv->font_cache_size * 1024);
+}
+
+/* This helper removes the font matching the arguments from the font cache
+ * and returns it, or returns NULL if there is no such font.
+ */
+static ConsoleFont*
+font_cache_take (ConsolePrivate *priv, const gchar *file, gint face_index, gint size, gdouble dpi)
+{
+  GList *link;
+
+  for (link = priv->font_lru.head; link != NULL; link = link->next)
+    {
+      ConsoleFont *font = link->data;
+
+      if (font->face_index == face_index && font->font_size == size &&
+          font->dpi == dpi && strcmp (font->font_file, file) == 0)
+        {
+          g_queue_unlink (&priv->font_lru, link);
+          priv->font_cache_bytes -= font->size;
+          return font;
+        }
+    }
+
+  return NULL;
+}
+
+/* This helper switches the console to the font, the current font goes to
+ * the font cache. Other sizes of the same face keep the face open.
+ */
+static void
+font_install (Console *console, ConsoleFont *font)
+{
+  ConsolePrivate *priv;
+  gboolean same_face, resize;
+
+  priv = console->priv;
+
+  g_debug ("switching to font file '%s' face index %d size %d",
+           font->font_file, font->face_index, font->font_size);
+
+  same_face = priv->font_file != NULL && priv->face_index == font->face_index &&
+              strcmp (priv->font_file, font->font_file) == 0;
+
+  font_cache_push (priv);
+
+  if (same_face)
+    row_cache_clear (priv);
+  else
+    console_font_cache_reset (priv);
+
+  if (priv->font_file != NULL)
+    g_free (priv->font_file);
+
+  priv->font_file = font->font_file;
+  priv->face_index = font->face_index;
+  priv->face_size = font->font_size;
+  priv->face_dpi = font->dpi;
+
+  priv->atlas = font->atlas;
+  priv->atlas_dpi = font->dpi;
+  priv->char_map = font->char_map;
+  priv->char_map_complete = font->char_map_complete;
+
+  resize = priv->char_width != font->char_width || priv->char_height != font->char_height;
+
+  priv->char_width = font->char_width;
+  priv->char_height = font->char_height;
+  priv->baseline = font->baseline;
+
+  g_free (font);
+
+  priv->cursor_valid = FALSE;
+
+  /* character cells of another size need another window size */
+  if (resize)
+    gtk_widget_queue_resize (GTK_WIDGET (console));
+
+  console_redraw (console);
+}
+
+/* This helper switches the console to the font loaded by the job.
+ */
+static void
+font_job_install (Console *console, ConsoleFontJob *job)
+{
+  ConsoleFont *font;
+
+  font = g_new0 (ConsoleFont, 1);
+
+  font->font_file = job->font_file;
+  font->face_index = job->face_index;
+  font->font_size = job->font_size;
+  font->dpi = job->dpi;
+  font->char_width = job->char_width;
+  font->char_height = job->char_height;
+  font->baseline = job->baseline;
+  font->char_map = job->char_map;
+  font->char_map_complete = job->char_map_complete;
+  font->atlas = job->atlas;
+
+  job->font_file = NULL;
+  job->atlas = NULL;
+  job->char_map = NULL;
+
+  font_install (console, font);
+}
+
+/* This callback is invoked in the main loop when the font loader is done
+ * with the job. The console switches to the font unless a newer font was
+ * requested meanwhile.
+ */
+static gboolean
+font_job_done (gpointer data)
+{
+  ConsoleFontJob *job;
+  ConsolePrivate *priv;
+
+  job = data;
+  priv = job->console->priv;
+
+  if (priv->font_job == job)
+    {
+      priv->font_job = NULL;
+
+      if (job->atlas != NULL)
+        font_job_install (job->console, job);
+      else
+        g_warning ("can't load font file '%s' face index %d", job->font_file, job->face_index);
+    }
+
+  font_job_free (job);
+
+  return FALSE;
+}
+
+/* This function runs in the font loader thread. It loads the font from the
+ * glyph cache, or rasterises the characters of the job with a FreeType
+ * library of its own and stores them in the glyph cache. The console
+ * data is never touched here.
+ */
+static void
+font_job_func (gpointer data, gpointer user_data)
+{
+  ConsoleFontJob *job;
+  GlyphCacheInfo info;
+  FT_Library lib;
+  FT_Face face;
+  GArray *chars, *glyph_indices;
+  guint i;
+
+  job = data;
+
+  memset (&info, 0, sizeof (info));
+
+  info.font_file = job->font_file;
+  info.face_index = job->face_index;
+  info.font_size = job->font_size;
+  info.dpi = job->dpi;
+  info.load_flags = GLYPH_LOAD_FLAGS;
+
+  job->char_map = g_new0 (guint32, CHAR_MAP_SIZE);
+
+  if (glyph_cache_load (&info, &job->atlas, job->char_map, CHAR_MAP_SIZE))
+    {
+      job->char_width = info.char_width;
+      job->char_height = info.char_height;
+      job->baseline = info.baseline;
+      job->char_map_complete = FALSE;
+      goto done;
+    }
+
+  if (FT_Init_FreeType (&lib) != 0)
+    goto done;
+
+  /* faces are freed along with the library */
+  if (FT_New_Face (lib, job->font_file, job->face_index, &face) != 0 ||
+      FT_Set_Char_Size (face, 0, job->font_size << 6, job->dpi, job->dpi) != 0)
+    {
+      FT_Done_FreeType (lib);
+      goto done;
+    }
+
+  font_metrics_compute (face, job->font_size, job->dpi, job->dpi,
+                        &job->char_width, &job->char_height, &job->baseline);
+
+  char_map_fill (face, job->char_map);
+  job->char_map_complete = TRUE;
+
+  job->atlas = glyph_atlas_new (face->num_glyphs, job->char_width, job->char_height);
+
+  chars = g_array_new (FALSE, FALSE, sizeof (gunichar));
+  glyph_indices = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (i = 0; i < job->chars->len && !g_atomic_int_get (&job->cancelled); i++)
+    {
+      gunichar uc = g_array_index (job->chars, gunichar, i);
+      guint glyph_index = job->char_map[uc];
+
+      if (glyph_index == 0)
+        continue;
+
+      /* characters may share glyphs */
+      if (glyph_atlas_lookup (job->atlas, glyph_index) == NULL)
+        {
+          FT_GlyphSlot glyph;
+
+          if (FT_Load_Glyph (face, glyph_index, GLYPH_LOAD_FLAGS) != 0)
+            continue;
+
+          glyph = face->glyph;
+
+          glyph_atlas_insert (job->atlas, glyph_index, glyph->bitmap.buffer,
+                              glyph->bitmap.width, glyph->bitmap.rows, glyph->bitmap.pitch,
+                              glyph->bitmap_left, glyph->bitmap_top);
+        }
+
+      g_array_append_val (chars, uc);
+      g_array_append_val (glyph_indices, glyph_index);
+    }
+
+  /* nobody waits for a cancelled font, don't spend time on caching it */
+  if (!g_atomic_int_get (&job->cancelled))
+    {
+      info.n_glyphs = face->num_glyphs;
+      info.char_width = job->char_width;
+      info.char_height = job->char_height;
+      info.baseline = job->baseline;
+
+      glyph_cache_save (&info, job->atlas, (gunichar *) chars->data,
+                        (guint *) glyph_indices->data, chars->len);
+    }
+
+  g_array_free (chars, TRUE);
+  g_array_free (glyph_indices, TRUE);
+
+  FT_Done_FreeType (lib);
+
+done:
+  g_idle_add (font_job_done, job);
+}
+
+/* This helper cancels loading of the font being loaded, if any.
+ */
+static void
+font_job_cancel (ConsolePrivate *priv)
+{
+  if (priv->font_job == NULL)
+    return;
+
+  g_atomic_int_set (&priv->font_job->cancelled, TRUE);
+  priv->font_job = NULL;
+}
+
+/* This helper starts loading the font file in the background, cancelling
+ * the font being loaded.
+ */
+static void
+font_job_push (Console *console, const gchar *file, gint face_index, gdouble dpi)
+{
+  ConsolePrivate *priv;
+  ConsoleFontJob *job;
+  GError *error = NULL;
+
+  priv = console->priv;
+
+  job = g_new0 (ConsoleFontJob, 1);
+  job->console = g_object_ref (console);
+  job->font_file = g_strdup (file);
+  job->face_index = face_index;
+  job->font_size = priv->font_size;
+  job->dpi = dpi;
+  job->chars = working_set_new (priv);
+
+  font_job_cancel (priv);
+  priv->font_job = job;
+
+  if (priv->font_pool == NULL)
+    {
+      priv->font_pool = g_thread_pool_new (font_job_func, NULL, 1, FALSE, &error);
+
+      if (priv->font_pool == NULL)
+        {
+          g_warning ("can't start font loader thread: %s", error->message);
+          g_error_free (error);
+
+          /* the font is loaded all the same, just not in the background */
+          font_job_func (job, NULL);
+          return;
+        }
+    }
+
+  g_thread_pool_push (priv->font_pool, job, NULL);
+}
+
+/* This callback looks up the font file matching the font properties and
+ * starts loading it unless it's loaded already.
+ */
+static gboolean
+font_job_start (gpointer user_data)
+{
+  Console *console;
+  ConsolePrivate *priv;
+  ConsoleFont *font;
+  gdouble dpi;
+  gint face_index;
+  gchar *file;
+
+  console = CONSOLE (user_data);
+  priv = console->priv;
+
+  priv->font_job_id = 0;
+  priv->font_changes = 0;
+
+  dpi = gdk_screen_get_resolution (gtk_widget_get_screen (GTK_WIDGET (console)));
+
+  fc_get_font_file (priv->font_family ? priv->font_family : FONT_FAMILY_DEFAULT,
+                    priv->font_style ? priv->font_style : FONT_STYLE_DEFAULT,
+                    TRUE, TRUE, &file, &face_index);
+
+  g_assert (file != NULL && face_index >= 0);
+
+  /* The font being loaded isn't wanted any more if the properties are
+   * back to the current font or to a cached one.
+   */
+  if (priv->face_index == face_index && priv->face_size == priv->font_size &&
+      priv->face_dpi == dpi && strcmp (priv->font_file, file) == 0)
+    font_job_cancel (priv);
+  else
+    {
+      font = font_cache_take (priv, file, face_index, priv->font_size, dpi);
+
+      if (font != NULL)
+        {
+          font_job_cancel (priv);
+          font_install (console, font);
+        }
+      else
+        font_job_push (console, file, face_index, dpi);
+    }
+
+  g_free (file);
+
+  return FALSE;
+}
+
+/* This helper schedules loading of the font after font properties changed.
+ * Properties changed together are applied at once. Nothing is needed before
+ * the first size request, which loads the font itself.
+ */
+static void
+font_job_queue (Console *console)
+{
+  ConsolePrivate *priv;
+
+  priv = console->priv;
+
+  if (priv->font_file == NULL || priv->font_changes == 0 || priv->font_job_id != 0)
+    return;
+
+  priv->font_job_id = g_idle_add (font_job_start, console);
+}
+
+GType
+console_get_type (void)
+{
+  static GType type = 0;
+
+  if (type == 0)
+    {
+      static const GTypeInfo info =
+        {
+          sizeof (ConsoleClass),
+          NULL,                        /* base_init */
+          NULL,                        /* base_finalize */
+          (GClassInitFunc) console_class_init,        /* class_init */
+          NULL,                        /* class_finalize */
+          NULL,                        /* class_data */
+          sizeof(Console),
+          0,                        /* n_preallocs */
+          (GInstanceInitFunc) console_init        /* instance_init */
+        };
+      type = g_type_register_static (GTK_TYPE_WIDGET,
+                                     "Console",
+                                     &info, 0);
+    }
+
+  return type;
+}
+
+/* Public functions available to user.
+ */
+
+GtkWidget*
+console_new()
+{
+  return GTK_WIDGET (g_object_new (console_get_type (), NULL));
+}
+
+GtkWidget*
+console_new_with_size (gint width, gint height)
+{
+  return GTK_WIDGET (g_object_new (console_get_type (), "width", width, "height", height, NULL));
+}
+
+/* This function sets up class structure, properties and registers signals. */
+static void
+console_class_init (ConsoleClass *klass)
+{
+  GtkWidgetClass *widget_class;
+  GObjectClass *object_class;
+
+  g_debug ("console: class init");
+
+  widget_class = (GtkWidgetClass *) klass;
+  object_class = (GObjectClass *) klass;
+
+  widget_class->realize = console_realize;
+  widget_class->size_request = console_size_request;
+  widget_class->size_allocate = console_size_allocate;
+  widget_class->expose_event = console_expose;
+
+  object_class->set_property = console_set_property;
+  object_class->get_property = console_get_property;
+
+  g_type_class_add_private (object_class, sizeof (ConsolePrivate));
+
+  g_object_class_install_property (object_class, PROP_WIDTH,
+                                   g_param_spec_int ("width",
+                                                     "Console Window Width",
+                                                     "The width of the console in characters",
+                                                     CONSOLE_WIDTH_MIN, CONSOLE_WIDTH_MAX,
+                                                     CONSOLE_WIDTH_DEFAULT,
+                                                     G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_HEIGHT,
+                                   g_param_spec_int ("height",
+                                                     "Console Window Height",
+                                                     "The height of the console in characters",
+                                                     CONSOLE_HEIGHT_MIN, CONSOLE_HEIGHT_MAX,
+                                                     CONSOLE_HEIGHT_DEFAULT,
+                                                     G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_FONT_SIZE,
+                                   g_param_spec_int ("font-size",
+                                                     "Console Window Font Size",
+                                                     "The size of the console font in points",
+                                                     FONT_SIZE_MIN, FONT_SIZE_MAX, FONT_SIZE_DEFAULT,
+                                                     G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_FONT_FAMILY,
+                                   g_param_spec_string ("font-family",
+                                                        "Console Font Family",
+                                                        "The font family name",
+                                                        FONT_FAMILY_DEFAULT,
+                                                        G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_FONT_STYLE,
+                                   g_param_spec_string ("font-style",
+                                                        "Console Font Style",
+                                                        "The font style name",
+                                                        FONT_STYLE_DEFAULT,
+                                                        G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_CURSOR_SHAPE,
+                                   g_param_spec_int ("cursor-shape",
+                                                     "Console Cursor Shape",
+                                                     "The shape of the console cursor",
+                                                     CONSOLE_CURSOR_DEFAULT, CONSOLE_CURSOR_VERT_HALF,
+                                                     CONSOLE_CURSOR_DEFAULT,
+                                                     G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_CURSOR_TIMER,
+                                   g_param_spec_int ("cursor-timer",
+                                                     "Console Cursor Timer",
+                                                     "This sets the blinking timer for the cursor",
+                                                     CONSOLE_BLINK_STEADY, CONSOLE_BLINK_FAST,
+                                                     CONSOLE_BLINK_MEDIUM,
+                                                     G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_MAX_FPS,
+                                   g_param_spec_int ("max-fps",
+                                                     "Console Maximum Frame Rate",
+                                                     "The maximum number of screen updates per second, 0 for unlimited",
+                                                     MAX_FPS_MIN, MAX_FPS_MAX,
+                                                     MAX_FPS_DEFAULT,
+                                                     G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_RENDER_THREADS,
+                                   g_param_spec_int ("render-threads",
+                                                     "Console Render Threads",
+                                                     "The number of threads rendering large screen updates, 0 to render in the main thread",
+                                                     RENDER_THREADS_MIN, RENDER_THREADS_MAX,
+                                                     RENDER_THREADS_DEFAULT,
+                                                     G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_ROW_CACHE_SIZE,
+                                   g_param_spec_int ("row-cache-size",
+                                                     "Console Row Cache Size",
+                                                     "The memory budget in kilobytes of rendered rows kept for reuse, 0 to disable the row cache",
+                                                     ROW_CACHE_SIZE_MIN, ROW_CACHE_SIZE_MAX,
+                                                     ROW_CACHE_SIZE_DEFAULT,
+                                                     G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_FONT_CACHE_SIZE,
+                                   g_param_spec_int ("font-cache-size",
+                                                     "Console Font Cache Size",
+                                                     "The memory budget in kilobytes of recently used fonts kept for reuse, 0 to disable the font cache",
+                                                     FONT_CACHE_SIZE_MIN, FONT_CACHE_SIZE_MAX,
+                                                     FONT_CACHE_SIZE_DEFAULT,
+                                                     G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_SCROLLBACK_LINES,
+                                   g_param_spec_int ("scrollback-lines",
+                                                     "Console Scrollback Lines",
+                                                     "The number of lines scrolled off the screen kept in the history, 0 to disable the history",
+                                                     SCROLLBACK_LINES_MIN, SCROLLBACK_LINES_MAX,
+                                                     SCROLLBACK_LINES_DEFAULT,
+                                                     G_PARAM_READWRITE));
+
+  g_object_class_install_property (object_class, PROP_SCROLLBACK_SPILL,
+                                   g_param_spec_boolean ("scrollback-spill",
+                                                         "Console Scrollback Spill",
+                                                         "Whether lines beyond the scrollback lines are kept in a file instead of being dropped",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE));
+  klass->primary_text_pasted = NULL;
   klass->primary_text_selected = console_primary_text_selected;
   klass->clipboard_text_pasted = NULL;
   klass->clipboard_text_selected = console_clipboard_text_selected;
@@ -713,1053 +2044,2184 @@ console_class_init (ConsoleClass *klass)
                   G_TYPE_BOOLEAN, 1,
                   G_TYPE_STRING);
 
-  console_signals[CLIPBOARD_TEXT_SELECTED] =
-    g_signal_new ("clipboard-text-selected",
-                  G_TYPE_FROM_CLASS (object_class),
-                  G_SIGNAL_RUN_LAST,
-                  G_STRUCT_OFFSET (ConsoleClass, clipboard_text_selected),
-                  g_signal_accumulator_true_handled,
-                  NULL,
-                  g_cclosure_console_BOOLEAN__STRING,
-                  G_TYPE_BOOLEAN, 1,
-                  G_TYPE_STRING);
-  console_signals[CLIPBOARD_TEXT_PASTED] =
-    g_signal_new ("clipboard-text-pasted",
-                  G_TYPE_FROM_CLASS (object_class),
-                  G_SIGNAL_RUN_LAST,
-                  G_STRUCT_OFFSET (ConsoleClass, clipboard_text_pasted),
-                  g_signal_accumulator_true_handled,
-                  NULL,
-                  g_cclosure_console_BOOLEAN__STRING,
-                  G_TYPE_BOOLEAN, 1,
-                  G_TYPE_STRING);
+  console_signals[CLIPBOARD_TEXT_SELECTED] =
+    g_signal_new ("clipboard-text-selected",
+                  G_TYPE_FROM_CLASS (object_class),
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (ConsoleClass, clipboard_text_selected),
+                  g_signal_accumulator_true_handled,
+                  NULL,
+                  g_cclosure_console_BOOLEAN__STRING,
+                  G_TYPE_BOOLEAN, 1,
+                  G_TYPE_STRING);
+  console_signals[CLIPBOARD_TEXT_PASTED] =
+    g_signal_new ("clipboard-text-pasted",
+                  G_TYPE_FROM_CLASS (object_class),
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (ConsoleClass, clipboard_text_pasted),
+                  g_signal_accumulator_true_handled,
+                  NULL,
+                  g_cclosure_console_BOOLEAN__STRING,
+                  G_TYPE_BOOLEAN, 1,
+                  G_TYPE_STRING);
+
+  object_class->finalize = console_finalize;
+}
+
+static void
+color_parse (ConsoleColor *color, const char *spec)
+{
+  GdkColor gdkcolor;
+
+  g_assert (spec != NULL);
+
+  gdk_color_parse (spec, &gdkcolor);
+
+  color->red = gdkcolor.red / GDK_COLOR_SCALE;
+  color->green = gdkcolor.green / GDK_COLOR_SCALE;
+  color->blue = gdkcolor.blue / GDK_COLOR_SCALE;
+}
+
+/* This helper returns the index of the palette entry closest to a color.
+ */
+static gint
+palette_lookup (const ConsolePrivate *priv, const ConsoleColor *color)
+{
+  gdouble dist, min_dist;
+  gint i, index;
+
+  index = 0;
+  min_dist = G_MAXDOUBLE;
+
+  for (i = 0; i < CONSOLE_PALETTE_SIZE; i++)
+    {
+      const ConsoleColor *p = priv->palette + i;
+
+      dist = (p->red - color->red) * (p->red - color->red) +
+             (p->green - color->green) * (p->green - color->green) +
+             (p->blue - color->blue) * (p->blue - color->blue);
+
+      if (dist < min_dist)
+        {
+          min_dist = dist;
+          index = i;
+        }
+    }
+
+  return index;
+}
+
+/* This helper fills n character cells with blanks of the given colors
+ * and attributes.
+ */
+static void
+blank_chars (ConsoleChar *chr, gint n, guint8 color, guint8 attr)
+{
+  ConsoleChar blank;
+
+  blank.chr = ' ';
+  blank.color = color;
+  blank.attr = attr;
+  blank.reserved = 0;
+
+  while (n-- > 0)
+    *chr++ = blank;
+}
+
+/* This helper resizes the screen to a new width and height.
+ */
+static void
+resize_screen (Console *console, gint width, gint height)
+{
+  ConsolePrivate *priv;
+  ConsoleChar *old_scr;
+  ConsoleChar *scr;
+  ConsoleChar **rows;
+  guint alloc_size;
+  gint old_width, old_height;
+  gint i;
+
+  g_assert (console != NULL);
+  g_assert (width > 0 && height > 0);
+
+  priv = console->priv;
+
+  old_scr = priv->scr;
+  old_width = priv->width;
+  old_height = priv->height;
+
+  alloc_size = width * height;
+  scr = g_new (ConsoleChar, alloc_size);
+  rows = g_new (ConsoleChar*, height);
+
+  for (i = 0; i < height; i++)
+    {
+      ConsoleChar *row = scr + i*width;
+      gint n = 0;
+
+      /* Try to relocate contents of the old screen to the new one.
+       */
+      if (old_scr != NULL && i < old_height)
+        {
+          n = MIN (width, old_width);
+          memcpy (row, SCREEN_ROW (priv, i), n * sizeof (ConsoleChar));
+        }
+
+      blank_chars (row + n, width - n, priv->color, CONSOLE_CHAR_ATTR_DEFAULT);
+
+      rows[i] = row;
+    }
+
+  g_free (priv->rows);
+
+  priv->scr = scr;
+  priv->rows = rows;
+  priv->rows_head = 0;
+
+  /* history lines are laid out again on the next scroll back */
+  g_free (priv->view);
+  priv->view = NULL;
+  priv->view_offset = 0;
+  priv->width = width;
+  priv->height = height;
+
+  /* Reallocate dirty spans for the new number of rows. The widget
+   * is redrawn as a whole after a resize, so old damage is dropped.
+   */
+  priv->dirty = g_renew (ConsoleDirtySpan, priv->dirty, height);
+  priv->dirty_y1 = 0;
+  priv->dirty_y2 = height - 1;
+  damage_reset (console);
+  priv->backing_valid = FALSE;
+
+  /* correct cursor position */
+  if (priv->cursor_x >= width)
+    priv->cursor_x = width - 1;
+  if (priv->cursor_y >= height)
+    priv->cursor_y = height - 1;
+
+  if (old_scr != NULL)
+    g_free (old_scr);
+}
+
+static void
+console_init (Console *console)
+{
+  ConsolePrivate *priv;
+  gint i, tid;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE(console));
+
+  g_debug ("console: init");
+
+  priv = CONSOLE_GET_PRIVATE (console);
+  console->priv = priv;
+
+  /* set initial cursor position to the top left corner */
+  priv->cursor_x = 0;
+  priv->cursor_y = 0;
+  priv->cursor_shape = CONSOLE_CURSOR_DEFAULT;
+  priv->cursor_toggle = FALSE;
+  /* start cursor blinking timer */
+  tid = g_timeout_add (CURSOR_BLINKING_TIMER, (GSourceFunc) console_cursor_timer, console);
+  priv->cursor_timer_id = tid;
+
+  /* initialize the palette and default colors for the console characters */
+  for (i = 0; i < CONSOLE_PALETTE_SIZE; i++)
+    color_parse (priv->palette + i, default_palette[i]);
+
+  priv->color = CHAR_COLOR (PALETTE_FG_DEFAULT, PALETTE_BG_DEFAULT);
+
+  /* initialize default font */
+  priv->font_family = g_strdup (FONT_FAMILY_DEFAULT);
+  priv->font_style = g_strdup (FONT_STYLE_DEFAULT);
+  priv->face_index = 0;
+  priv->font_size = FONT_SIZE_DEFAULT;
+  priv->font_file = NULL;
+  priv->font_changes = 0;
+  priv->face_size = FONT_SIZE_DEFAULT;
+  priv->face_dpi = 0.0;
+
+  /* font loader thread is started on the first font change */
+  priv->font_pool = NULL;
+  priv->font_job = NULL;
+  priv->font_job_id = 0;
+
+  priv->font_cache_size = FONT_CACHE_SIZE_DEFAULT;
+  g_queue_init (&priv->font_lru);
+  priv->font_cache_bytes = 0;
+
+  /* initialize FreeType backend */
+  console_font_cache_init (priv);
+
+  priv->char_width = -1;
+  priv->char_height = -1;
+  priv->baseline = -1;
+
+  /* initial selection
+   */
+  priv->text_selection.x1 = -1;
+  priv->text_selection.y1 = -1;
+  priv->text_selection.x2 = -1;
+  priv->text_selection.y2 = -1;
+
+  /* set default TAB position each 8 characters */
+  for (i = 0; i < TABMAP_SIZE; i++)
+    priv->tabs[i] = 0x01010101;
+
+  /* callbacks */
+  g_signal_connect (GTK_WIDGET (console), "button-press-event", G_CALLBACK (console_button_press_event_cb), console);
+  g_signal_connect (GTK_WIDGET (console), "key-press-event", G_CALLBACK (console_key_press_event_cb), console);
+  g_signal_connect (GTK_WIDGET (console), "button-release-event", G_CALLBACK (console_button_release_event_cb), console);
+  g_signal_connect (GTK_WIDGET (console), "motion-notify-event", G_CALLBACK (console_motion_notify_event_cb), console);
+
+  /* no damage recorded yet, dirty spans are allocated with the screen */
+  priv->dirty = NULL;
+  priv->dirty_y1 = G_MAXINT;
+  priv->dirty_y2 = -1;
+  priv->damage_flush_id = 0;
+  priv->cursor_moved = FALSE;
+  priv->freeze_count = 0;
+
+  /* frame scheduler */
+  priv->max_fps = MAX_FPS_DEFAULT;
+  priv->last_frame_time = 0;
+  priv->frame_timer_id = 0;
+  memset (&priv->stats, 0, sizeof (priv->stats));
+
+  /* The widget paints from its own backing pixmap which is created
+   * on the first expose, GTK double buffering would only add a copy.
+   */
+  priv->backing = NULL;
+  priv->backing_gc = NULL;
+  priv->backing_valid = FALSE;
+
+  /* cursor pixmap is created on the first expose as well */
+  priv->cursor_pixmap = NULL;
+  priv->cursor_pixmap_x = 0;
+  priv->cursor_pixmap_y = 0;
+  priv->cursor_valid = FALSE;
+  gtk_widget_set_double_buffered (GTK_WIDGET (console), FALSE);
+
+  /* band renderer threads are started on request */
+  priv->render_threads = RENDER_THREADS_DEFAULT;
+  priv->render_pool = NULL;
+  priv->render_done = NULL;
+
+  priv->row_cache_size = ROW_CACHE_SIZE_DEFAULT;
+  priv->row_cache_bytes = 0;
+  priv->row_cache = g_hash_table_new (g_int64_hash, g_int64_equal);
+  g_queue_init (&priv->row_lru);
+
+  /* the view follows the screen until it is scrolled back */
+  priv->scrollback = scrollback_new (SCROLLBACK_LINES_DEFAULT);
+  priv->view_offset = 0;
+  priv->view = NULL;
+
+  /* allocate console screen buffer */
+  resize_screen (console, CONSOLE_WIDTH_DEFAULT, CONSOLE_HEIGHT_DEFAULT);
+}
+
+static gboolean
+console_primary_text_selected (Console *console, const gchar *str)
+{
+  GtkClipboard *clipboard;
+
+  clipboard = gtk_clipboard_get (GDK_SELECTION_PRIMARY);
+  gtk_clipboard_set_text (clipboard, str, strlen(str));
+
+  return TRUE;
+}
+
+static gboolean
+console_clipboard_text_selected (Console *console, const gchar *str)
+{
+  GtkClipboard *clipboard;
+
+  clipboard = gtk_clipboard_get (GDK_SELECTION_CLIPBOARD);
+  gtk_clipboard_set_text (clipboard, str, strlen(str));
+
+  return TRUE;
+}
+
+
+/* This helper opens the font face and calculates character cell metrics.
+ */
+static void
+console_font_metrics_load (ConsolePrivate *priv, gdouble dpi_x, gdouble dpi_y)
+{
+  FT_Face face;
+  gint error;
+
+  /* Lookup face to determine font metrics. */
+  error = FTC_Manager_LookupFace (priv->ftcache->manager, console_face_id (priv), &face);
+  if (error != 0)
+    g_error ("can't lookup face in the cache");
+
+  font_metrics_compute (face, priv->face_size, dpi_x, dpi_y,
+                        &priv->char_width, &priv->char_height, &priv->baseline);
+}
+
+/* This helper loads the console font right away, from the glyph cache if
+ * the font is cached. Otherwise only the font metrics are calculated and
+ * the glyphs are rasterised in the background.
+ */
+static void
+console_font_load (Console *console, gdouble dpi_x, gdouble dpi_y)
+{
+  ConsolePrivate *priv;
+  gint face_index;
+  gchar *file;
+
+  priv = console->priv;
+
+  fc_get_font_file (priv->font_family ? priv->font_family : FONT_FAMILY_DEFAULT,
+                    priv->font_style ? priv->font_style : FONT_STYLE_DEFAULT,
+                    TRUE, TRUE, &file, &face_index);
+
+  g_assert (file != NULL && face_index >= 0);
+
+  /* Before looking up font metrics, reset the cache, because we don't need
+   * it's contents any more for sure.
+   */
+  console_font_cache_reset (priv);
+  priv->backing_valid = FALSE;
+
+  if (priv->font_file != NULL)
+    g_free (priv->font_file);
+
+  priv->font_file = file;
+  priv->face_index = face_index;
+  priv->face_size = priv->font_size;
+  priv->face_dpi = dpi_x;
+  priv->font_changes = 0;
+
+  /* A cached font is displayed without opening the face at all.
+   */
+  if (!console_glyph_cache_load (priv, dpi_x))
+    {
+      console_font_metrics_load (priv, dpi_x, dpi_y);
+      font_job_push (console, file, face_index, dpi_x);
+    }
+}
+
+static void
+console_size_request (GtkWidget *widget, GtkRequisition *requisition)
+{
+  GdkGeometry hints;
+  GtkWidget *toplevel;
+  Console *console;
+  ConsolePrivate *priv;
+  GdkScreen *screen;
+  double dpi_x, dpi_y;
+
+  g_return_if_fail (widget != NULL);
+  g_return_if_fail (IS_CONSOLE(widget));
+  g_return_if_fail (requisition != NULL);
+
+  console = CONSOLE (widget);
+  priv = console->priv;
+
+  g_debug ("console: size request width %d height %d", priv->width, priv->height);
+
+  /* Get screen resolution in dots per inch. */
+  screen = gtk_widget_get_screen (widget);
+  dpi_x = gdk_screen_get_resolution (screen);
+  dpi_y = dpi_x;
+
+  /* The font is loaded on the first request and when the screen resolution
+   * changes. Font property changes are handled by the background loader,
+   * which keeps the current font until the new one is ready.
+   */
+  if (priv->font_job == NULL && (priv->font_file == NULL || priv->face_dpi != dpi_x))
+    console_font_load (console, dpi_x, dpi_y);
+
+  /* Calculate console window size required. */
+  requisition->width = priv->char_width * priv->width;
+  requisition->height = priv->char_height * priv->height;
+
+  /* Do the canonical terminal window geometry hints to resize properly. */
+  toplevel = gtk_widget_get_toplevel (widget);
+
+  if (GTK_WIDGET_TOPLEVEL (toplevel))
+    {
+      hints.width_inc = priv->char_width;
+      hints.height_inc = priv->char_height;
+      hints.base_width = priv->char_width;
+      hints.base_height = priv->char_height;
+      hints.min_width = priv->char_width;
+      hints.min_height = priv->char_height;
+
+      gtk_window_set_geometry_hints (GTK_WINDOW (toplevel),
+                                     GTK_WIDGET (widget),
+                                     &hints,
+                                     GDK_HINT_MIN_SIZE |
+                                     GDK_HINT_BASE_SIZE |
+                                     GDK_HINT_RESIZE_INC);
+    }
+}
+
+
+static void
+console_size_allocate (GtkWidget *widget,
+                           GtkAllocation *allocation)
+{
+  gint width, height;
+
+  g_return_if_fail (widget != NULL);
+  g_return_if_fail (IS_CONSOLE(widget));
+  g_return_if_fail (allocation != NULL);
+
+  widget->allocation = *allocation;
+
+  g_debug ("console: allocate x=%d y=%d width=%d height=%d",
+           allocation->x, allocation->y,
+           allocation->width, allocation->height);
+
+  if (GTK_WIDGET_REALIZED (widget))
+    {
+      allocation->width = ROUND_UP(allocation->width, CONSOLE(widget)->priv->char_width);
+      allocation->height = ROUND_UP(allocation->height, CONSOLE(widget)->priv->char_height);
+
+      /* Resize widget window and move to allocated position
+       * relative to it's parent window.
+       */
+
+      gdk_window_move_resize (widget->window,
+                              allocation->x, allocation->y,
+                              allocation->width, allocation->height);
+
+      width = allocation->width / CONSOLE(widget)->priv->char_width;
+      height = allocation->height / CONSOLE(widget)->priv->char_height;
+
+      resize_screen (CONSOLE(widget), width, height);
+    }
+}
+
+static void
+console_realize (GtkWidget *widget)
+{
+  ConsolePrivate *priv;
+  GdkWindowAttr attr;
+  guint attr_mask, event_mask;
+
+  g_return_if_fail (widget != NULL);
+  g_return_if_fail (IS_CONSOLE(widget));
+
+  priv = CONSOLE (widget)->priv;
+
+  g_debug ("console: realize");
+
+  GTK_WIDGET_SET_FLAGS (widget, GTK_REALIZED | GTK_CAN_FOCUS);
+
+  attr.window_type = GDK_WINDOW_CHILD;
+  attr.x = widget->allocation.x;
+  attr.y = widget->allocation.y;
+  attr.width = widget->allocation.width;
+  attr.height = widget->allocation.height;
+
+  attr.wclass = GDK_INPUT_OUTPUT;
+
+  event_mask = GDK_EXPOSURE_MASK | GDK_KEY_PRESS_MASK | GDK_BUTTON_PRESS_MASK |
+               GDK_BUTTON_RELEASE_MASK | GDK_POINTER_MOTION_MASK;
+  attr.event_mask = gtk_widget_get_events (widget) | event_mask;
+
+  attr_mask = GDK_WA_X | GDK_WA_Y;
+
+  widget->window = gdk_window_new (gtk_widget_get_parent_window (widget), &attr, attr_mask);
+
+  gdk_window_set_user_data (widget->window, widget);
+
+  /* The whole window is painted from the backing pixmap, so the server
+   * must not clear exposed areas before that.
+   */
+  gdk_window_set_back_pixmap (widget->window, NULL, FALSE);
+
+  widget->style = gtk_style_attach (widget->style, widget->window);
+  //gtk_style_set_background (widget->style, widget->window, GTK_STATE_NORMAL);
+}
+
+void
+console_get_foreground_color (Console *console, GdkColor *color)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (color != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  console_get_palette_color (console, CHAR_FG (console->priv->color), color);
+}
+
+void
+console_get_background_color (Console *console, GdkColor *color)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (color != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  console_get_palette_color (console, CHAR_BG (console->priv->color), color);
+}
+
+void
+console_set_foreground_color (Console *console, const GdkColor *color)
+{
+  ConsoleColor c;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (color != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  c.red = color->red / GDK_COLOR_SCALE;
+  c.green = color->green / GDK_COLOR_SCALE;
+  c.blue = color->blue / GDK_COLOR_SCALE;
+
+  console_set_foreground_index (console, palette_lookup (console->priv, &c));
+}
+
+void
+console_set_background_color (Console *console, const GdkColor *color)
+{
+  ConsoleColor c;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (color != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  c.red = color->red / GDK_COLOR_SCALE;
+  c.green = color->green / GDK_COLOR_SCALE;
+  c.blue = color->blue / GDK_COLOR_SCALE;
+
+  console_set_background_index (console, palette_lookup (console->priv, &c));
+}
+
+void
+console_set_foreground_color_from_string (Console *console, const gchar *color)
+{
+  ConsoleColor c;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (color != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  color_parse (&c, color);
+
+  console_set_foreground_index (console, palette_lookup (console->priv, &c));
+}
+
+void
+console_set_background_color_from_string (Console *console, const gchar *color)
+{
+  ConsoleColor c;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (color != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  color_parse (&c, color);
+
+  console_set_background_index (console, palette_lookup (console->priv, &c));
+}
+
+gint
+console_get_foreground_index (Console *console)
+{
+  g_return_val_if_fail (console != NULL, 0);
+  g_return_val_if_fail (IS_CONSOLE (console), 0);
+
+  return CHAR_FG (console->priv->color);
+}
+
+gint
+console_get_background_index (Console *console)
+{
+  g_return_val_if_fail (console != NULL, 0);
+  g_return_val_if_fail (IS_CONSOLE (console), 0);
+
+  return CHAR_BG (console->priv->color);
+}
+
+void
+console_set_foreground_index (Console *console, gint index)
+{
+  ConsolePrivate *priv;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (index >= 0 && index < CONSOLE_PALETTE_SIZE);
+
+  priv = console->priv;
+  priv->color = CHAR_COLOR (index, CHAR_BG (priv->color));
+}
+
+void
+console_set_background_index (Console *console, gint index)
+{
+  ConsolePrivate *priv;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (index >= 0 && index < CONSOLE_PALETTE_SIZE);
+
+  priv = console->priv;
+  priv->color = CHAR_COLOR (CHAR_FG (priv->color), index);
+}
+
+void
+console_get_palette_color (Console *console, gint index, GdkColor *color)
+{
+  ConsoleColor *c;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (color != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (index >= 0 && index < CONSOLE_PALETTE_SIZE);
+
+  c = console->priv->palette + index;
+
+  color->red = c->red * GDK_COLOR_SCALE;
+  color->green = c->green * GDK_COLOR_SCALE;
+  color->blue = c->blue * GDK_COLOR_SCALE;
+}
+
+void
+console_set_palette_color (Console *console, gint index, const GdkColor *color)
+{
+  ConsoleColor *c;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (color != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (index >= 0 && index < CONSOLE_PALETTE_SIZE);
+
+  c = console->priv->palette + index;
+
+  c->red = color->red / GDK_COLOR_SCALE;
+  c->green = color->green / GDK_COLOR_SCALE;
+  c->blue = color->blue / GDK_COLOR_SCALE;
+
+  /* Characters refer to palette entries, so a recolor is just a repaint
+   * once the rows rendered with old colors are dropped.
+   */
+  row_cache_clear (console->priv);
+  damage_all (console);
+}
+
+void
+console_set_height (Console *console, gint height)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (height > 0);
+
+  resize_screen (console, console->priv->width, height);
+  console->priv->height = height;
+
+  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
+    {
+      gtk_widget_queue_resize (GTK_WIDGET (console));
+      console_redraw (console);
+    }
+}
+
+void
+console_set_width (Console *console, gint width)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (width > 0);
+
+  resize_screen (console, width, console->priv->height);
+  console->priv->width = width;
+
+  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
+    {
+      gtk_widget_queue_resize (GTK_WIDGET (console));
+      console_redraw (console);
+    }
+}
+
+void
+console_set_size (Console *console, gint width, gint height)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (width > 0 && height > 0);
+
+  resize_screen (console, width, height);
+  console->priv->width = width;
+  console->priv->height = height;
+
+  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
+    {
+      gtk_widget_queue_resize (GTK_WIDGET (console));
+      console_redraw (console);
+    }
+}
+
+void
+console_set_font_family (Console *console, const char *family)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (family != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  if (g_strcmp0 (console->priv->font_family, family) == 0)
+    return;
+
+  if (console->priv->font_family)
+    g_free (console->priv->font_family);
+
+  console->priv->font_family = g_strdup (family);
+  console->priv->font_changes |= PROP_FONT_FAMILY_MASK;
+
+  font_job_queue (console);
+}
+
+void
+console_set_font_style (Console *console, const char *style)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (style != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  if (g_strcmp0 (console->priv->font_style, style) == 0)
+    return;
+
+  if (console->priv->font_style)
+    g_free (console->priv->font_style);
+
+  console->priv->font_style = g_strdup (style);
+  console->priv->font_changes |= PROP_FONT_STYLE_MASK;
+
+  font_job_queue (console);
+}
+
+void
+console_set_font_size (Console *console, gint size)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (size > 0);
+
+  if (console->priv->font_size == size)
+    return;
+
+  console->priv->font_size = size;
+  console->priv->font_changes |= PROP_FONT_SIZE_MASK;
+
+  font_job_queue (console);
+}
+
+/* Changes the font size by steps of the zoom scale, zooming in for positive
+ * steps and out for negative ones. Recently used sizes are switched to
+ * without loading the font.
+ */
+void
+console_zoom (Console *console, gint steps)
+{
+  gint size, i, n;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  size = console->priv->font_size;
+  n = G_N_ELEMENTS (zoom_sizes);
+
+  /* the font size may be off the scale */
+  if (steps > 0)
+    {
+      for (i = 0; i < n && zoom_sizes[i] <= size; i++)
+        ;
+      i += steps - 1;
+    }
+  else if (steps < 0)
+    {
+      for (i = n - 1; i >= 0 && zoom_sizes[i] >= size; i--)
+        ;
+      i += steps + 1;
+    }
+  else
+    return;
+
+  i = CLAMP (i, 0, n - 1);
+
+  if (zoom_sizes[i] != size)
+    console_set_font_size (console, zoom_sizes[i]);
+}
+
+void
+console_set_cursor_shape (Console *console, ConsoleCursorShape shape)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  if (shape < 0 || shape >= CONSOLE_CURSOR_MAX)
+    shape = CONSOLE_CURSOR_DEFAULT;
+
+  console->priv->cursor_shape = shape;
+
+  damage_cursor (console);
+}
+
+void
+console_set_cursor_timer (Console *console, ConsoleBlinkTimer timer)
+{
+  gint timeout;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  if (console->priv->cursor_timer_id > 0)
+    g_source_remove (console->priv->cursor_timer_id);
+
+  console->priv->cursor_timer_id = 0;
+  timeout = 0;
+
+  switch (timer)
+    {
+      case CONSOLE_BLINK_STEADY:
+        console->priv->cursor_toggle = TRUE;
+        break;
+
+      case CONSOLE_BLINK_SLOW:
+        timeout = CURSOR_BLINKING_TIMER * 2;
+        break;
+
+      case CONSOLE_BLINK_MEDIUM:
+        timeout = CURSOR_BLINKING_TIMER;
+        break;
 
-  object_class->finalize = console_finalize;
+      case CONSOLE_BLINK_FAST:
+        timeout = CURSOR_BLINKING_TIMER / 2;
+        break;
+
+      default:
+        g_warn_if_reached ();
+        break;
+    }
+
+  if (timeout > 0)
+    {
+      console->priv->cursor_timer_id =
+        g_timeout_add (timeout, (GSourceFunc) console_cursor_timer, console);
+    }
+
+  damage_cursor (console);
 }
 
-static void
-color_parse (ConsoleColor *color, const char *spec)
+gint
+console_get_width (Console *console)
 {
-  GdkColor gdkcolor;
+  g_return_val_if_fail (console != NULL, -1);
+  g_return_val_if_fail (IS_CONSOLE (console), -1);
 
-  g_assert (spec != NULL);
+  return console->priv->width;
+}
 
-  gdk_color_parse (spec, &gdkcolor);
+gint
+console_get_height (Console *console)
+{
+  g_return_val_if_fail (console != NULL, -1);
+  g_return_val_if_fail (IS_CONSOLE (console), -1);
 
-  color->red = gdkcolor.red / GDK_COLOR_SCALE;
-  color->green = gdkcolor.green / GDK_COLOR_SCALE;
-  color->blue = gdkcolor.blue / GDK_COLOR_SCALE;
+  return console->priv->height;
 }
 
-/* This helper resizes the screen to a new width and height.
+gint
+console_get_font_size (Console *console)
+{
+  g_return_val_if_fail (console != NULL, -1);
+  g_return_val_if_fail (IS_CONSOLE (console), -1);
+
+  return console->priv->font_size;
+}
+
+const gchar*
+console_get_font_family (Console *console)
+{
+  g_return_val_if_fail (console != NULL, NULL);
+  g_return_val_if_fail (IS_CONSOLE (console), NULL);
+
+  return console->priv->font_family;
+}
+
+const gchar*
+console_get_font_style (Console *console)
+{
+  g_return_val_if_fail (console != NULL, NULL);
+  g_return_val_if_fail (IS_CONSOLE (console), NULL);
+
+  return console->priv->font_style;
+}
+
+ConsoleCursorShape
+console_get_cursor_shape (Console *console)
+{
+  g_return_val_if_fail (console != NULL, -1);
+  g_return_val_if_fail (IS_CONSOLE (console), -1);
+
+  return console->priv->cursor_shape;
+}
+
+void
+console_set_max_fps (Console *console, gint max_fps)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (max_fps >= 0);
+
+  console->priv->max_fps = max_fps;
+}
+
+gint
+console_get_max_fps (Console *console)
+{
+  g_return_val_if_fail (console != NULL, -1);
+  g_return_val_if_fail (IS_CONSOLE (console), -1);
+
+  return console->priv->max_fps;
+}
+
+void
+console_get_stats (Console *console, ConsoleStats *stats)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (stats != NULL);
+
+  *stats = console->priv->stats;
+}
+
+/* This helper creates or destroys the render thread pool according to the
+ * number of render threads.
  */
 static void
-resize_screen (Console *console, gint width, gint height)
+render_pool_update (ConsolePrivate *priv)
+{
+  GError *error = NULL;
+
+  if (priv->render_pool != NULL)
+    {
+      /* wait for the threads to finish, they never run across frames anyway */
+      g_thread_pool_free (priv->render_pool, FALSE, TRUE);
+      priv->render_pool = NULL;
+    }
+
+  if (priv->render_threads <= 0)
+    return;
+
+  if (priv->render_done == NULL)
+    priv->render_done = g_async_queue_new ();
+
+  priv->render_pool = g_thread_pool_new (render_band_func, NULL, priv->render_threads, TRUE, &error);
+
+  if (priv->render_pool == NULL)
+    {
+      g_warning ("can't start render threads: %s", error->message);
+      g_error_free (error);
+      priv->render_threads = 0;
+    }
+}
+
+void
+console_set_render_threads (Console *console, gint n_threads)
 {
   ConsolePrivate *priv;
-  ConsoleChar *old_scr;
-  ConsoleChar *scr;
-  guint alloc_size;
-  gint old_width, old_height;
-  gint i, j;
 
-  g_assert (console != NULL);
-  g_assert (width > 0 && height > 0);
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (n_threads >= RENDER_THREADS_MIN && n_threads <= RENDER_THREADS_MAX);
 
   priv = console->priv;
 
-  old_scr = priv->scr;
-  old_width = priv->width;
-  old_height = priv->height;
+  if (priv->render_threads == n_threads)
+    return;
 
-  alloc_size = width * height;
-  scr = g_malloc0 (alloc_size * sizeof (ConsoleChar));
+  priv->render_threads = n_threads;
+  render_pool_update (priv);
+}
 
-  for (i = 0; i < height; i++)
-    {
-      for (j = 0; j < width; j++)
-        {
-          /* Try to relocate contents of the old screen to the new one.
-           */
-          if (old_scr != NULL &&
-              (i < priv->height && j < priv->width))
-            {
-              ConsoleChar *dst, *src;
+gint
+console_get_render_threads (Console *console)
+{
+  g_return_val_if_fail (console != NULL, -1);
+  g_return_val_if_fail (IS_CONSOLE (console), -1);
 
-              dst = scr + i*width + j;
-              src = old_scr + i*old_width + j;
+  return console->priv->render_threads;
+}
 
-              *dst = *src;
-            }
-          else
-            {
-              ConsoleChar *chr;
+void
+console_set_row_cache_size (Console *console, gint size)
+{
+  ConsolePrivate *priv;
 
-              chr = scr + i*width + j;
-              chr->chr = ' ';
-              chr->color = priv->color;
-              chr->bg_color = priv->bg_color;
-              chr->attr = CONSOLE_CHAR_ATTR_DEFAULT;
-            }
-        }
-    }
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (size >= ROW_CACHE_SIZE_MIN && size <= ROW_CACHE_SIZE_MAX);
 
-  priv->scr = scr;
-  priv->width = width;
-  priv->height = height;
+  priv = console->priv;
 
-  /* correct cursor position */
-  if (priv->cursor_x >= width)
-    priv->cursor_x = width - 1;
-  if (priv->cursor_y >= height)
-    priv->cursor_y = height - 1;
+  priv->row_cache_size = size;
+  row_cache_trim (priv, (gsize) size * 1024);
+}
 
-  if (old_scr != NULL)
-    g_free (old_scr);
+gint
+console_get_row_cache_size (Console *console)
+{
+  g_return_val_if_fail (console != NULL, -1);
+  g_return_val_if_fail (IS_CONSOLE (console), -1);
+
+  return console->priv->row_cache_size;
 }
 
-static void
-console_init (Console *console)
+void
+console_set_font_cache_size (Console *console, gint size)
 {
   ConsolePrivate *priv;
-  gint i, tid;
 
   g_return_if_fail (console != NULL);
-  g_return_if_fail (IS_CONSOLE(console));
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (size >= FONT_CACHE_SIZE_MIN && size <= FONT_CACHE_SIZE_MAX);
 
-  g_debug ("console: init");
+  priv = console->priv;
 
-  priv = CONSOLE_GET_PRIVATE (console);
-  console->priv = priv;
+  priv->font_cache_size = size;
+  font_cache_trim (priv, (gsize) size * 1024);
+}
 
-  /* set initial cursor position to the top left corner */
-  priv->cursor_x = 0;
-  priv->cursor_y = 0;
-  priv->cursor_shape = CONSOLE_CURSOR_DEFAULT;
-  priv->cursor_toggle = FALSE;
-  /* start cursor blinking timer */
-  tid = g_timeout_add (CURSOR_BLINKING_TIMER, (GSourceFunc) console_cursor_timer, console);
-  priv->cursor_timer_id = tid;
+gint
+console_get_font_cache_size (Console *console)
+{
+  g_return_val_if_fail (console != NULL, -1);
+  g_return_val_if_fail (IS_CONSOLE (console), -1);
 
-  /* initialize default colors for the console characters */
-  color_parse (&priv->color, COLOR_BASE0);
-  color_parse (&priv->bg_color, COLOR_BASE03);
+  return console->priv->font_cache_size;
+}
 
-  /* initialize default font */
-  priv->font_family = g_strdup (FONT_FAMILY_DEFAULT);
-  priv->font_style = g_strdup (FONT_STYLE_DEFAULT);
-  priv->face_index = 0;
-  priv->font_size = FONT_SIZE_DEFAULT;
-  priv->font_file = NULL;
+/* Sets the memory budget of the FreeType cache shared by all consoles in
+ * kilobytes, zero means the FreeType default. The cache is created along
+ * with the first console, so the budget is set before creating consoles.
+ */
+void
+console_set_freetype_cache_size (gint size)
+{
+  g_return_if_fail (size >= FREETYPE_CACHE_SIZE_MIN && size <= FREETYPE_CACHE_SIZE_MAX);
 
-  /* initialize FreeType backend */
-  console_font_cache_init (priv);
+  freetype_cache_size = size;
+  ft_cache_set_max_bytes ((gsize) size * 1024);
+}
 
-  priv->char_width = -1;
-  priv->char_height = -1;
-  priv->baseline = -1;
+gint
+console_get_freetype_cache_size (void)
+{
+  return freetype_cache_size;
+}
 
-  /* initial selection
-   */
-  priv->text_selection.x1 = -1;
-  priv->text_selection.y1 = -1;
-  priv->text_selection.x2 = -1;
-  priv->text_selection.y2 = -1;
+void
+console_set_scrollback_lines (Console *console, gint n_lines)
+{
+  ConsolePrivate *priv;
 
-  /* set default TAB position each 8 characters */
-  for (i = 0; i < TABMAP_SIZE; i++)
-    priv->tabs[i] = 0x01010101;
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (n_lines >= SCROLLBACK_LINES_MIN && n_lines <= SCROLLBACK_LINES_MAX);
 
-  /* callbacks */
-  g_signal_connect (GTK_WIDGET (console), "button-press-event", G_CALLBACK (console_button_press_event_cb), console);
-  g_signal_connect (GTK_WIDGET (console), "key-press-event", G_CALLBACK (console_key_press_event_cb), console);
-  g_signal_connect (GTK_WIDGET (console), "button-release-event", G_CALLBACK (console_button_release_event_cb), console);
-  g_signal_connect (GTK_WIDGET (console), "motion-notify-event", G_CALLBACK (console_motion_notify_event_cb), console);
+  priv = console->priv;
 
-  /* allocate console screen buffer */
-  resize_screen (console, CONSOLE_WIDTH_DEFAULT, CONSOLE_HEIGHT_DEFAULT);
+  /* the view may show lines about to be dropped */
+  view_reset (console);
+
+  scrollback_set_max_lines (priv->scrollback, n_lines);
+}
+
+gint
+console_get_scrollback_lines (Console *console)
+{
+  g_return_val_if_fail (console != NULL, -1);
+  g_return_val_if_fail (IS_CONSOLE (console), -1);
+
+  return scrollback_get_max_lines (console->priv->scrollback);
 }
 
-static gboolean
-console_primary_text_selected (Console *console, const gchar *str)
+/* Makes lines beyond the scrollback lines move to a spill file on disk,
+ * so the history keeps all lines.
+ */
+void
+console_set_scrollback_spill (Console *console, gboolean spill)
 {
-  GtkClipboard *clipboard;
+  ConsolePrivate *priv;
+  GError *error = NULL;
 
-  clipboard = gtk_clipboard_get (GDK_SELECTION_PRIMARY);
-  gtk_clipboard_set_text (clipboard, str, strlen(str));
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
 
-  return TRUE;
+  priv = console->priv;
+
+  /* the view may show spilled lines */
+  view_reset (console);
+
+  if (!spill)
+    scrollback_spill_disable (priv->scrollback);
+  else if (!scrollback_spill_enable (priv->scrollback, priv->width, CONSOLE_WIDTH_MAX, &error))
+    {
+      g_warning ("can't create scrollback spill file: %s", error->message);
+      g_error_free (error);
+    }
 }
 
-static gboolean
-console_clipboard_text_selected (Console *console, const gchar *str)
+gboolean
+console_get_scrollback_spill (Console *console)
 {
-  GtkClipboard *clipboard;
-
-  clipboard = gtk_clipboard_get (GDK_SELECTION_CLIPBOARD);
-  gtk_clipboard_set_text (clipboard, str, strlen(str));
+  g_return_val_if_fail (console != NULL, FALSE);
+  g_return_val_if_fail (IS_CONSOLE (console), FALSE);
 
-  return TRUE;
+  return scrollback_spill_is_enabled (console->priv->scrollback);
 }
 
-
 static void
-console_size_request (GtkWidget *widget, GtkRequisition *requisition)
+console_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
 {
-  GdkGeometry hints;
-  GtkWidget *toplevel;
-  Console *console;
-  ConsolePrivate *priv;
-  GdkScreen *screen;
-  FT_Face face;
-  double dpi_x, dpi_y, scale_x, scale_y;
-  gint face_index, error;
-  gint char_width, char_height, baseline;
-  gchar *file;
+  switch (prop_id)
+    {
+    case PROP_WIDTH:
+      console_set_width (CONSOLE (object), g_value_get_int (value));
+      break;
 
-  g_return_if_fail (widget != NULL);
-  g_return_if_fail (IS_CONSOLE(widget));
-  g_return_if_fail (requisition != NULL);
+    case PROP_HEIGHT:
+      console_set_height (CONSOLE (object), g_value_get_int (value));
+      break;
 
-  console = CONSOLE (widget);
-  priv = console->priv;
+    case PROP_FONT_SIZE:
+      console_set_font_size (CONSOLE (object), g_value_get_int (value));
+      break;
 
-  g_debug ("console: size request width %d height %d", priv->width, priv->height);
+    case PROP_FONT_STYLE:
+      console_set_font_style (CONSOLE (object), g_value_get_string (value));
+      break;
 
-  /* Get screen resolution in dots per inch. */
-  screen = gtk_widget_get_screen (widget);
-  dpi_x = gdk_screen_get_resolution (screen);
-  dpi_y = dpi_x;
+    case PROP_FONT_FAMILY:
+      console_set_font_family (CONSOLE (object), g_value_get_string (value));
+      break;
 
-  fc_get_font_file (priv->font_family ? priv->font_family : FONT_FAMILY_DEFAULT,
-                    priv->font_style ? priv->font_style : FONT_STYLE_DEFAULT,
-                    TRUE, TRUE, &file, &face_index);
+    case PROP_CURSOR_SHAPE:
+      console_set_cursor_shape (CONSOLE (object), g_value_get_enum (value));
+      break;
 
-  priv->face_index = face_index;
+    case PROP_CURSOR_TIMER:
+      console_set_cursor_timer (CONSOLE (object), g_value_get_enum (value));
+      break;
 
-  g_assert (file != NULL && face_index >= 0);
+    case PROP_MAX_FPS:
+      console_set_max_fps (CONSOLE (object), g_value_get_int (value));
+      break;
 
-  if (priv->font_file != NULL)
-    g_free (priv->font_file);
+    case PROP_RENDER_THREADS:
+      console_set_render_threads (CONSOLE (object), g_value_get_int (value));
+      break;
 
-  priv->font_file = file;
+    case PROP_ROW_CACHE_SIZE:
+      console_set_row_cache_size (CONSOLE (object), g_value_get_int (value));
+      break;
 
-  /* Before looking up font metrics, reset the cache, because we don't need
-   * it's contents any more for sure. Resize is requested when the font it
-   * changed, so we need to drop previous cached items either.
-   */
-  console_font_cache_reset (priv);
+    case PROP_FONT_CACHE_SIZE:
+      console_set_font_cache_size (CONSOLE (object), g_value_get_int (value));
+      break;
 
-  /* Lookup face to determine font metrics. */
-  error = FTC_Manager_LookupFace (priv->manager, (FTC_FaceID) priv, &face);
-  if (error != 0)
-    g_error ("can't lookup face in the cache");
+    case PROP_SCROLLBACK_LINES:
+      console_set_scrollback_lines (CONSOLE (object), g_value_get_int (value));
+      break;
 
-  /* Scale metrics using screen dpi and units per EM. */
-  scale_x = (priv->font_size * dpi_x / 72.0) / (double) face->units_per_EM;
-  scale_y = (priv->font_size * dpi_y / 72.0) / (double) face->units_per_EM;
+    case PROP_SCROLLBACK_SPILL:
+      console_set_scrollback_spill (CONSOLE (object), g_value_get_boolean (value));
+      break;
 
-  g_debug ("scale_x = %f scale_y = %f", scale_x, scale_y);
-  g_debug ("ascender %d descender %d underline %d max_advance_width %d",
-           face->ascender >> 6, face->descender >> 6,
-           face->underline_position >> 6, face->max_advance_width >> 6);
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
 
-  /* Calculate font height, width and baseline position (in pixels). */
-  if (face->bbox.xMin < 0)
-    char_width = face->bbox.xMax * scale_x + 0.5;
-  else
-    char_width = (face->bbox.xMax + face->bbox.xMin) * scale_x + 0.5;
+static void
+console_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+  switch (prop_id)
+    {
+    case PROP_WIDTH:
+      g_value_set_int (value, console_get_width (CONSOLE (object)));
+      break;
 
-  char_height = (face->bbox.yMax - face->bbox.yMin) * scale_y + 0.5;
-  if (char_height < 0)
-    char_height = face->bbox.yMax * scale_y + 0.5;
+    case PROP_HEIGHT:
+      g_value_set_int (value, console_get_height (CONSOLE (object)));
+      break;
 
-  baseline = face->bbox.yMax * scale_y;
+    case PROP_FONT_SIZE:
+      g_value_set_int (value, console_get_font_size (CONSOLE (object)));
+      break;
 
-  g_assert (baseline >= 0);
+    case PROP_FONT_STYLE:
+      g_value_set_string (value, console_get_font_style (CONSOLE (object)));
+      break;
 
-  priv->char_width = char_width;
-  priv->char_height = char_height;
-  priv->baseline = baseline;
+    case PROP_FONT_FAMILY:
+      g_value_set_string (value, console_get_font_family (CONSOLE (object)));
+      break;
 
-  g_debug ("xMin %d xMax %d yMax %d yMin %d", (int)face->bbox.xMin, (int)face->bbox.xMax, (int)face->bbox.yMax, (int)face->bbox.yMin);
-  g_debug ("char_width %d, char_height %d, baseline %d", char_width, char_height, baseline);
+    case PROP_CURSOR_SHAPE:
+      g_value_set_int (value, console_get_cursor_shape (CONSOLE (object)));
+      break;
 
-  /* Calculate console window size required. */
-  requisition->width = priv->char_width * priv->width;
-  requisition->height = priv->char_height * priv->height;
+    case PROP_MAX_FPS:
+      g_value_set_int (value, console_get_max_fps (CONSOLE (object)));
+      break;
 
-  /* Do the canonical terminal window geometry hints to resize properly. */
-  toplevel = gtk_widget_get_toplevel (widget);
+    case PROP_RENDER_THREADS:
+      g_value_set_int (value, console_get_render_threads (CONSOLE (object)));
+      break;
 
-  if (GTK_WIDGET_TOPLEVEL (toplevel))
-    {
-      hints.width_inc = priv->char_width;
-      hints.height_inc = priv->char_height;
-      hints.base_width = priv->char_width;
-      hints.base_height = priv->char_height;
-      hints.min_width = priv->char_width;
-      hints.min_height = priv->char_height;
+    case PROP_ROW_CACHE_SIZE:
+      g_value_set_int (value, console_get_row_cache_size (CONSOLE (object)));
+      break;
 
-      gtk_window_set_geometry_hints (GTK_WINDOW (toplevel),
-                                     GTK_WIDGET (widget),
-                                     &hints,
-                                     GDK_HINT_MIN_SIZE |
-                                     GDK_HINT_BASE_SIZE |
-                                     GDK_HINT_RESIZE_INC);
+    case PROP_FONT_CACHE_SIZE:
+      g_value_set_int (value, console_get_font_cache_size (CONSOLE (object)));
+      break;
+
+    case PROP_SCROLLBACK_LINES:
+      g_value_set_int (value, console_get_scrollback_lines (CONSOLE (object)));
+      break;
+
+    case PROP_SCROLLBACK_SPILL:
+      g_value_set_boolean (value, console_get_scrollback_spill (CONSOLE (object)));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
     }
 }
 
-
+/* This helper makes the backing pixmap match the size of the widget window
+ * and renders the whole screen into it if its contents are stale.
+ */
 static void
-console_size_allocate (GtkWidget *widget,
-                           GtkAllocation *allocation)
+backing_update (Console *console)
 {
+  ConsolePrivate *priv;
+  GtkWidget *widget;
   gint width, height;
 
-  g_return_if_fail (widget != NULL);
-  g_return_if_fail (IS_CONSOLE(widget));
-  g_return_if_fail (allocation != NULL);
+  priv = console->priv;
+  widget = GTK_WIDGET (console);
 
-  widget->allocation = *allocation;
+  gdk_drawable_get_size (widget->window, &width, &height);
 
-  g_debug ("console: allocate x=%d y=%d width=%d height=%d",
-           allocation->x, allocation->y,
-           allocation->width, allocation->height);
+  if (priv->backing != NULL)
+    {
+      gint backing_width, backing_height;
 
-  if (GTK_WIDGET_REALIZED (widget))
+      gdk_drawable_get_size (priv->backing, &backing_width, &backing_height);
+
+      if (backing_width != width || backing_height != height)
+        {
+          g_object_unref (priv->backing);
+          priv->backing = NULL;
+        }
+    }
+
+  if (priv->backing == NULL)
     {
-      allocation->width = ROUND_UP(allocation->width, CONSOLE(widget)->priv->char_width);
-      allocation->height = ROUND_UP(allocation->height, CONSOLE(widget)->priv->char_height);
+      g_debug ("console: new backing pixmap %dx%d", width, height);
 
-      /* Resize widget window and move to allocated position
-       * relative to it's parent window.
+      priv->backing = gdk_pixmap_new (widget->window, width, height, -1);
+      priv->backing_valid = FALSE;
+    }
+
+  if (priv->backing_gc == NULL)
+    {
+      priv->backing_gc = gdk_gc_new (widget->window);
+      gdk_gc_set_exposures (priv->backing_gc, FALSE);
+    }
+
+  if (!priv->backing_valid)
+    {
+      ConsoleColor color;
+      GdkRectangle rect;
+      GdkRegion *region;
+      cairo_t *cr;
+
+      /* Clear the area the character cells don't cover.
        */
+      color_parse (&color, COLOR_BASE02);
 
-      gdk_window_move_resize (widget->window,
-                              allocation->x, allocation->y,
-                              allocation->width, allocation->height);
+      cr = gdk_cairo_create (priv->backing);
+      cairo_set_source_rgb (cr, color.red, color.green, color.blue);
+      cairo_paint (cr);
+      cairo_destroy (cr);
 
-      width = allocation->width / CONSOLE(widget)->priv->char_width;
-      height = allocation->height / CONSOLE(widget)->priv->char_height;
+      rect.x = 0;
+      rect.y = 0;
+      rect.width = width;
+      rect.height = height;
 
-      resize_screen (CONSOLE(widget), width, height);
+      region = gdk_region_rectangle (&rect);
+      console_draw (console, region);
+      gdk_region_destroy (region);
+
+      priv->backing_valid = TRUE;
     }
 }
 
+/* This helper drops the backing pixmap contents and requests the whole
+ * widget to be drawn again.
+ */
 static void
-console_realize (GtkWidget *widget)
+console_redraw (Console *console)
+{
+  console->priv->backing_valid = FALSE;
+  gtk_widget_queue_draw (GTK_WIDGET (console));
+}
+
+static gboolean
+console_expose (GtkWidget *widget, GdkEventExpose *event)
 {
   ConsolePrivate *priv;
-  GdkWindowAttr attr;
-  GdkColor color;
-  guint attr_mask, event_mask;
+  GdkRectangle *area;
 
-  g_return_if_fail (widget != NULL);
-  g_return_if_fail (IS_CONSOLE(widget));
+  g_return_val_if_fail (widget != NULL, FALSE);
+  g_return_val_if_fail (IS_CONSOLE(widget), FALSE);
+  g_return_val_if_fail (event != NULL, FALSE);
+
+/*  g_debug ("console_expose: event->area.x %d event->area.y %d width %d height %d",
+           event->area.x, event->area.y, event->area.width, event->area.height);*/
 
   priv = CONSOLE (widget)->priv;
 
-  g_debug ("console: realize");
+  backing_update (CONSOLE (widget));
 
-  GTK_WIDGET_SET_FLAGS (widget, GTK_REALIZED | GTK_DOUBLE_BUFFERED | GTK_CAN_FOCUS);
+  /* Exposed areas are copied from the backing pixmap which already keeps
+   * the rendered screen.
+   */
+  area = &event->area;
 
-  attr.window_type = GDK_WINDOW_CHILD;
-  attr.x = widget->allocation.x;
-  attr.y = widget->allocation.y;
-  attr.width = widget->allocation.width;
-  attr.height = widget->allocation.height;
+  gdk_gc_set_clip_region (priv->backing_gc, event->region);
+  gdk_draw_drawable (widget->window, priv->backing_gc, priv->backing,
+                     area->x, area->y, area->x, area->y, area->width, area->height);
 
-  attr.wclass = GDK_INPUT_OUTPUT;
+  /* The cursor is drawn over the screen contents. */
+  expose_cursor (CONSOLE (widget), event->region);
 
-  event_mask = GDK_EXPOSURE_MASK | GDK_KEY_PRESS_MASK | GDK_BUTTON_PRESS_MASK |
-               GDK_BUTTON_RELEASE_MASK | GDK_POINTER_MOTION_MASK;
-  attr.event_mask = gtk_widget_get_events (widget) | event_mask;
+  gdk_gc_set_clip_region (priv->backing_gc, NULL);
 
-  attr_mask = GDK_WA_X | GDK_WA_Y;
+  return FALSE;
+}
+
+/* This helper determines cursor rectangle position and size
+ * according to cursor appearence and returns it in the
+ * GdkRectangle structure provided by the caller.
+ */
+static void
+get_cursor_rectangle (ConsolePrivate *priv, double xc, double yc, GdkRectangle *rect)
+{
+
+  rect->width = priv->char_width;
+  rect->x = xc;
+
+  switch (priv->cursor_shape)
+    {
+    case CONSOLE_CURSOR_FULL_BLOCK:
+    case CONSOLE_CURSOR_DEFAULT:
+      rect->height = priv->char_height;
+      rect->y = yc;
+      break;
+
+    case CONSOLE_CURSOR_UNDERSCORE:
+      rect->height = 3.0;
+      rect->y = yc + priv->baseline - 1.0;
+      break;
+
+    case CONSOLE_CURSOR_LOWER_THIRD:
+      rect->height = priv->char_height / 3.0;
+      rect->y = yc + priv->char_height * (2.0 / 3.0);
+      break;
 
-  widget->window = gdk_window_new (gtk_widget_get_parent_window (widget), &attr, attr_mask);
+    case CONSOLE_CURSOR_LOWER_HALF:
+      rect->height = priv->char_height * 0.5;
+      rect->y = yc + priv->char_height * 0.5;
+      break;
 
-  gdk_window_set_user_data (widget->window, widget);
+    case CONSOLE_CURSOR_TWO_THIRDS:
+      rect->height = priv->char_height * (2.0 / 3.0);
+      rect->y = yc + priv->char_height / 3.0;
+      break;
 
-  gdk_color_parse (COLOR_BASE02, &color);
-  gdk_rgb_find_color (gtk_widget_get_colormap (widget), &color);
-  gdk_window_set_background (widget->window, &color);
+    case CONSOLE_CURSOR_VERT_THIRD:
+      rect->height = priv->char_height;
+      rect->width = priv->char_width / 3.0;
+      rect->y = yc;
+      break;
 
- // gdk_window_set_back_pixmap (widget->window, NULL, TRUE);
+    case CONSOLE_CURSOR_VERT_HALF:
+      rect->height = priv->char_height;
+      rect->width = priv->char_width * 0.5;
+      rect->y = yc;
+      break;
 
-  widget->style = gtk_style_attach (widget->style, widget->window);
-  //gtk_style_set_background (widget->style, widget->window, GTK_STATE_NORMAL);
+    case CONSOLE_CURSOR_INVISIBLE:
+      rect->x = 0;
+      rect->y = 0;
+      rect->width = 0;
+      rect->height = 0;
+      break;
+    }
 }
 
-void
-console_get_foreground_color (Console *console, GdkColor *color)
+/* This helper returns TRUE if the cursor must be displayed.
+ */
+static gboolean
+cursor_is_visible (const ConsolePrivate *priv)
 {
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (color != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
-
-  color->red = console->priv->color.red * GDK_COLOR_SCALE;
-  color->green = console->priv->color.green * GDK_COLOR_SCALE;
-  color->blue = console->priv->color.blue * GDK_COLOR_SCALE;
+  if ((priv->cursor_shape != CONSOLE_CURSOR_INVISIBLE) && priv->cursor_toggle && priv->view_offset == 0)
+    return TRUE;
+  else
+    return FALSE;
 }
 
-void
-console_get_background_color (Console *console, GdkColor *color)
+static gboolean
+console_gdk_rectangle_intersect (GdkRectangle *src1, GdkRectangle *src2)
 {
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (color != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
+  gint dest_x, dest_y;
+  gint dest_x2, dest_y2;
+
+  dest_x = MAX (src1->x, src2->x);
+  dest_y = MAX (src1->y, src2->y);
+  dest_x2 = MIN (src1->x + src1->width, src2->x + src2->width);
+  dest_y2 = MIN (src1->y + src1->height, src2->y + src2->height);
 
-  color->red = console->priv->bg_color.red * GDK_COLOR_SCALE;
-  color->green = console->priv->bg_color.green * GDK_COLOR_SCALE;
-  color->blue = console->priv->bg_color.blue * GDK_COLOR_SCALE;
+  if (dest_x2 >= dest_x && dest_y2 >= dest_y)
+    {
+      return TRUE;
+    }
+  
+  return FALSE;
 }
 
-void
-console_set_foreground_color (Console *console, const GdkColor *color)
+/* This helper returns the palette colors a character at position [x,y] is
+ * displayed with. Colors are swapped for characters with reverse attribute and for
+ * characters inside the text selection area.
+ */
+static void
+get_char_colors (const ConsolePrivate *priv,
+                 const ConsoleChar    *chr,
+                 GdkRectangle         *selection,
+                 gint                  x,
+                 gint                  y,
+                 const ConsoleColor  **color,
+                 const ConsoleColor  **bg_color)
 {
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (color != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
+  GdkRectangle rect;
+  gboolean reverse;
 
-  console->priv->color.red = color->red / GDK_COLOR_SCALE;
-  console->priv->color.green = color->green / GDK_COLOR_SCALE;
-  console->priv->color.blue = color->blue / GDK_COLOR_SCALE;
-}
+  rect.x = x * priv->char_width;
+  rect.y = y * priv->char_height;
+  rect.width = priv->char_width;
+  rect.height = priv->char_height;
 
-void
-console_set_background_color (Console *console, const GdkColor *color)
-{
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (color != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
+  reverse = (chr->attr == CONSOLE_CHAR_ATTR_REVERSE);
 
-  console->priv->bg_color.red = color->red / GDK_COLOR_SCALE;
-  console->priv->bg_color.green = color->green / GDK_COLOR_SCALE;
-  console->priv->bg_color.blue = color->blue / GDK_COLOR_SCALE;
+  if (console_gdk_rectangle_intersect (&rect, selection))
+    reverse = !reverse;
+
+  if (reverse)
+    {
+      *color = priv->palette + CHAR_BG (chr->color);
+      *bg_color = priv->palette + CHAR_FG (chr->color);
+    }
+  else
+    {
+      *color = priv->palette + CHAR_FG (chr->color);
+      *bg_color = priv->palette + CHAR_BG (chr->color);
+    }
 }
 
-void
-console_set_foreground_color_from_string (Console *console, const gchar *color)
+/* This helper renders characters of a band into the band image. Glyphs
+ * were rasterised into the atlas beforehand, so only read-only data is
+ * accessed here and bands may be rendered by several threads at once.
+ */
+static void
+render_band (ConsoleBand *band)
 {
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (color != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
+  ConsoleBandJob *job = band->job;
+  ConsolePrivate *priv = job->priv;
+  RasterImage *image = &band->image;
+  gint x, y, box_width, char_width, char_height, baseline;
+  gint phase_x, phase_y;
 
-  color_parse (&console->priv->color, color);
-}
+  char_width = priv->char_width;
+  char_height = priv->char_height;
+  baseline = priv->baseline;
+  box_width = job->x2 - job->x1;
 
-void
-console_set_background_color_from_string (Console *console, const gchar *color)
-{
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (color != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
+  /* screen position of the band image */
+  phase_x = job->x1 * char_width;
+  phase_y = band->y1 * char_height;
 
-  color_parse (&console->priv->bg_color, color);
-}
+  for (y = band->y1; y < band->y2; y++)
+    {
+      const GlyphSlot **slots;
+      const ConsoleColor *run_color, *color, *bg_color;
+      ConsoleChar *row;
+      gint yc, run_start;
+
+      row = VIEW_ROW (priv, y);
+      slots = job->slots + (y - job->y1)*box_width - job->x1;
+      yc = (y - band->y1) * char_height;
+
+      /* Fill backgrounds first, glyphs may overhang neighbour characters.
+       * Adjacent characters sharing the same background color are merged
+       * into a single rectangle.
+       */
+      get_char_colors (priv, row + job->x1, &job->selection, job->x1, y, &color, &run_color);
+      run_start = job->x1;
 
-void
-console_set_height (Console *console, gint height)
-{
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
-  g_return_if_fail (height > 0);
+      for (x = job->x1 + 1; x <= job->x2; x++)
+        {
+          if (x < job->x2)
+            {
+              get_char_colors (priv, row + x, &job->selection, x, y, &color, &bg_color);
+              if (bg_color == run_color)
+                continue;
+            }
 
-  resize_screen (console, console->priv->width, height);
-  console->priv->height = height;
+          raster_fill_rect (image, (run_start - job->x1) * char_width, yc,
+                            (x - run_start) * char_width, char_height,
+                            job->palette[run_color - priv->palette]);
 
-  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
-    {
-      gtk_widget_queue_resize (GTK_WIDGET (console));
-      gtk_widget_queue_draw (GTK_WIDGET (console));
-    }
-}
+          run_color = bg_color;
+          run_start = x;
+        }
 
-void
-console_set_width (Console *console, gint width)
-{
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
-  g_return_if_fail (width > 0);
+      /* Now draw character glyphs, cursor and underline above the backgrounds.
+       */
+      for (x = job->x1; x < job->x2; x++)
+        {
+          const GlyphSlot *slot = slots[x];
+          guint32 fg, bg;
+          gint xc;
 
-  resize_screen (console, width, console->priv->height);
-  console->priv->width = width;
+          xc = (x - job->x1) * char_width;
 
-  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
-    {
-      gtk_widget_queue_resize (GTK_WIDGET (console));
-      gtk_widget_queue_draw (GTK_WIDGET (console));
-    }
-}
+          get_char_colors (priv, row + x, &job->selection, x, y, &color, &bg_color);
+          fg = job->palette[color - priv->palette];
+          bg = job->palette[bg_color - priv->palette];
 
-void
-console_set_size (Console *console, gint width, gint height)
-{
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
-  g_return_if_fail (width > 0 && height > 0);
+          if (BOXDRAW_IS_BOX_CHAR (row[x].chr))
+            boxdraw_render (image, xc, yc, char_width, char_height, phase_x, phase_y, row[x].chr, fg);
+          else if (slot != NULL && slot->width > 0)
+            {
+              raster_blend_mask (image, xc + slot->left, yc + baseline - slot->top,
+                                 job->atlas_data + slot->y*job->atlas_stride + slot->x,
+                                 job->atlas_stride, slot->width, slot->height, fg);
+            }
 
-  resize_screen (console, width, height);
-  console->priv->width = width;
-  console->priv->height = height;
+          if (job->cursor && x == priv->cursor_x && y == priv->cursor_y)
+            {
+              RasterImage cursor;
+              GdkRectangle rect;
 
-  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
-    {
-      gtk_widget_queue_resize (GTK_WIDGET (console));
-      gtk_widget_queue_draw (GTK_WIDGET (console));
+              /* Fill the cursor with foreground color and draw the glyph
+               * part it covers in background color.
+               */
+              get_cursor_rectangle (priv, xc, yc, &rect);
+              raster_image_clip (&cursor, image, rect.x, rect.y, rect.width, rect.height);
+              raster_fill_rect (&cursor, 0, 0, cursor.width, cursor.height, fg);
+
+              if (BOXDRAW_IS_BOX_CHAR (row[x].chr))
+                {
+                  boxdraw_render (&cursor, xc - rect.x, yc - rect.y, char_width, char_height,
+                                  phase_x + rect.x, phase_y + rect.y, row[x].chr, bg);
+                }
+              else if (slot != NULL && slot->width > 0)
+                {
+                  raster_blend_mask (&cursor, xc + slot->left - rect.x,
+                                     yc + baseline - slot->top - rect.y,
+                                     job->atlas_data + slot->y*job->atlas_stride + slot->x,
+                                     job->atlas_stride, slot->width, slot->height, bg);
+                }
+            }
+
+          if (row[x].attr == CONSOLE_CHAR_ATTR_UNDERSCORE)
+            raster_fill_rect (image, xc, yc + MIN (baseline + 1, char_height - 1), char_width, 1, fg);
+        }
     }
 }
 
-void
-console_set_font_family (Console *console, const char *family)
+/* This function is run by a render thread to render a band.
+ */
+static void
+render_band_func (gpointer data, gpointer user_data)
 {
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (family != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
-
-  if (console->priv->font_family)
-    g_free (console->priv->font_family);
+  ConsoleBand *band = data;
 
-  console->priv->font_family = g_strdup (family);
+  render_band (band);
 
-  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
-    {
-      gtk_widget_queue_resize (GTK_WIDGET (console));
-      gtk_widget_queue_draw (GTK_WIDGET (console));
-    }
+  g_async_queue_push (band->job->priv->render_done, band);
 }
 
-void
-console_set_font_style (Console *console, const char *style)
+/* This helper prepares rendering of the box [x1,y1]-[x2,y2) of the screen.
+ * FreeType and the atlas aren't thread safe, so all glyphs of the box are
+ * looked up here before rendering starts.
+ */
+static void
+box_job_init (ConsoleBandJob *job,
+              ConsolePrivate *priv,
+              GdkRectangle   *selection,
+              gint            x1,
+              gint            y1,
+              gint            x2,
+              gint            y2,
+              gdouble         dpi)
 {
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (style != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
+  gint x, y, i, box_width;
 
-  if (console->priv->font_style)
-    g_free (console->priv->font_style);
+  job->priv = priv;
+  job->x1 = x1;
+  job->y1 = y1;
+  job->x2 = x2;
+  job->y2 = y2;
+  job->selection = *selection;
+  job->cursor = FALSE;
 
-  console->priv->font_style = g_strdup (style);
+  box_width = x2 - x1;
 
-  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
+  job->slots = g_new (const GlyphSlot*, box_width * (y2 - y1));
+
+  for (y = y1; y < y2; y++)
     {
-      gtk_widget_queue_resize (GTK_WIDGET (console));
-      gtk_widget_queue_draw (GTK_WIDGET (console));
-    }
-}
+      ConsoleChar *row = VIEW_ROW (priv, y);
+      const GlyphSlot **slots = job->slots + (y - y1)*box_width - x1;
 
-void
-console_set_font_size (Console *console, gint size)
-{
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
-  g_return_if_fail (size > 0);
+      for (x = x1; x < x2; x++)
+        {
+          /* pseudographics is drawn without the font */
+          if (row[x].chr != ' ' && !BOXDRAW_IS_BOX_CHAR (row[x].chr))
+            slots[x] = console_glyph_lookup (priv, row[x].chr, dpi);
+          else
+            slots[x] = NULL;
+        }
+    }
 
-  console->priv->font_size = size;
+  job->atlas_data = NULL;
+  job->atlas_stride = 0;
 
-  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
+  if (priv->atlas != NULL)
     {
-      gtk_widget_queue_resize (GTK_WIDGET (console));
-      gtk_widget_queue_draw (GTK_WIDGET (console));
+      cairo_surface_t *surface = glyph_atlas_get_surface (priv->atlas);
+
+      cairo_surface_flush (surface);
+      job->atlas_data = cairo_image_surface_get_data (surface);
+      job->atlas_stride = cairo_image_surface_get_stride (surface);
     }
+
+  for (i = 0; i < CONSOLE_PALETTE_SIZE; i++)
+    job->palette[i] = raster_color (priv->palette[i].red, priv->palette[i].green, priv->palette[i].blue);
 }
 
-void
-console_set_cursor_shape (Console *console, ConsoleCursorShape shape)
+static void
+box_job_clear (ConsoleBandJob *job)
 {
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
-
-  if (shape < 0 || shape >= CONSOLE_CURSOR_MAX)
-    shape = CONSOLE_CURSOR_DEFAULT;
-
-  console->priv->cursor_shape = shape;
+  g_free (job->slots);
+  job->slots = NULL;
+}
 
-  invalidate_cursor_rect (console);
+/* This helper sets up a band of rows [y1,y2) of the box and creates
+ * its image.
+ */
+static void
+band_init (ConsoleBand *band, ConsoleBandJob *job, gint y1, gint y2)
+{
+  ConsolePrivate *priv = job->priv;
+
+  band->job = job;
+  band->y1 = y1;
+  band->y2 = y2;
+  band->surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, (job->x2 - job->x1) * priv->char_width,
+                                              (y2 - y1) * priv->char_height);
+  band->image.data = cairo_image_surface_get_data (band->surface);
+  band->image.width = cairo_image_surface_get_width (band->surface);
+  band->image.height = cairo_image_surface_get_height (band->surface);
+  band->image.stride = cairo_image_surface_get_stride (band->surface);
 }
 
-void
-console_set_cursor_timer (Console *console, ConsoleBlinkTimer timer)
+/* This helper renders the box [x1,y1]-[x2,y2) of the screen and composites
+ * it with the cairo context, which the caller is expected to clip. The box
+ * is split into n_bands horizontal bands, rendered by the render threads if
+ * there are more than one.
+ */
+static void
+draw_box (ConsolePrivate *priv,
+          cairo_t        *cr,
+          GdkRectangle   *selection,
+          gint            x1,
+          gint            y1,
+          gint            x2,
+          gint            y2,
+          gint            n_bands,
+          gdouble         dpi)
 {
-  gint timeout;
+  ConsoleBandJob job;
+  ConsoleBand *bands;
+  gint i, band_height;
 
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
+  box_job_init (&job, priv, selection, x1, y1, x2, y2, dpi);
 
-  if (console->priv->cursor_timer_id > 0)
-    g_source_remove (console->priv->cursor_timer_id);
+  if (priv->render_pool == NULL)
+    n_bands = 1;
 
-  console->priv->cursor_timer_id = 0;
-  timeout = 0;
+  n_bands = CLAMP (n_bands, 1, y2 - y1);
+  band_height = (y2 - y1 + n_bands - 1) / n_bands;
+  n_bands = (y2 - y1 + band_height - 1) / band_height;
 
-  switch (timer)
-    {
-      case CONSOLE_BLINK_STEADY:
-        console->priv->cursor_toggle = TRUE;
-        break;
+  bands = g_new (ConsoleBand, n_bands);
 
-      case CONSOLE_BLINK_SLOW:
-        timeout = CURSOR_BLINKING_TIMER * 2;
-        break;
+  for (i = 0; i < n_bands; i++)
+    {
+      ConsoleBand *band = bands + i;
 
-      case CONSOLE_BLINK_MEDIUM:
-        timeout = CURSOR_BLINKING_TIMER;
-        break;
+      band_init (band, &job, y1 + i*band_height, MIN (y1 + (i + 1)*band_height, y2));
 
-      case CONSOLE_BLINK_FAST:
-        timeout = CURSOR_BLINKING_TIMER / 2;
-        break;
+      if (n_bands > 1)
+        g_thread_pool_push (priv->render_pool, band, NULL);
+      else
+        render_band (band);
+    }
 
-      default:
-        g_warn_if_reached ();
-        break;
+  /* wait for all bands to be rendered */
+  if (n_bands > 1)
+    {
+      for (i = 0; i < n_bands; i++)
+        g_async_queue_pop (priv->render_done);
     }
 
-  if (timeout > 0)
+  for (i = 0; i < n_bands; i++)
     {
-      console->priv->cursor_timer_id =
-        g_timeout_add (timeout, (GSourceFunc) console_cursor_timer, console);
+      ConsoleBand *band = bands + i;
+
+      cairo_surface_mark_dirty (band->surface);
+      cairo_set_source_surface (cr, band->surface, x1 * priv->char_width, band->y1 * priv->char_height);
+      cairo_paint (cr);
+      cairo_surface_destroy (band->surface);
     }
 
-  invalidate_cursor_rect (console);
+  g_free (bands);
+  box_job_clear (&job);
 }
 
-gint
-console_get_width (Console *console)
+/* This helper returns a hash of the row contents rendered at the given
+ * screen resolution and shade pattern phase.
+ */
+static guint64
+row_hash (const ConsoleChar *row, gint width, gdouble dpi, gint phase)
 {
-  g_return_val_if_fail (console != NULL, -1);
-  g_return_val_if_fail (IS_CONSOLE (console), -1);
+  const guint8 *p, *end;
+  guint64 hash;
 
-  return console->priv->width;
-}
+  /* FNV-1a */
+  hash = G_GUINT64_CONSTANT (14695981039346656037);
+  hash = (hash ^ (guint64) (dpi * 64.0)) * G_GUINT64_CONSTANT (1099511628211);
+  hash = (hash ^ phase) * G_GUINT64_CONSTANT (1099511628211);
 
-gint
-console_get_height (Console *console)
-{
-  g_return_val_if_fail (console != NULL, -1);
-  g_return_val_if_fail (IS_CONSOLE (console), -1);
+  p = (const guint8 *) row;
+  end = (const guint8 *) (row + width);
 
-  return console->priv->height;
+  while (p < end)
+    hash = (hash ^ *p++) * G_GUINT64_CONSTANT (1099511628211);
+
+  return hash;
 }
 
-gint
-console_get_font_size (Console *console)
+static void
+row_cache_entry_free (ConsoleRowCacheEntry *entry)
 {
-  g_return_val_if_fail (console != NULL, -1);
-  g_return_val_if_fail (IS_CONSOLE (console), -1);
-
-  return console->priv->font_size;
+  cairo_surface_destroy (entry->surface);
+  g_free (entry->cells);
+  g_free (entry);
 }
 
-const gchar*
-console_get_font_family (Console *console)
+/* This helper removes an entry from the row cache.
+ */
+static void
+row_cache_remove (ConsolePrivate *priv, ConsoleRowCacheEntry *entry)
 {
-  g_return_val_if_fail (console != NULL, NULL);
-  g_return_val_if_fail (IS_CONSOLE (console), NULL);
-
-  return console->priv->font_family;
+  g_queue_unlink (&priv->row_lru, &entry->link);
+  g_hash_table_remove (priv->row_cache, &entry->hash);
+  priv->row_cache_bytes -= entry->size;
+  row_cache_entry_free (entry);
 }
 
-const gchar*
-console_get_font_style (Console *console)
+/* This helper evicts the least recently used rows until the row cache
+ * takes no more than budget bytes.
+ */
+static void
+row_cache_trim (ConsolePrivate *priv, gsize budget)
 {
-  g_return_val_if_fail (console != NULL, NULL);
-  g_return_val_if_fail (IS_CONSOLE (console), NULL);
+  while (priv->row_cache_bytes > budget)
+    row_cache_remove (priv, g_queue_peek_tail_link (&priv->row_lru)->data);
+}
 
-  return console->priv->font_style;
+/* This helper drops all rendered rows, it is called when the font or the
+ * palette changes.
+ */
+static void
+row_cache_clear (ConsolePrivate *priv)
+{
+  row_cache_trim (priv, 0);
 }
 
-ConsoleCursorShape
-console_get_cursor_shape (Console *console)
+/* This helper returns TRUE if the rendered row depends only on its contents,
+ * i.e. the text selection isn't displayed in it.
+ */
+static gboolean
+row_is_cacheable (ConsolePrivate *priv, GdkRectangle *selection, gint y)
 {
-  g_return_val_if_fail (console != NULL, -1);
-  g_return_val_if_fail (IS_CONSOLE (console), -1);
+  GdkRectangle rect;
 
-  return console->priv->cursor_shape;
+  rect.x = 0;
+  rect.y = y * priv->char_height;
+  rect.width = priv->width * priv->char_width;
+  rect.height = priv->char_height;
+
+  return !console_gdk_rectangle_intersect (&rect, selection);
 }
 
-static void
-console_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
+/* This helper draws row y of the screen using the row cache. A row rendered
+ * before is copied from the cache, otherwise it is rendered and added to the
+ * cache. It returns FALSE if the row can't be cached.
+ */
+static gboolean
+draw_row_cached (ConsolePrivate *priv, cairo_t *cr, GdkRectangle *selection, gint y, gdouble dpi)
 {
-  switch (prop_id)
+  ConsoleRowCacheEntry *entry;
+  ConsoleChar *row;
+  guint64 hash;
+  gint phase;
+
+  if (priv->row_cache_size <= 0 || !row_is_cacheable (priv, selection, y))
+    return FALSE;
+
+  /* Shade patterns are aligned to the screen, so a row may look different
+   * on odd and even pixel rows.
+   */
+  row = VIEW_ROW (priv, y);
+  phase = (y * priv->char_height) & 1;
+  hash = row_hash (row, priv->width, dpi, phase);
+
+  entry = g_hash_table_lookup (priv->row_cache, &hash);
+
+  /* The hash may collide, so contents of the rows are compared as well.
+   */
+  if (entry != NULL &&
+      (entry->width != priv->width || entry->dpi != dpi || entry->phase != phase ||
+       memcmp (entry->cells, row, priv->width * sizeof (ConsoleChar)) != 0))
     {
-    case PROP_WIDTH:
-      console_set_width (CONSOLE (object), g_value_get_int (value));
-      break;
+      row_cache_remove (priv, entry);
+      entry = NULL;
+    }
 
-    case PROP_HEIGHT:
-      console_set_height (CONSOLE (object), g_value_get_int (value));
-      break;
+  if (entry != NULL)
+    {
+      priv->stats.row_cache_hits++;
 
-    case PROP_FONT_SIZE:
-      console_set_font_size (CONSOLE (object), g_value_get_int (value));
-      break;
+      /* move the row to the head of LRU list */
+      g_queue_unlink (&priv->row_lru, &entry->link);
+      g_queue_push_head_link (&priv->row_lru, &entry->link);
+    }
+  else
+    {
+      ConsoleBandJob job;
+      ConsoleBand band;
+
+      priv->stats.row_cache_misses++;
+
+      box_job_init (&job, priv, selection, 0, y, priv->width, y + 1, dpi);
+      band_init (&band, &job, y, y + 1);
+      render_band (&band);
+      box_job_clear (&job);
+
+      cairo_surface_mark_dirty (band.surface);
+
+      entry = g_new0 (ConsoleRowCacheEntry, 1);
+      entry->hash = hash;
+      entry->cells = g_memdup (row, priv->width * sizeof (ConsoleChar));
+      entry->width = priv->width;
+      entry->dpi = dpi;
+      entry->phase = phase;
+      entry->surface = band.surface;
+      entry->link.data = entry;
+
+      /* rows are budgeted by memory, the surface takes the most of it */
+      entry->size = sizeof (ConsoleRowCacheEntry) + priv->width * sizeof (ConsoleChar) +
+                    cairo_image_surface_get_stride (band.surface) *
+                    cairo_image_surface_get_height (band.surface);
+
+      g_hash_table_insert (priv->row_cache, &entry->hash, entry);
+      g_queue_push_head_link (&priv->row_lru, &entry->link);
+      priv->row_cache_bytes += entry->size;
+    }
 
-    case PROP_FONT_STYLE:
-      console_set_font_style (CONSOLE (object), g_value_get_string (value));
-      break;
+  cairo_set_source_surface (cr, entry->surface, 0, y * priv->char_height);
+  cairo_paint (cr);
 
-    case PROP_FONT_FAMILY:
-      console_set_font_family (CONSOLE (object), g_value_get_string (value));
-      break;
+  /* the row is trimmed only after painting it, if it alone exceeds the budget */
+  row_cache_trim (priv, (gsize) priv->row_cache_size * 1024);
 
-    case PROP_CURSOR_SHAPE:
-      console_set_cursor_shape (CONSOLE (object), g_value_get_enum (value));
-      break;
+  return TRUE;
+}
 
-    case PROP_CURSOR_TIMER:
-      console_set_cursor_timer (CONSOLE (object), g_value_get_enum (value));
-      break;
+/* This helper returns the text selection area in pixels.
+ */
+static void
+get_selection_rectangle (ConsolePrivate *priv, GdkRectangle *selection)
+{
+  ConsoleTextSelection *cs = &priv->text_selection;
 
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-      break;
-    }
+  selection->x = MIN(cs->x1, cs->x2);
+  selection->y = MIN(cs->y1, cs->y2);
+  selection->width = ABS(cs->x2 - cs->x1);
+  selection->height = ABS(cs->y2 - cs->y1);
 }
 
+/* This helper returns the area of the character at [x,y] in pixels.
+ */
 static void
-console_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+get_cell_rectangle (ConsolePrivate *priv, gint x, gint y, GdkRectangle *rect)
 {
-  switch (prop_id)
+  rect->x = x * priv->char_width;
+  rect->y = y * priv->char_height;
+  rect->width = priv->char_width;
+  rect->height = priv->char_height;
+}
+
+/* This helper renders the character under the cursor with the cursor drawn
+ * over it into the cursor pixmap, unless the pixmap is up to date already.
+ * The backing pixmap never keeps the cursor, the cursor pixmap is copied
+ * over it on expose, so blinking the cursor doesn't render anything.
+ */
+static void
+cursor_update (Console *console)
+{
+  ConsolePrivate *priv;
+  GdkRectangle selection;
+  ConsoleBandJob job;
+  ConsoleBand band;
+  cairo_t *cr;
+  gint width, height;
+  gdouble dpi;
+
+  priv = console->priv;
+
+  if (priv->cursor_pixmap != NULL)
     {
-    case PROP_WIDTH:
-      g_value_set_int (value, console_get_width (CONSOLE (object)));
-      break;
+      gdk_drawable_get_size (priv->cursor_pixmap, &width, &height);
 
-    case PROP_HEIGHT:
-      g_value_set_int (value, console_get_height (CONSOLE (object)));
-      break;
+      if (width != priv->char_width || height != priv->char_height)
+        {
+          g_object_unref (priv->cursor_pixmap);
+          priv->cursor_pixmap = NULL;
+        }
+    }
 
-    case PROP_FONT_SIZE:
-      g_value_set_int (value, console_get_font_size (CONSOLE (object)));
-      break;
+  if (priv->cursor_pixmap == NULL)
+    {
+      priv->cursor_pixmap = gdk_pixmap_new (GTK_WIDGET (console)->window,
+                                            priv->char_width, priv->char_height, -1);
+      priv->cursor_valid = FALSE;
+    }
 
-    case PROP_FONT_STYLE:
-      g_value_set_string (value, console_get_font_style (CONSOLE (object)));
-      break;
+  if (priv->cursor_valid &&
+      priv->cursor_pixmap_x == priv->cursor_x &&
+      priv->cursor_pixmap_y == priv->cursor_y)
+    return;
 
-    case PROP_FONT_FAMILY:
-      g_value_set_string (value, console_get_font_family (CONSOLE (object)));
-      break;
+  dpi = gdk_screen_get_resolution (gtk_widget_get_screen (GTK_WIDGET (console)));
 
-    case PROP_CURSOR_SHAPE:
-      g_value_set_int (value, console_get_cursor_shape (CONSOLE (object)));
-      break;
+  get_selection_rectangle (priv, &selection);
 
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-      break;
-    }
-}
+  box_job_init (&job, priv, &selection, priv->cursor_x, priv->cursor_y,
+                priv->cursor_x + 1, priv->cursor_y + 1, dpi);
+  job.cursor = TRUE;
 
-static gboolean
-console_expose (GtkWidget *widget, GdkEventExpose *event)
-{
-  g_return_val_if_fail (widget != NULL, FALSE);
-  g_return_val_if_fail (IS_CONSOLE(widget), FALSE);
-  g_return_val_if_fail (event != NULL, FALSE);
+  band_init (&band, &job, priv->cursor_y, priv->cursor_y + 1);
+  render_band (&band);
+  box_job_clear (&job);
 
-/*  g_debug ("console_expose: event->area.x %d event->area.y %d width %d height %d",
-           event->area.x, event->area.y, event->area.width, event->area.height);*/
+  cairo_surface_mark_dirty (band.surface);
+
+  cr = gdk_cairo_create (GDK_DRAWABLE (priv->cursor_pixmap));
+  cairo_set_source_surface (cr, band.surface, 0, 0);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
 
-  console_draw (widget, event);
+  cairo_surface_destroy (band.surface);
 
-  return FALSE;
+  priv->cursor_pixmap_x = priv->cursor_x;
+  priv->cursor_pixmap_y = priv->cursor_y;
+  priv->cursor_valid = TRUE;
 }
 
-/* This helper determines cursor rectangle position and size
- * according to cursor appearence and returns it in the
- * GdkRectangle structure provided by the caller.
+/* This helper copies the cursor pixmap to the window if the cursor is
+ * displayed within the exposed region. The caller is expected to clip
+ * the backing pixmap graphics context to the region.
  */
 static void
-get_cursor_rectangle (ConsolePrivate *priv, double xc, double yc, GdkRectangle *rect)
+expose_cursor (Console *console, GdkRegion *region)
 {
+  ConsolePrivate *priv;
+  GdkRectangle rect;
 
-  rect->width = priv->char_width;
-  rect->x = xc;
-
-  switch (priv->cursor_shape)
-    {
-    case CONSOLE_CURSOR_FULL_BLOCK:
-    case CONSOLE_CURSOR_DEFAULT:
-      rect->height = priv->char_height;
-      rect->y = yc;
-      break;
-
-    case CONSOLE_CURSOR_UNDERSCORE:
-      rect->height = 3.0;
-      rect->y = yc + priv->baseline - 1.0;
-      break;
-
-    case CONSOLE_CURSOR_LOWER_THIRD:
-      rect->height = priv->char_height / 3.0;
-      rect->y = yc + priv->char_height * (2.0 / 3.0);
-      break;
+  priv = console->priv;
 
-    case CONSOLE_CURSOR_LOWER_HALF:
-      rect->height = priv->char_height * 0.5;
-      rect->y = yc + priv->char_height * 0.5;
-      break;
+  if (!cursor_is_visible (priv) || priv->scr == NULL)
+    return;
 
-    case CONSOLE_CURSOR_TWO_THIRDS:
-      rect->height = priv->char_height * (2.0 / 3.0);
-      rect->y = yc + priv->char_height / 3.0;
-      break;
+  get_cell_rectangle (priv, priv->cursor_x, priv->cursor_y, &rect);
 
-    case CONSOLE_CURSOR_VERT_THIRD:
-      rect->height = priv->char_height;
-      rect->width = priv->char_width / 3.0;
-      rect->y = yc;
-      break;
+  if (gdk_region_rect_in (region, &rect) == GDK_OVERLAP_RECTANGLE_OUT)
+    return;
 
-    case CONSOLE_CURSOR_VERT_HALF:
-      rect->height = priv->char_height;
-      rect->width = priv->char_width * 0.5;
-      rect->y = yc;
-      break;
+  cursor_update (console);
 
-    case CONSOLE_CURSOR_INVISIBLE:
-      rect->x = 0;
-      rect->y = 0;
-      rect->width = 0;
-      rect->height = 0;
-      break;
-    }
+  gdk_draw_drawable (GTK_WIDGET (console)->window, priv->backing_gc, priv->cursor_pixmap,
+                     0, 0, rect.x, rect.y, rect.width, rect.height);
 }
 
-/* This helper returns TRUE if the cursor must be drawn at character position [x,y].
+/* This helper requests the cursor to be displayed or hidden. Only the
+ * window is updated, the screen contents under the cursor is copied from
+ * the backing pixmap.
  */
-static gboolean
-cursor_is_visible_at (const ConsolePrivate *priv, gint x, gint y)
+static void
+invalidate_cursor (Console *console)
 {
-  if ((x == priv->cursor_x && y == priv->cursor_y) &&
-      (priv->cursor_shape != CONSOLE_CURSOR_INVISIBLE) &&
-      priv->cursor_toggle)
-    return TRUE;
-  else
-    return FALSE;
+  ConsolePrivate *priv;
+  GdkRectangle rect;
+
+  priv = console->priv;
+
+  if (!GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
+    return;
+
+  get_cell_rectangle (priv, priv->cursor_x, priv->cursor_y, &rect);
+  gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, FALSE);
 }
 
+/* This helper converts a rectangle in pixels to the range of characters
+ * it touches. It returns FALSE if the range is empty.
+ */
 static gboolean
-console_gdk_rectangle_intersect (GdkRectangle *src1, GdkRectangle *src2)
+get_cell_range (ConsolePrivate *priv, GdkRectangle *rect, gint *x1, gint *y1, gint *x2, gint *y2)
 {
-  gint dest_x, dest_y;
-  gint dest_x2, dest_y2;
-
-  dest_x = MAX (src1->x, src2->x);
-  dest_y = MAX (src1->y, src2->y);
-  dest_x2 = MIN (src1->x + src1->width, src2->x + src2->width);
-  dest_y2 = MIN (src1->y + src1->height, src2->y + src2->height);
+  *x1 = MAX (rect->x, 0) / priv->char_width;
+  *y1 = MAX (rect->y, 0) / priv->char_height;
+  *x2 = MIN ((rect->x + rect->width + priv->char_width - 1) / priv->char_width, priv->width);
+  *y2 = MIN ((rect->y + rect->height + priv->char_height - 1) / priv->char_height, priv->height);
 
-  if (dest_x2 >= dest_x && dest_y2 >= dest_y)
-    {
-      return TRUE;
-    }
-  
-  return FALSE;
+  return (*x1 < *x2 && *y1 < *y2);
 }
 
+/* This function renders characters of the screen region into the backing
+ * pixmap. Only the cells covered by rectangles of the region are visited.
+ */
 static void
-console_draw (GtkWidget *widget, GdkEventExpose *event)
+console_draw (Console *console, GdkRegion *region)
 {
   ConsolePrivate *priv;
-  ConsoleChar *scr;
+  GdkRectangle selection;
+  GdkRectangle *rects;
+  GdkRectangle box;
   cairo_t *cr;
-  gint x, y, baseline, width, height;
-  gint char_width, char_height, max_stride;
-  guchar *glyph_buffer;
+  gint i, n_rects;
+  gint x1, y1, x2, y2;
   gdouble dpi;
 
-  g_return_if_fail (widget != NULL);
-  g_return_if_fail (IS_CONSOLE (widget));
-
-  priv = CONSOLE (widget)->priv;
-
-  /* Obtain cairo context for the widget window and clip it to redraw area. */
-  cr = gdk_cairo_create (GDK_DRAWABLE (widget->window));
-  gdk_cairo_region (cr, event->region);
-  cairo_clip (cr);
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
 
-  /* shortcuts to console properties */
-  width = priv->width;
-  height = priv->height;
-  char_width = priv->char_width;
-  char_height = priv->char_height;
-  baseline = priv->baseline;
-  scr = priv->scr;
+  priv = console->priv;
 
-  /* get screen resolution to scale font points to pixels later */
-  dpi = gdk_screen_get_resolution (gtk_widget_get_screen (widget));
+  g_return_if_fail (priv->backing != NULL);
 
-  /* Create temporary buffer used to keep around a glyph bitmap.
-   * Note that cairo library uses some hardware optimizations and
-   * requires proper alignment of rows of pixels.
-   */
-  max_stride = cairo_format_stride_for_width (CAIRO_FORMAT_A8, char_width);
-  glyph_buffer = g_alloca (max_stride * char_height);
+  if (priv->scr == NULL)
+    return;
 
-  if (scr != NULL)
-    {
-      ConsoleTextSelection *cs = &priv->text_selection;
-      GdkRectangle selection;
+  /* Obtain cairo context for the backing pixmap. */
+  cr = gdk_cairo_create (GDK_DRAWABLE (priv->backing));
 
-      selection.x = MIN(cs->x1, cs->x2);
-      selection.y = MIN(cs->y1, cs->y2);
-      selection.width = ABS(cs->x2 - cs->x1);
-      selection.height = ABS(cs->y2 - cs->y1);
+  /* get screen resolution to scale font points to pixels later */
+  dpi = gdk_screen_get_resolution (gtk_widget_get_screen (GTK_WIDGET (console)));
 
-      for (y = 0; y < height; y++)
-        {
-          for (x = 0; x < width; x++)
-            {
-              GdkRectangle rect;
-              ConsoleChar *chr;
-              ConsoleColor *bg_color, *color;
-              double xc, yc;
+  get_selection_rectangle (priv, &selection);
 
-              /* calculate upper left coordinates of the character rectangle */
-              xc = x * char_width;
-              yc = y * char_height;
+  /* The cursor image is rendered from the screen contents under it.
+   */
+  get_cell_rectangle (priv, priv->cursor_x, priv->cursor_y, &box);
 
-              rect.x = xc;
-              rect.y = yc;
-              rect.height = char_height;
-              rect.width = char_width;
+  if (gdk_region_rect_in (region, &box) != GDK_OVERLAP_RECTANGLE_OUT)
+    priv->cursor_valid = FALSE;
 
-              /* skip this character if we are out of redraw requested region */
-              if (gdk_region_rect_in (event->region, &rect) == GDK_OVERLAP_RECTANGLE_OUT)
-                 continue;
+  /* Large updates are rendered as a whole in bands by the render threads
+   * if there are any. Make a couple of bands per thread to even out the load.
+   */
+  gdk_region_get_clipbox (region, &box);
 
-              /* shortcut to character */
-              chr = scr + y*width + x;
+  if (priv->render_pool != NULL &&
+      get_cell_range (priv, &box, &x1, &y1, &x2, &y2) &&
+      (x2 - x1) * (y2 - y1) >= BAND_RENDER_MIN_CELLS)
+    {
+      gdk_cairo_region (cr, region);
+      cairo_clip (cr);
 
-              color = &chr->color;
-              bg_color = &chr->bg_color;
+      draw_box (priv, cr, &selection, x1, y1, x2, y2, priv->render_threads * 2, dpi);
 
-              /* swap colors if character inside ConsoleTextSelection area */
-              if (console_gdk_rectangle_intersect(&rect, &selection))
-                {
-                  ConsoleColor *tmp;
+      cairo_destroy (cr);
+      return;
+    }
 
-                  g_debug ("intersect");
+  gdk_region_get_rectangles (region, &rects, &n_rects);
 
-                  tmp = color;
-                  color = bg_color;
-                  bg_color = tmp;
-                }
+  for (i = 0; i < n_rects; i++)
+    {
+      GdkRectangle *rect = rects + i;
 
-              /* draw background rectangle at a character position */
-              cairo_save (cr);
-              cairo_move_to (cr, xc, yc);
-              cairo_set_source_rgb (cr, bg_color->red, bg_color->green, bg_color->blue);
-              cairo_rectangle (cr, xc, yc, char_width, char_height);
-              cairo_fill (cr);
-              cairo_restore (cr);
+      if (!get_cell_range (priv, rect, &x1, &y1, &x2, &y2))
+        continue;
 
-              /* draw character glyph and cursor at a character position */
-              if (chr->chr == ' ' && cursor_is_visible_at (priv, x, y))
-                {
-                  GdkRectangle rect;
+      /* Characters partially covered by the rectangle are clipped, so the
+       * pixels shared by neighbouring rectangles are drawn only once.
+       */
+      cairo_save (cr);
+      gdk_cairo_rectangle (cr, rect);
+      cairo_clip (cr);
 
-                  get_cursor_rectangle (priv, xc, yc, &rect);
+      /* Full width rows are taken from the row cache when possible.
+       */
+      if (x1 == 0 && x2 == priv->width && priv->row_cache_size > 0)
+        {
+          gint y;
 
-                  /* Here we simply draw the cursor at the character position.
-                   */
-                  cairo_save (cr);
-                  cairo_set_source_rgb (cr, color->red, color->green, color->blue);
-                  cairo_rectangle (cr, rect.x, rect.y, rect.width, rect.height);
-                  cairo_fill (cr);
-                  cairo_restore (cr);
-                }
-              else if (chr->chr != ' ')
-                {
-                  FTC_SBit sbitmap;
-                  FTC_ScalerRec scaler;
-                  FTC_Node node;
-                  cairo_surface_t *image;
-                  gint i, error, glyph_index, stride;
-                  guchar *dst, *src;
-
-                  glyph_index = FTC_CMapCache_Lookup (priv->cmapcache, priv, 0, chr->chr);
-                  if (glyph_index <= 0)
-                    {
-                      FT_Face face;
-
-                      FTC_Manager_LookupFace (priv->manager, priv, &face);
-                      glyph_index = FT_Get_Char_Index (face, chr->chr);
-                      if (glyph_index <= 0)
-                        {
-                          g_warning ("no unicode char 0x%0x in character map", chr->chr);
-                          continue;
-                        }
-                    }
-
-                  scaler.face_id = priv;
-                  scaler.pixel = FALSE;
-                  scaler.height = priv->font_size << 6;
-                  scaler.width = 0;
-                  scaler.x_res = dpi;
-                  scaler.y_res = dpi;
-
-                  error = FTC_SBitCache_LookupScaler (priv->sbitcache, &scaler,
-                                                      FT_LOAD_RENDER | FT_LOAD_DEFAULT,
-                                                      glyph_index, &sbitmap, &node);
-                  if (error)
-                    {
-                      g_warning ("failed looking up sbitmap for glyph index %d", glyph_index);
-                      continue;
-                    }
-
-                  stride = cairo_format_stride_for_width (CAIRO_FORMAT_A8, sbitmap->width);
-
-                  memset (glyph_buffer, 0, stride * sbitmap->height);
-                  dst = glyph_buffer;
-                  src = sbitmap->buffer;
-
-                  for (i = 0; i < sbitmap->height; i++)
-                    {
-                      memcpy (dst, src, sbitmap->width);
-                      src += sbitmap->pitch;
-                      dst += stride;
-                    }
-
-                  image = cairo_image_surface_create_for_data (glyph_buffer, CAIRO_FORMAT_A8, sbitmap->width, sbitmap->height, stride);
-
-                  cairo_set_source_rgb (cr, color->red, color->green, color->blue);
-
-                  cairo_mask_surface (cr, image, xc + sbitmap->left, yc + baseline - sbitmap->top);
-
-                  if (cursor_is_visible_at (priv, x, y))
-                    {
-                      GdkRectangle rect;
-
-                      /* We draw the cursor using foreground color,
-                       * then we place the glyph bitmap, clipped by cursor
-                       * rectangle, above. The glyph is drawn in background
-                       * color.
-                       */
-                      get_cursor_rectangle (priv, xc, yc, &rect);
-
-                      cairo_save (cr);
-                      cairo_set_source_rgb (cr, color->red, color->green, color->blue);
-                      cairo_rectangle (cr, rect.x, rect.y, rect.width, rect.height);
-                      cairo_fill_preserve (cr);
-                      cairo_clip (cr);
-                      cairo_set_source_rgb (cr, bg_color->red, bg_color->green, bg_color->blue);
-                      cairo_mask_surface (cr, image, xc + sbitmap->left, yc + baseline - sbitmap->top);
-                      cairo_restore (cr);
-                    }
-
-                  cairo_surface_destroy (image);
-
-                  FTC_Node_Unref (node, priv->manager);
-                }
+          for (y = y1; y < y2; y++)
+            {
+              if (!draw_row_cached (priv, cr, &selection, y, dpi))
+                draw_box (priv, cr, &selection, x1, y, x2, y + 1, 1, dpi);
             }
         }
+      else
+        draw_box (priv, cr, &selection, x1, y1, x2, y2, 1, dpi);
+
+      cairo_restore (cr);
     }
 
+  g_free (rects);
+
   cairo_destroy (cr);
 }
 
@@ -1784,7 +4246,72 @@ console_finalize (GObject *object)
   if (priv->scr != NULL)
     g_free (priv->scr);
 
+  g_free (priv->rows);
+
   priv->scr = NULL;
+  priv->rows = NULL;
+
+  scrollback_free (priv->scrollback);
+  g_free (priv->view);
+
+  priv->scrollback = NULL;
+  priv->view = NULL;
+
+  if (priv->dirty != NULL)
+    g_free (priv->dirty);
+
+  priv->dirty = NULL;
+
+  /* remove pending damage flush and deferred frame */
+  if (priv->damage_flush_id > 0)
+    {
+      g_source_remove (priv->damage_flush_id);
+      priv->damage_flush_id = 0;
+    }
+
+  if (priv->frame_timer_id > 0)
+    {
+      g_source_remove (priv->frame_timer_id);
+      priv->frame_timer_id = 0;
+    }
+
+  if (priv->backing != NULL)
+    g_object_unref (priv->backing);
+
+  if (priv->backing_gc != NULL)
+    g_object_unref (priv->backing_gc);
+
+  if (priv->cursor_pixmap != NULL)
+    g_object_unref (priv->cursor_pixmap);
+
+  priv->backing = NULL;
+  priv->backing_gc = NULL;
+  priv->cursor_pixmap = NULL;
+
+  /* stop render threads */
+  priv->render_threads = 0;
+  render_pool_update (priv);
+
+  if (priv->render_done != NULL)
+    g_async_queue_unref (priv->render_done);
+
+  priv->render_done = NULL;
+
+  row_cache_clear (priv);
+  g_hash_table_destroy (priv->row_cache);
+
+  /* Pending font jobs keep the console alive, so the loader is idle here.
+   */
+  if (priv->font_job_id != 0)
+    g_source_remove (priv->font_job_id);
+
+  if (priv->font_pool != NULL)
+    g_thread_pool_free (priv->font_pool, TRUE, TRUE);
+
+  priv->font_job_id = 0;
+  priv->font_pool = NULL;
+
+  font_cache_trim (priv, 0);
 
   if (priv->font_family != NULL)
     g_free (priv->font_family);
@@ -1819,19 +4346,98 @@ console_finalize (GObject *object)
     (*parent_class->finalize) (object);
 }
 
+/* This helper rotates pointers to the rows y..y+box_height-1 of the screen
+ * by n rows down, so contents of the rows move without copying them.
+ */
+static void
+rotate_rows (ConsolePrivate *priv, gint y, gint box_height, gint n)
+{
+  ConsoleChar **rows;
+  gint i;
+
+  if (y == 0 && box_height == priv->height)
+    {
+      /* the whole screen scrolls by moving its top row */
+      priv->rows_head = (priv->rows_head - n + box_height) % box_height;
+      return;
+    }
+
+  rows = g_newa (ConsoleChar*, box_height);
+
+  for (i = 0; i < box_height; i++)
+    rows[(i + n + box_height) % box_height] = SCREEN_ROW (priv, y + i);
+
+  for (i = 0; i < box_height; i++)
+    SCREEN_ROW (priv, y + i) = rows[i];
+}
+
+/* This helper appends the screen row to the history. Trailing blanks of
+ * default colors are left out, the row is padded with them when viewed.
+ */
+static void
+scrollback_push_row (ConsolePrivate *priv, const ConsoleChar *row)
+{
+  gint n;
+
+  for (n = priv->width; n > 0; n--)
+    {
+      const ConsoleChar *chr = row + n - 1;
+
+      if (chr->chr != ' ' || chr->attr != CONSOLE_CHAR_ATTR_DEFAULT ||
+          chr->color != CHAR_COLOR (PALETTE_FG_DEFAULT, PALETTE_BG_DEFAULT))
+        break;
+    }
+
+  scrollback_push (priv->scrollback, (const ScrollbackCell *) row, n);
+}
+
+/* This helper fills the view with history lines for the view offset.
+ */
+static void
+view_update (ConsolePrivate *priv)
+{
+  gint y, n;
+
+  if (priv->view == NULL)
+    priv->view = g_new (ConsoleChar, priv->width * priv->height);
+
+  for (y = 0; y < MIN (priv->view_offset, priv->height); y++)
+    {
+      ConsoleChar *row = priv->view + y*priv->width;
+
+      n = scrollback_get_line (priv->scrollback, priv->view_offset - 1 - y,
+                               (ScrollbackCell *) row, priv->width);
+
+      blank_chars (row + n, priv->width - n, CHAR_COLOR (PALETTE_FG_DEFAULT, PALETTE_BG_DEFAULT),
+                   CONSOLE_CHAR_ATTR_DEFAULT);
+    }
+}
+
+/* This helper scrolls the view back to the screen, it is called before
+ * the screen changes.
+ */
+static void
+view_reset (Console *console)
+{
+  if (console->priv->view_offset == 0)
+    return;
+
+  console->priv->view_offset = 0;
+  damage_all (console);
+  invalidate_cursor (console);
+}
+
 static void
 scroll_box_down (Console *console, gint x, gint y, gint box_width, gint box_height, gint nlines)
 {
   ConsolePrivate *priv;
-  ConsoleChar *scr;
   gint width, height;
 
   priv = console->priv;
-  scr = priv->scr;
   width = priv->width;
   height = priv->height;
 
-  if (scr != NULL)
+  if (priv->scr != NULL)
     {
       gint cnt;
 
@@ -1845,34 +4451,24 @@ scroll_box_down (Console *console, gint x, gint y, gint box_width, gint box_heig
       /* get number of lines to move */
       cnt = box_height - nlines;
 
-      /* move lines to new positions */
-      if (cnt > 0)
+      /* Rows of the full width are moved by their pointers, lines left
+       * behind then come from the bottom of the box.
+       */
+      if (cnt > 0 && x == 0 && box_width == width)
+        rotate_rows (priv, y, box_height, nlines);
+      else if (cnt > 0)
         {
-          ConsoleChar *p1 = scr + ((y + box_height - 1)*width + x);
-          ConsoleChar *p2 = scr + ((y + cnt - 1)*width + x);
-
           while (cnt > 0)
             {
-              ConsoleChar *dst = p1;
-              ConsoleChar *src = p2;
-              gint n;
-
-              for (n = 0; n < box_width; n++)
-                {
-                  *dst++ = *src;
-                  src->attr = priv->attr;
-                  src->chr = ' ';
-                  src->color = priv->color;
-                  src->bg_color = priv->bg_color;
-                  ++src;
-                }
-
-              p1 -= width;
-              p2 -= width;
-
+              memmove (SCREEN_ROW (priv, y + cnt + nlines - 1) + x, SCREEN_ROW (priv, y + cnt - 1) + x,
+                       box_width * sizeof (ConsoleChar));
               --cnt;
             }
         }
+
+      /* blank lines left behind */
+      for (cnt = 0; cnt < MIN (nlines, box_height); cnt++)
+        blank_chars (SCREEN_ROW (priv, y + cnt) + x, box_width, priv->color, priv->attr);
     }
 }
 
@@ -1880,7 +4476,6 @@ static void
 scroll_box_up (Console *console, gint x, gint y, gint box_width, gint box_height, gint nlines)
 {
   ConsolePrivate *priv;
-  ConsoleChar *scr;
   gint width, height;
 
   g_assert (console != NULL);
@@ -1888,11 +4483,10 @@ scroll_box_up (Console *console, gint x, gint y, gint box_width, gint box_height
   g_assert (box_width >= 0 && box_height >= 0);
 
   priv = console->priv;
-  scr = priv->scr;
   width = priv->width;
   height = priv->height;
 
-  if (scr != NULL)
+  if (priv->scr != NULL)
     {
       gint cnt;
 
@@ -1903,82 +4497,448 @@ scroll_box_up (Console *console, gint x, gint y, gint box_width, gint box_height
       if ((y + box_height) > height)
         box_height -= (y + box_height) - height;
 
+      /* Lines scrolled off the top of the screen go to the history.
+       */
+      if (y == 0 && x == 0 && box_width == width)
+        {
+          for (cnt = 0; cnt < MIN (nlines, box_height); cnt++)
+            scrollback_push_row (priv, SCREEN_ROW (priv, cnt));
+        }
+
       /* get number of lines to move */
       cnt = box_height - nlines;
 
-      /* move lines to new positions */
-      if (cnt > 0)
+      /* Rows of the full width are moved by their pointers, lines left
+       * behind then come from the top of the box.
+       */
+      if (cnt > 0 && x == 0 && box_width == width)
+        rotate_rows (priv, y, box_height, -nlines);
+      else if (cnt > 0)
         {
-          ConsoleChar *p1 = scr + (y*width + x);
-          ConsoleChar *p2 = scr + ((y + nlines)*width + x);
+          gint i;
 
-          while (cnt > 0)
+          for (i = 0; i < cnt; i++)
             {
-              ConsoleChar *dst = p1;
-              ConsoleChar *src = p2;
-              gint n;
+              memmove (SCREEN_ROW (priv, y + i) + x, SCREEN_ROW (priv, y + i + nlines) + x,
+                       box_width * sizeof (ConsoleChar));
+            }
+        }
 
-              for (n = 0; n < box_width; n++)
-                {
-                  *dst++ = *src;
-                  src->attr = priv->attr;
-                  src->chr = ' ';
-                  src->color = priv->color;
-                  src->bg_color = priv->bg_color;
-                  ++src;
-                }
+      /* blank lines left behind */
+      for (cnt = MAX (box_height - nlines, 0); cnt < box_height; cnt++)
+        blank_chars (SCREEN_ROW (priv, y + cnt) + x, box_width, priv->color, priv->attr);
+    }
+}
+
+/* This helper marks all rows clean.
+ */
+static void
+damage_reset (Console *console)
+{
+  ConsolePrivate *priv;
+  gint y;
+
+  priv = console->priv;
+
+  if (priv->dirty != NULL)
+    {
+      for (y = MAX (priv->dirty_y1, 0); y <= priv->dirty_y2; y++)
+        priv->dirty[y].x1 = -1;
+    }
+
+  priv->dirty_y1 = G_MAXINT;
+  priv->dirty_y2 = -1;
+}
+
+/* This helper renders the accumulated damage into the backing pixmap,
+ * invalidates it in the console widget window as a single region and marks
+ * all rows clean. Rows having the same dirty span are merged into one
+ * rectangle.
+ */
+static void
+flush_damage (Console *console)
+{
+  ConsolePrivate *priv;
+  GdkRegion *region;
+  GdkRectangle rect;
+  gint y, y1;
+
+  priv = console->priv;
+
+  /* The cursor moved, it is removed from its old position and displayed
+   * at the new one.
+   */
+  if (priv->cursor_moved && GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
+    {
+      get_cell_rectangle (priv, priv->cursor_old_x, priv->cursor_old_y, &rect);
+      gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, FALSE);
+      invalidate_cursor (console);
+    }
+
+  priv->cursor_moved = FALSE;
+
+  if (priv->dirty_y1 > priv->dirty_y2)
+    return;
+
+  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
+    {
+      region = gdk_region_new ();
+
+      y = priv->dirty_y1;
+
+      while (y <= priv->dirty_y2)
+        {
+          ConsoleDirtySpan *span = priv->dirty + y;
+
+          if (span->x1 < 0)
+            {
+              y++;
+              continue;
+            }
+
+          y1 = y;
+
+          while (y < priv->dirty_y2 &&
+                 priv->dirty[y+1].x1 == span->x1 &&
+                 priv->dirty[y+1].x2 == span->x2)
+            y++;
+
+          rect.x = span->x1 * priv->char_width;
+          rect.y = y1 * priv->char_height;
+          rect.width = (span->x2 - span->x1 + 1) * priv->char_width;
+          rect.height = (y - y1 + 1) * priv->char_height;
+
+          gdk_region_union_with_rect (region, &rect);
+
+          priv->stats.cells_rendered += (span->x2 - span->x1 + 1) * (y - y1 + 1);
+
+          y++;
+        }
+
+      /* A stale backing pixmap is rendered as a whole on the next expose.
+       */
+      if (priv->backing != NULL && priv->backing_valid)
+        console_draw (console, region);
+
+      gdk_window_invalidate_region (GTK_WIDGET (console)->window, region, FALSE);
+      gdk_region_destroy (region);
+    }
+
+  damage_reset (console);
+}
+
+/* This helper flushes the damage as a new frame.
+ */
+static void
+paint_frame (Console *console)
+{
+  ConsolePrivate *priv = console->priv;
+
+  /* the damage is kept until the console is thawed */
+  if (priv->freeze_count > 0)
+    return;
+
+  flush_damage (console);
+
+  priv->last_frame_time = g_get_monotonic_time ();
+  priv->stats.frames_painted++;
+}
+
+/* This timer callback paints the frame deferred by the frame scheduler.
+ */
+static gboolean
+console_frame_timer (gpointer user_data)
+{
+  Console *console;
+
+  g_return_val_if_fail (user_data != NULL, FALSE);
+  g_return_val_if_fail (IS_CONSOLE (user_data), FALSE);
+
+  console = CONSOLE (user_data);
+  console->priv->frame_timer_id = 0;
+
+  paint_frame (console);
+
+  return FALSE;
+}
+
+/* This is an idle callback run once per main loop iteration which recorded
+ * some damage. The first change after the console was idle for a frame
+ * interval is painted at once to keep the echo latency low. Changes coming
+ * faster than the maximum frame rate are merged and painted by a timer
+ * when the frame interval elapses.
+ */
+static gboolean
+console_damage_flush_idle (gpointer user_data)
+{
+  ConsolePrivate *priv;
+  Console *console;
+  gint64 now, elapsed, interval;
+
+  g_return_val_if_fail (user_data != NULL, FALSE);
+  g_return_val_if_fail (IS_CONSOLE (user_data), FALSE);
+
+  console = CONSOLE (user_data);
+  priv = console->priv;
+  priv->damage_flush_id = 0;
+
+  if (priv->max_fps > 0)
+    {
+      interval = G_USEC_PER_SEC / priv->max_fps;
+      now = g_get_monotonic_time ();
+      elapsed = now - priv->last_frame_time;
+
+      if (elapsed < interval)
+        {
+          /* This frame is merged with the next one. */
+          priv->stats.frames_skipped++;
+
+          if (priv->frame_timer_id == 0)
+            {
+              priv->frame_timer_id =
+                g_timeout_add ((interval - elapsed + 999) / 1000, console_frame_timer, console);
+            }
+
+          return FALSE;
+        }
+    }
+
+  /* A frame deferred before the frame rate limit was changed is painted now. */
+  if (priv->frame_timer_id > 0)
+    {
+      g_source_remove (priv->frame_timer_id);
+      priv->frame_timer_id = 0;
+    }
+
+  paint_frame (console);
+
+  return FALSE;
+}
+
+/* This helper schedules a frame before GDK processes window updates in
+ * the same main loop iteration.
+ */
+static void
+damage_schedule (Console *console)
+{
+  ConsolePrivate *priv;
+
+  priv = console->priv;
+
+  if (priv->damage_flush_id == 0)
+    {
+      priv->damage_flush_id =
+        g_idle_add_full (G_PRIORITY_HIGH_IDLE + 10, console_damage_flush_idle, console, NULL);
+    }
+}
+
+/* This helper records a box of characters as needing redraw. Nothing is
+ * invalidated until the damage is flushed, so subsequent updates of the
+ * same row are coalesced into one span.
+ */
+static void
+damage_box (Console *console, gint x, gint y, gint box_width, gint box_height)
+{
+  ConsolePrivate *priv;
+  gint x2, y2, i;
+
+  priv = console->priv;
+
+  if (priv->dirty == NULL)
+    return;
+
+  /* clip the box to the screen */
+  x2 = MIN (x + box_width, priv->width) - 1;
+  y2 = MIN (y + box_height, priv->height) - 1;
+  x = MAX (x, 0);
+  y = MAX (y, 0);
+
+  if (x > x2 || y > y2)
+    return;
+
+  for (i = y; i <= y2; i++)
+    {
+      ConsoleDirtySpan *span = priv->dirty + i;
+
+      if (span->x1 < 0)
+        {
+          span->x1 = x;
+          span->x2 = x2;
+        }
+      else
+        {
+          span->x1 = MIN (span->x1, x);
+          span->x2 = MAX (span->x2, x2);
+        }
+    }
+
+  priv->dirty_y1 = MIN (priv->dirty_y1, y);
+  priv->dirty_y2 = MAX (priv->dirty_y2, y2);
+
+  damage_schedule (console);
+}
+
+/* This helper records the cursor as leaving its position, it is called
+ * before the cursor moves. Instead of redrawing the cells, the cursor is
+ * displayed at its new position when the damage is flushed, so moving the
+ * cursor or running it over many unchanged cells updates the window at its
+ * ends only.
+ */
+static void
+damage_cursor_move (Console *console)
+{
+  ConsolePrivate *priv;
+
+  priv = console->priv;
+
+  if (priv->dirty == NULL)
+    return;
+
+  if (!priv->cursor_moved)
+    {
+      priv->cursor_moved = TRUE;
+      priv->cursor_old_x = priv->cursor_x;
+      priv->cursor_old_y = priv->cursor_y;
+    }
+
+  damage_schedule (console);
+}
+
+/* This helper records a character at coordinates x and y as needing redraw.
+ */
+static void
+damage_char (Console *console, gint x, gint y)
+{
+  damage_box (console, x, y, 1, 1);
+}
 
-              p1 += width;
-              p2 += width;
+/* This helper records a character at the current cursor position as needing redraw.
+ */
+static void
+damage_cursor (Console *console)
+{
+  damage_box (console, console->priv->cursor_x, console->priv->cursor_y, 1, 1);
+}
 
-              --cnt;
-            }
-        }
-    }
+/* This helper records the whole screen as needing redraw.
+ */
+static void
+damage_all (Console *console)
+{
+  damage_box (console, 0, 0, console->priv->width, console->priv->height);
 }
 
-/* This helper invalidates console widget window area at the current cursor position.
+/* This helper updates the window after a box of characters was scrolled by
+ * dy lines (negative dy means up). Instead of redrawing the whole box, pixels
+ * already rendered are moved within the window and only the lines uncovered
+ * by the scroll are damaged.
  */
 static void
-invalidate_cursor_rect (Console *console)
+damage_scroll (Console *console, gint x, gint y, gint box_width, gint box_height, gint dy)
 {
   ConsolePrivate *priv;
+  GdkRegion *region;
   GdkRectangle rect;
+  gint i, n;
 
-  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
+  priv = console->priv;
+
+  /* correct scroll box size the same way the screen buffer does */
+  if ((x + box_width) > priv->width)
+    box_width -= (x + box_width) - priv->width;
+
+  if ((y + box_height) > priv->height)
+    box_height -= (y + box_height) - priv->height;
+
+  n = ABS (dy);
+
+  if (box_width <= 0 || box_height <= 0 || n == 0)
+    return;
+
+  /* Moving pixels would paint a frozen console, the box is redrawn instead.
+   */
+  if (n >= box_height || !GTK_WIDGET_REALIZED (GTK_WIDGET (console)) || priv->freeze_count > 0)
     {
-      priv = console->priv;
+      damage_box (console, x, y, box_width, box_height);
+      return;
+    }
 
-      rect.x = priv->cursor_x * priv->char_width;
-      rect.y = priv->cursor_y * priv->char_height;
-      rect.height = priv->char_height;
-      rect.width = priv->char_width;
+  /* Damage which isn't flushed yet must move along with the pixels. For
+   * full width boxes dirty spans are moved with the rows, otherwise the
+   * damage is flushed and GDK moves invalid areas itself.
+   */
+  if (x == 0 && box_width == priv->width && priv->dirty != NULL)
+    {
+      if (priv->dirty_y1 <= y + box_height - 1 && priv->dirty_y2 >= y)
+        {
+          if (dy < 0)
+            {
+              for (i = y; i < y + box_height - n; i++)
+                priv->dirty[i] = priv->dirty[i+n];
+            }
+          else
+            {
+              for (i = y + box_height - 1; i >= y + n; i--)
+                priv->dirty[i] = priv->dirty[i-n];
+            }
 
-      gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, FALSE);
+          priv->dirty_y1 = MIN (priv->dirty_y1, y);
+          priv->dirty_y2 = MAX (priv->dirty_y2, y + box_height - 1);
+        }
     }
-}
+  else
+    flush_damage (console);
 
-/* This helper invalidates console widget window area at coordinates x and y.
- */
-static void
-invalidate_char_rect (Console *console, int x, int y)
-{
-  ConsolePrivate *priv;
-  GdkRectangle rect;
+  /* Move the part of the box which remains visible, both in the backing
+   * pixmap and in the window.
+   */
+  rect.x = x * priv->char_width;
+  rect.y = (dy < 0 ? y + n : y) * priv->char_height;
+  rect.width = box_width * priv->char_width;
+  rect.height = (box_height - n) * priv->char_height;
 
-  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
+  if (priv->backing != NULL && priv->backing_valid)
     {
-      priv = console->priv;
+      gdk_draw_drawable (priv->backing, priv->backing_gc, priv->backing,
+                         rect.x, rect.y, rect.x, rect.y + dy * priv->char_height,
+                         rect.width, rect.height);
+    }
 
-      g_assert (x < priv->width && y < priv->height);
+  region = gdk_region_rectangle (&rect);
+  gdk_window_move_region (GTK_WIDGET (console)->window, region, 0, dy * priv->char_height);
+  gdk_region_destroy (region);
 
-      rect.x = x * priv->char_width;
-      rect.y = y * priv->char_height;
-      rect.height = priv->char_height;
-      rect.width = priv->char_width ;
+  /* The cursor overlay may have moved along with the window pixels,
+   * display it again at its place.
+   */
+  get_cell_rectangle (priv, priv->cursor_x, priv->cursor_y + dy, &rect);
+  gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, FALSE);
+  invalidate_cursor (console);
 
-      gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, FALSE);
+  /* The cursor which moved since the last frame is still displayed at its
+   * old position, that image moved too. Once it left the box it is gone.
+   */
+  if (priv->cursor_moved &&
+      priv->cursor_old_x >= x && priv->cursor_old_x < x + box_width &&
+      priv->cursor_old_y >= y && priv->cursor_old_y < y + box_height)
+    {
+      priv->cursor_old_y += dy;
+
+      if (priv->cursor_old_y >= y && priv->cursor_old_y < y + box_height)
+        {
+          get_cell_rectangle (priv, priv->cursor_old_x, priv->cursor_old_y, &rect);
+          gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, FALSE);
+        }
+      else
+        priv->cursor_moved = FALSE;
     }
+
+  /* Damage the lines uncovered by the scroll.
+   */
+  if (dy < 0)
+    damage_box (console, x, y + box_height - n, box_width, n);
+  else
+    damage_box (console, x, y, box_width, n);
 }
 
 /* This function is called by cursor blinking timer. */
@@ -1996,13 +4956,16 @@ console_cursor_timer (gpointer user_data)
 
   priv->cursor_toggle = !priv->cursor_toggle;
 
-  invalidate_cursor_rect (console);
+  invalidate_cursor (console);
 
   return TRUE;
 }
 
-void
-console_put_char (Console *console, gunichar uc)
+/* This helper puts the character at the cursor position or performs the
+ * control character.
+ */
+static void
+put_char (Console *console, gunichar uc)
 {
   ConsolePrivate *priv;
   ConsoleChar *chr;
@@ -2011,9 +4974,6 @@ console_put_char (Console *console, gunichar uc)
   gint32 mask;
   gint i, pos;
 
-  g_return_if_fail (console != NULL);
-  g_return_if_fail (IS_CONSOLE (console));
-
   priv = console->priv;
 
   width = priv->width;
@@ -2029,28 +4989,24 @@ console_put_char (Console *console, gunichar uc)
 
     case ASCII_FF: /* form feed */
     case ASCII_LF: /* line feed */
-      /* previous cursor position must be redrawn */
-      invalidate_cursor_rect (console);
+      /* the cursor leaves its position, no cell changes */
+      damage_cursor_move (console);
       /* move cursor to the next line */
       ++cursor_y;
       if (cursor_y >= height)
         {
           cursor_y = height - 1;
           scroll_box_up (console, 0, 0, width, height, 1);
-          gtk_widget_queue_draw (GTK_WIDGET (console));
+          damage_scroll (console, 0, 0, width, height, -1);
         }
-      /* redraw character at the new cursor position */
-      invalidate_char_rect (console, cursor_x, cursor_y);
       /* save modification back */
       priv->cursor_y = cursor_y;
       break;
 
     case ASCII_CR: /* carriage return */
-      /* character at previous cursor position must be redrawn */
-      invalidate_cursor_rect (console);
+      damage_cursor_move (console);
       /* move cursor to the beginning of the current line */
       cursor_x = 0;
-      invalidate_char_rect (console, cursor_x, cursor_y);
       priv->cursor_x = cursor_x;
       break;
 
@@ -2062,14 +5018,19 @@ console_put_char (Console *console, gunichar uc)
     case ASCII_DEL: /* delete */
       if (cursor_x > 0)
         {
-          invalidate_cursor_rect (console);
+          damage_cursor_move (console);
           --cursor_x;
-          chr = priv->scr + (width*cursor_y + cursor_x);
-          chr->attr = priv->attr;
-          chr->color = priv->color;
-          chr->bg_color = priv->bg_color;
-          chr->chr = ' ';
-          invalidate_char_rect (console, cursor_x, cursor_y);
+          chr = SCREEN_ROW (priv, cursor_y) + cursor_x;
+          /* erase the character before the cursor unless it is blank already */
+          if (CHAR_EQUAL (chr, ' ', priv->color, priv->attr))
+            priv->stats.writes_suppressed++;
+          else
+            {
+              chr->attr = priv->attr;
+              chr->color = priv->color;
+              chr->chr = ' ';
+              damage_char (console, cursor_x, cursor_y);
+            }
           priv->cursor_x = cursor_x;
         }
       break;
@@ -2078,7 +5039,7 @@ console_put_char (Console *console, gunichar uc)
       break;
 
     case ASCII_HT: /* horizontal tab */
-      invalidate_cursor_rect (console);
+      damage_cursor_move (console);
       /* determine the nearest tab position using bitmap */
       pos = cursor_x + 1;
       mask = 1 << (pos & ((1 << TABMAP_SIZE)-1));
@@ -2102,20 +5063,26 @@ console_put_char (Console *console, gunichar uc)
       else
         cursor_x = width - 1;
       priv->cursor_x = cursor_x;
-      invalidate_char_rect (console, cursor_x, cursor_y);
       break;
 
     default:
       g_assert (cursor_x < width && cursor_y < height);
       /* shortcut to character */
-      chr = priv->scr + (width*cursor_y + cursor_x);
-      /* put the character at the current cursor position */
-      chr->attr = priv->attr;
-      chr->color = priv->color;
-      chr->bg_color = priv->bg_color;
-      chr->chr = uc;
-      /* invalidate a character at the cursor position */
-      invalidate_cursor_rect (console);
+      chr = SCREEN_ROW (priv, cursor_y) + cursor_x;
+      /* a character written again only moves the cursor */
+      if (CHAR_EQUAL (chr, uc, priv->color, priv->attr))
+        priv->stats.writes_suppressed++;
+      else
+        {
+          /* put the character at the current cursor position */
+          chr->attr = priv->attr;
+          chr->color = priv->color;
+          chr->chr = uc;
+          /* invalidate a character at the cursor position */
+          damage_cursor (console);
+        }
+      /* the cursor is displayed at its new position on flush */
+      damage_cursor_move (console);
       /* advance the cursor to the next position */
       ++cursor_x;
       if (cursor_x >= width)
@@ -2128,17 +5095,202 @@ console_put_char (Console *console, gunichar uc)
         {
           cursor_y = height - 1;
           scroll_box_up (console, 0, 0, width, height, 1);
-          gtk_widget_queue_draw (GTK_WIDGET (console));
+          damage_scroll (console, 0, 0, width, height, -1);
         }
       /* save modified cursor position back */
       priv->cursor_x = cursor_x;
       priv->cursor_y = cursor_y;
-      /* request redrawing the widget */
-      invalidate_char_rect (console, cursor_x, cursor_y);
       break;
     }
 }
 
+void
+console_put_char (Console *console, gunichar uc)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  /* output brings the view back to the screen */
+  view_reset (console);
+
+  put_char (console, uc);
+}
+
+/* Puts n_chars characters at the cursor position as console_put_char()
+ * does. Runs of printable characters are stored a row at a time with one
+ * damage record per row at most.
+ */
+void
+console_put_chars (Console *console, const gunichar *chars, gint n_chars)
+{
+  ConsolePrivate *priv;
+  gint i, n, k, x1, x2;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (chars != NULL || n_chars == 0);
+
+  view_reset (console);
+
+  priv = console->priv;
+
+  for (i = 0; i < n_chars; i += n)
+    {
+      ConsoleChar *row;
+      gint width, height;
+
+      width = priv->width;
+      height = priv->height;
+
+      /* control characters are performed one by one */
+      if (chars[i] < 0x20 || chars[i] == ASCII_DEL)
+        {
+          put_char (console, chars[i]);
+          n = 1;
+          continue;
+        }
+
+      /* printable characters up to the end of the cursor row */
+      for (n = 1; i + n < n_chars && n < width - priv->cursor_x; n++)
+        {
+          if (chars[i + n] < 0x20 || chars[i + n] == ASCII_DEL)
+            break;
+        }
+
+      row = SCREEN_ROW (priv, priv->cursor_y) + priv->cursor_x;
+
+      /* Cells keeping the characters already are left alone, only the
+       * changed ones are damaged.
+       */
+      for (k = 0, x1 = n, x2 = -1; k < n; k++)
+        {
+          if (CHAR_EQUAL (row + k, chars[i + k], priv->color, priv->attr))
+            {
+              priv->stats.writes_suppressed++;
+              continue;
+            }
+
+          row[k].attr = priv->attr;
+          row[k].color = priv->color;
+          row[k].chr = chars[i + k];
+
+          x1 = MIN (x1, k);
+          x2 = k;
+        }
+
+      if (x1 <= x2)
+        damage_box (console, priv->cursor_x + x1, priv->cursor_y, x2 - x1 + 1, 1);
+
+      damage_cursor_move (console);
+
+      priv->cursor_x += n;
+
+      if (priv->cursor_x >= width)
+        {
+          priv->cursor_x = 0;
+          ++priv->cursor_y;
+        }
+
+      /* scroll console one line up if needed */
+      if (priv->cursor_y >= height)
+        {
+          priv->cursor_y = height - 1;
+          scroll_box_up (console, 0, 0, width, height, 1);
+          damage_scroll (console, 0, 0, width, height, -1);
+        }
+    }
+}
+
+/* Puts n_cells cells starting from the position x and y, cells beyond the
+ * end of the row are left out. Cells get the current attributes, the cursor
+ * stays in place. Colors must be palette indices.
+ */
+gboolean
+console_put_cells (Console *console, const ConsoleCell *cells, gint n_cells, gint x, gint y)
+{
+  ConsolePrivate *priv;
+  ConsoleChar *row;
+  gint i, x1, x2;
+
+  g_return_val_if_fail (console != NULL, FALSE);
+  g_return_val_if_fail (IS_CONSOLE (console), FALSE);
+  g_return_val_if_fail (cells != NULL || n_cells == 0, FALSE);
+  g_return_val_if_fail (x >= 0 && y >= 0 && n_cells >= 0, FALSE);
+
+  /* colors are checked before any cell is put, so the screen isn't changed
+   * halfway
+   */
+  for (i = 0; i < n_cells; i++)
+    g_return_val_if_fail (cells[i].fg < CONSOLE_PALETTE_SIZE && cells[i].bg < CONSOLE_PALETTE_SIZE, FALSE);
+
+  priv = console->priv;
+
+  if (x >= priv->width || y >= priv->height)
+    return FALSE;
+
+  if (priv->scr != NULL)
+    {
+      view_reset (console);
+
+      n_cells = MIN (n_cells, priv->width - x);
+      row = SCREEN_ROW (priv, y) + x;
+
+      for (i = 0, x1 = n_cells, x2 = -1; i < n_cells; i++)
+        {
+          guint8 color = CHAR_COLOR (cells[i].fg, cells[i].bg);
+
+          if (CHAR_EQUAL (row + i, cells[i].chr, color, priv->attr))
+            {
+              priv->stats.writes_suppressed++;
+              continue;
+            }
+
+          row[i].chr = cells[i].chr;
+          row[i].color = color;
+          row[i].attr = priv->attr;
+
+          x1 = MIN (x1, i);
+          x2 = i;
+        }
+
+      if (x1 <= x2)
+        damage_box (console, x + x1, y, x2 - x1 + 1, 1);
+    }
+
+  return TRUE;
+}
+
+/* Stops painting the console until console_thaw() is called, changes made
+ * meanwhile are painted at once. Calls may be nested.
+ */
+void
+console_freeze (Console *console)
+{
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+
+  console->priv->freeze_count++;
+}
+
+void
+console_thaw (Console *console)
+{
+  ConsolePrivate *priv;
+
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (console->priv->freeze_count > 0);
+
+  priv = console->priv;
+
+  if (--priv->freeze_count > 0)
+    return;
+
+  /* paint the changes made while frozen */
+  if (priv->dirty_y1 <= priv->dirty_y2 || priv->cursor_moved)
+    damage_schedule (console);
+}
+
 gboolean
 console_put_char_at (Console *console, gunichar c, gint x, gint y)
 {
@@ -2156,26 +5308,22 @@ console_put_char_at (Console *console, gunichar c, gint x, gint y)
 
   if (priv->scr != NULL)
     {
-      GdkRectangle rect;
-      gint char_width, char_height;
+      chr = SCREEN_ROW (priv, y) + x;
 
-      char_width = priv->char_width;
-      char_height = priv->char_height;
-
-      rect.width = char_width;
-      rect.height = char_height;
-      rect.x = x * char_width;
-      rect.y = y * char_height;
+      /* the cell keeps the character already */
+      if (CHAR_EQUAL (chr, c, priv->color, priv->attr))
+        {
+          priv->stats.writes_suppressed++;
+          return TRUE;
+        }
 
-      chr = priv->scr + (y*priv->width + x);
+      view_reset (console);
 
       chr->chr = c;
       chr->color = priv->color;
-      chr->bg_color = priv->bg_color;
       chr->attr = priv->attr;
 
-      if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
-        gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, TRUE);
+      damage_char (console, x, y);
     }
 
   return TRUE;
@@ -2184,61 +5332,79 @@ console_put_char_at (Console *console, gunichar c, gint x, gint y)
 void
 console_scroll_box_down (Console *console, gint x, gint y, gint box_width, gint box_height, gint nlines)
 {
-  GdkRectangle rect;
-  ConsolePrivate *priv;
-
   g_return_if_fail (console != NULL);
   g_return_if_fail (IS_CONSOLE (console));
   g_return_if_fail (x >= 0 && y >= 0);
 
-  priv = console->priv;
-
-  rect.x = x * priv->char_width;
-  rect.y = y * priv->char_height;
-  rect.width = box_width * priv->char_width;
-  rect.height = box_height * priv->char_height;
+  view_reset (console);
 
   scroll_box_down (console, x, y, box_width, box_height, nlines);
 
-  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
-    gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, FALSE);
+  damage_scroll (console, x, y, box_width, box_height, nlines);
 }
 
 void
 console_scroll_box_up (Console *console, gint x, gint y, gint box_width, gint box_height, gint nlines)
 {
-  GdkRectangle rect;
+  g_return_if_fail (console != NULL);
+  g_return_if_fail (IS_CONSOLE (console));
+  g_return_if_fail (x >= 0 && y >= 0);
+
+  view_reset (console);
+
+  scroll_box_up (console, x, y, box_width, box_height, nlines);
+
+  damage_scroll (console, x, y, box_width, box_height, -nlines);
+}
+
+/* Scrolls the view by n_lines lines back into the history, negative n_lines
+ * scroll it forward to the screen. The view returns to the screen when the
+ * screen changes.
+ */
+void
+console_scroll_view (Console *console, gint n_lines)
+{
   ConsolePrivate *priv;
+  gint offset;
 
   g_return_if_fail (console != NULL);
   g_return_if_fail (IS_CONSOLE (console));
-  g_return_if_fail (x >= 0 && y >= 0);
 
   priv = console->priv;
 
-  rect.x = x * priv->char_width;
-  rect.y = y * priv->char_height;
-  rect.width = box_width * priv->char_width;
-  rect.height = box_height * priv->char_height;
+  offset = CLAMP (priv->view_offset + n_lines, 0, scrollback_get_n_lines (priv->scrollback));
 
-  scroll_box_up (console, x, y, box_width, box_height, nlines);
+  if (offset == priv->view_offset || priv->scr == NULL)
+    return;
 
-  if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
-    gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, FALSE);
+  priv->view_offset = offset;
+  view_update (priv);
+
+  damage_all (console);
+  invalidate_cursor (console);
+}
+
+gint
+console_get_view_offset (Console *console)
+{
+  g_return_val_if_fail (console != NULL, -1);
+  g_return_val_if_fail (IS_CONSOLE (console), -1);
+
+  return console->priv->view_offset;
 }
 
 void
 console_move_cursor_to (Console *console, gint x, gint y)
 {
   ConsolePrivate *priv;
-  gint old_x, old_y;
 
   g_return_if_fail (console != NULL);
   g_return_if_fail (IS_CONSOLE (console));
 
   priv = console->priv;
-  old_x = priv->cursor_x;
-  old_y = priv->cursor_y;
+
+  /* only the cursor is moved, no cell is redrawn */
+  damage_cursor_move (console);
 
   /* Negative x or y cursor coordinate indicates that
    * the user asked to leave the old position unchanged.
@@ -2256,183 +5422,124 @@ console_move_cursor_to (Console *console, gint x, gint y)
         y = priv->height - 1;
       priv->cursor_y = y;
     }
-
-  /* request to redraw a rectangle at the new cursor position */
-  invalidate_cursor_rect (console);
-
-  /* request to redraw a rectangle at the old cursor position */
-  invalidate_char_rect (console, old_x, old_y);
 }
 
 void
 console_erase_line (Console *console, ConsoleEraseMode mode)
 {
   ConsoleChar *chr;
-  GdkRectangle rect;
-  gint char_width, char_height;
-  gint width, height;
+  gint width;
   gint nr_chars_erased;
-  gint x, y;
+  gint x, y, x1;
 
   g_return_if_fail (console != NULL);
   g_return_if_fail (IS_CONSOLE (console));
 
-  rect.x = rect.y = 0;
-  rect.width = rect.height = 0;
+  view_reset (console);
 
   /* Obtain shortcuts to the most used fields of the structure.
    */
-  char_width = console->priv->char_width;
-  char_height = console->priv->char_height;
   width = console->priv->width;
-  height = console->priv->height;
   x = console->priv->cursor_x;
   y = console->priv->cursor_y;
   nr_chars_erased = 0;
+  x1 = 0;
 
   if (console->priv->scr != NULL)
     {
-      /* Calculate the rectangular region of the window, which will require an update.
+      /* Calculate the range of characters to erase.
        */
       switch (mode)
         {
         case CONSOLE_ERASE_FROM_START:
-          rect.x = 0;
-          rect.y = y * char_height;
-          rect.width = (x+1) * char_width;
-          rect.height = 1 * char_height;
+          x1 = 0;
           nr_chars_erased = x + 1;
-          chr = console->priv->scr + y*width;
           break;
 
         case CONSOLE_ERASE_TO_END:
-          rect.x = x * char_width;
-          rect.y = y * char_height;
-          rect.width = (width - x) * char_width;
-          rect.height = 1 * char_height;
+          x1 = x;
           nr_chars_erased = width - x;
-          chr = console->priv->scr + y*width + x;
           break;
 
         case CONSOLE_ERASE_WHOLE:
-          rect.x = 0;
-          rect.y = y * char_height;
-          rect.width = width * char_width;
-          rect.height = 1 * char_height;
+          x1 = 0;
           nr_chars_erased = width;
-          chr = console->priv->scr + y*width;
           break;
 
         default:
           g_warn_if_reached ();
         }
 
-      /* Erase characters of the line.
+      /* Notify that the characters will require an update.
        */
-      for (; nr_chars_erased > 0; --nr_chars_erased, ++chr)
-        {
-          chr->attr = 0;
-          chr->chr = ' ';
-          chr->bg_color = console->priv->bg_color;
-          chr->color = console->priv->color;
-        }
+      damage_box (console, x1, y, nr_chars_erased, 1);
 
-      /* Notify that the rectangular region of the widget's window needs an update.
+      /* Erase characters of the line.
        */
-      if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
-        gdk_window_invalidate_rect (GTK_WIDGET (console)->window, &rect, FALSE);
+      chr = SCREEN_ROW (console->priv, y) + x1;
+
+      blank_chars (chr, nr_chars_erased, console->priv->color, CONSOLE_CHAR_ATTR_DEFAULT);
     }
 }
 
 void
 console_erase_display (Console *console, ConsoleEraseMode mode)
 {
-  ConsoleChar *chr;
-  GdkRegion *region;
-  GdkRectangle rect;
-  gint char_width, char_height;
   gint width, height;
   gint nr_chars_erased;
-  gint x, y;
+  gint x, y, x1, y1;
 
   g_return_if_fail (console != NULL);
   g_return_if_fail (IS_CONSOLE (console));
 
-  char_width = console->priv->char_width;
-  char_height = console->priv->char_height;
+  view_reset (console);
+
   width = console->priv->width;
   height = console->priv->height;
   x = console->priv->cursor_x;
   y = console->priv->cursor_y;
   nr_chars_erased = 0;
+  x1 = y1 = 0;
 
   if (console->priv->scr != NULL)
     {
-      region = gdk_region_new ();
-
       switch (mode)
         {
         case CONSOLE_ERASE_FROM_START:
-          rect.x = 0;
-          rect.y = y * char_height;
-          rect.width = (x+1) * char_width;
-          rect.height = 1 * char_height;
-          gdk_region_union_with_rect (region, &rect);
-          rect.x = 0;
-          rect.y = 0;
-          rect.width = width * char_width;
-          rect.height = y * char_height;
-          gdk_region_union_with_rect (region, &rect);
+          damage_box (console, 0, y, x+1, 1);
+          damage_box (console, 0, 0, width, y);
           nr_chars_erased = (x+1) + y*width;
-          chr = console->priv->scr;
           break;
 
         case CONSOLE_ERASE_TO_END:
-          rect.x = x * char_width;
-          rect.y = y * char_height;
-          rect.width = (width - x) * char_width;
-          rect.height = 1 * char_height;
-          gdk_region_union_with_rect (region, &rect);
-
-          if (y+1 < height)
-            {
-              rect.x = 0;
-              rect.y = (y + 1) * char_height;
-              rect.width = width * char_width;
-              rect.height = (height - (y+1)) * char_height;
-              gdk_region_union_with_rect (region, &rect);
-            }
-
+          damage_box (console, x, y, width - x, 1);
+          damage_box (console, 0, y + 1, width, height - (y+1));
           nr_chars_erased = (width - x) + (height - (y+1))*width;
-          chr = console->priv->scr + y*width + x;
+          x1 = x;
+          y1 = y;
           break;
 
         case CONSOLE_ERASE_WHOLE:
-          rect.x = 0;
-          rect.y = 0;
-          rect.width = width * char_width;
-          rect.height = height * char_height;
+          damage_all (console);
           nr_chars_erased = width * height;
-          chr = console->priv->scr;
-          gdk_region_union_with_rect (region, &rect);
           break;
 
         default:
           g_warn_if_reached ();
         }
 
-      for (; nr_chars_erased > 0; --nr_chars_erased, ++chr)
+      /* Rows are not adjacent in the buffer, so they are erased one by one.
+       */
+      while (nr_chars_erased > 0)
         {
-          chr->attr = 0;
-          chr->chr = ' ';
-          chr->bg_color = console->priv->bg_color;
-          chr->color = console->priv->color;
-        }
+          gint n = MIN (nr_chars_erased, width - x1);
 
-      if (GTK_WIDGET_REALIZED (GTK_WIDGET (console)))
-        gdk_window_invalidate_region (GTK_WIDGET (console)->window, region, FALSE);
+          blank_chars (SCREEN_ROW (console->priv, y1) + x1, n, console->priv->color, CONSOLE_CHAR_ATTR_DEFAULT);
 
-      gdk_region_destroy (region);
+          nr_chars_erased -= n;
+          x1 = 0;
+          ++y1;
+        }
     }
 }
 
@@ -11,6 +11,10 @@ G_BEGIN_DECLS
 #define CONSOLE_CLASS(klass) GTK_CHECK_CLASS_CAST(klass, console_get_type (), ConsoleClass)
 #define IS_CONSOLE(obj) GTK_CHECK_TYPE(obj, console_get_type ())
 
+/* Number of colors in the console palette.
+ */
+#define CONSOLE_PALETTE_SIZE 16
+
 typedef enum
 {
   CONSOLE_CURSOR_DEFAULT,
@@ -43,6 +47,29 @@ typedef enum
 typedef struct _Console Console;
 typedef struct _ConsoleClass ConsoleClass;
 typedef struct _ConsolePrivate ConsolePrivate;
+typedef struct _ConsoleStats ConsoleStats;
+typedef struct _ConsoleCell ConsoleCell;
+
+/* Character cell written by console_put_cells().
+ */
+struct _ConsoleCell
+{
+  gunichar chr;                 /* unicode symbol */
+  guint8 fg;                    /* foreground palette index */
+  guint8 bg;                    /* background palette index */
+};
+
+/* Rendering statistics of a console widget.
+ */
+struct _ConsoleStats
+{
+  guint64 frames_painted;       /* frames flushed to the window */
+  guint64 frames_skipped;       /* frames merged with later ones to keep the frame rate limit */
+  guint64 row_cache_hits;       /* rows copied from the row cache */
+  guint64 row_cache_misses;     /* cacheable rows rendered from scratch */
+  guint64 writes_suppressed;    /* cell writes skipped since the cell kept the same contents */
+  guint64 cells_rendered;       /* damaged cells rendered again by painted frames */
+};
 
 struct _Console
 {
@@ -92,6 +119,8 @@ void               console_set_font_family  (Console     *console,
                                              const gchar *family);
 void               console_set_font_style   (Console     *console,
                                              const gchar *style);
+void               console_zoom             (Console     *console,
+                                             gint         steps);
 
 void               console_get_foreground_color (Console        *console,
                                                  GdkColor       *color);
@@ -107,9 +136,52 @@ void               console_set_background_color_from_string (Console *console,
 void               console_set_foreground_color_from_string (Console *console,
                                                              const gchar *spec);
 
+gint               console_get_foreground_index (Console        *console);
+gint               console_get_background_index (Console        *console);
+void               console_set_foreground_index (Console        *console,
+                                                 gint            index);
+void               console_set_background_index (Console        *console,
+                                                 gint            index);
+
+void               console_get_palette_color    (Console        *console,
+                                                 gint            index,
+                                                 GdkColor       *color);
+void               console_set_palette_color    (Console        *console,
+                                                 gint            index,
+                                                 const GdkColor *color);
+
 void               console_set_cursor_timer (Console            *console,
                                              ConsoleBlinkTimer   timer);
 
+gint               console_get_max_fps      (Console            *console);
+void               console_set_max_fps      (Console            *console,
+                                             gint                max_fps);
+void               console_get_stats        (Console            *console,
+                                             ConsoleStats       *stats);
+
+gint               console_get_render_threads (Console          *console);
+void               console_set_render_threads (Console          *console,
+                                               gint              n_threads);
+
+gint               console_get_row_cache_size (Console          *console);
+void               console_set_row_cache_size (Console          *console,
+                                               gint              size);
+
+gint               console_get_font_cache_size (Console         *console);
+void               console_set_font_cache_size (Console         *console,
+                                                gint             size);
+
+gint               console_get_freetype_cache_size (void);
+void               console_set_freetype_cache_size (gint         size);
+
+gint               console_get_scrollback_lines (Console        *console);
+void               console_set_scrollback_lines (Console        *console,
+                                                 gint            n_lines);
+
+gboolean           console_get_scrollback_spill (Console        *console);
+void               console_set_scrollback_spill (Console        *console,
+                                                 gboolean        spill);
+
 ConsoleCursorShape console_get_cursor_shape (Console            *console);
 void               console_set_cursor_shape (Console            *console,
                                              ConsoleCursorShape  cursor_shape);
@@ -132,6 +204,16 @@ void               console_move_cursor_to   (Console                *console,
                                              gint                y);
 void               console_put_char         (Console            *console,
                                              gunichar            c);
+void               console_put_chars        (Console            *console,
+                                             const gunichar     *chars,
+                                             gint                n_chars);
+gboolean           console_put_cells        (Console            *console,
+                                             const ConsoleCell  *cells,
+                                             gint                n_cells,
+                                             gint                x,
+                                             gint                y);
+void               console_freeze           (Console            *console);
+void               console_thaw             (Console            *console);
 gboolean           console_put_char_at      (Console            *console,
                                              gunichar            c,
                                              gint                x,
@@ -148,6 +230,9 @@ void               console_scroll_box_down  (Console            *console,
                                              gint                scroll_width,
                                              gint                scroll_height,
                                              gint                nlines);
+void               console_scroll_view      (Console            *console,
+                                             gint                n_lines);
+gint               console_get_view_offset  (Console            *console);
 void               console_window_to_display_coords (Console     *console,
                                              double             *x_coord,
                                              double             *y_coord);
@@ -8,6 +8,29 @@
 #define DEFAULT_MONOSPACE_FAMILY "sans mono"
 #define DEFAULT_MONOSPACE_STYLE  "regular"
 
+/* Fallback chain of a font description.
+ */
+struct _FcFallback
+{
+  FcFontSet *fonts;             /* fonts sorted by closeness to the description */
+};
+
+/* Font file matched for a font description.
+ */
+typedef struct _FcFontFile
+{
+  gchar *file;                  /* path to font file, NULL if nothing matched */
+  gint face_index;              /* font face index in the file */
+} FcFontFile;
+
+/* Font matching substitutes the pattern and sorts the whole font set, so
+ * match results are remembered by font description. The caches are dropped
+ * when the FontConfig configuration is replaced.
+ */
+static GHashTable *file_cache = NULL;
+static GHashTable *matched_cache = NULL;
+static FcConfig *cache_config = NULL;
+
 /* This converts FontConfig slant FC_SLANT_xxx to string.
  */
 static const gchar*
@@ -93,6 +116,69 @@ width_to_string (gint width)
   return NULL;
 }
 
+static void
+font_file_free (gpointer data)
+{
+  FcFontFile *font_file = data;
+
+  g_free (font_file->file);
+  g_free (font_file);
+}
+
+/* This helper drops remembered match results.
+ */
+static void
+match_cache_clear ()
+{
+  if (file_cache != NULL)
+    g_hash_table_destroy (file_cache);
+
+  if (matched_cache != NULL)
+    g_hash_table_destroy (matched_cache);
+
+  file_cache = NULL;
+  matched_cache = NULL;
+  cache_config = NULL;
+}
+
+/* This helper makes sure match results were obtained with the current
+ * configuration.
+ */
+static void
+match_cache_validate ()
+{
+  FcConfig *config;
+
+  config = FcConfigGetCurrent ();
+
+  if (config != cache_config)
+    match_cache_clear ();
+
+  if (file_cache == NULL)
+    file_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, font_file_free);
+
+  if (matched_cache == NULL)
+    matched_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_strfreev);
+
+  cache_config = config;
+}
+
+/* This helper returns the key the match of the font description is
+ * remembered by. Missing family and style are replaced by the defaults
+ * the same way the matching does.
+ */
+static gchar*
+match_key (const gchar *family, const gchar *style, gboolean monospaced, gboolean scalable)
+{
+  if (family == NULL)
+    family = monospaced ? DEFAULT_MONOSPACE_FAMILY : DEFAULT_FAMILY;
+
+  if (style == NULL)
+    style = monospaced ? DEFAULT_MONOSPACE_STYLE : DEFAULT_STYLE;
+
+  return g_strdup_printf ("%s\n%s\n%d%d", family, style, monospaced != FALSE, scalable != FALSE);
+}
+
 void
 fc_init ()
 {
@@ -102,6 +188,7 @@ fc_init ()
 void
 fc_finalize ()
 {
+  match_cache_clear ();
   FcFini ();
 }
 
@@ -128,13 +215,16 @@ fc_synthesize_style (gint width, gint weight, gint slant)
   return s;
 }
 
-void
-fc_get_matched (const gchar  *family,
-                const gchar  *style,
-                gboolean      monospaced,
-                gboolean      scalable,
-                gchar       **matched_family,
-                gchar       **matched_style)
+/* This helper matches the font description and returns the family and the
+ * style of the best matching font.
+ */
+static void
+fc_match (const gchar  *family,
+          const gchar  *style,
+          gboolean      monospaced,
+          gboolean      scalable,
+          gchar       **matched_family,
+          gchar       **matched_style)
 {
   FcPattern *pattern;
   FcPattern *match;
@@ -213,6 +303,37 @@ fc_get_matched (const gchar  *family,
   FcPatternDestroy (match);
 }
 
+void
+fc_get_matched (const gchar  *family,
+                const gchar  *style,
+                gboolean      monospaced,
+                gboolean      scalable,
+                gchar       **matched_family,
+                gchar       **matched_style)
+{
+  gchar **cached, *key;
+
+  match_cache_validate ();
+
+  key = match_key (family, style, monospaced, scalable);
+  cached = g_hash_table_lookup (matched_cache, key);
+
+  if (cached == NULL)
+    {
+      cached = g_new0 (gchar*, 3);
+      fc_match (family, style, monospaced, scalable, &cached[0], &cached[1]);
+      g_hash_table_insert (matched_cache, key, cached);
+    }
+  else
+    g_free (key);
+
+  if (matched_family != NULL)
+    *matched_family = g_strdup (cached[0]);
+
+  if (matched_style != NULL)
+    *matched_style = g_strdup (cached[1]);
+}
+
 void
 fc_list_faces (gboolean        monospaced,
                gboolean        scalable,
@@ -278,18 +399,16 @@ fc_list_faces (gboolean        monospaced,
   FcPatternDestroy (pat);
 }
 
-void
-fc_get_font_file (const gchar  *family,
-                  const gchar  *style,
-                  gboolean      monospaced,
-                  gboolean      scalable,
-                  gchar       **file,
-                  gint         *face_index)
+/* This helper returns the pattern matching fonts of the font description.
+ */
+static FcPattern*
+font_pattern_new (const gchar *family,
+                  const gchar *style,
+                  gboolean     monospaced,
+                  gboolean     scalable)
 {
-  FcPattern *pat, *match;
-  FcResult res;
+  FcPattern *pat;
 
-  /* Select the best suitable font using a pattern. */
   pat = FcPatternCreate ();
 
   if (family != NULL)
@@ -322,6 +441,26 @@ fc_get_font_file (const gchar  *family,
   FcConfigSubstitute (NULL, pat, FcMatchPattern);
   FcDefaultSubstitute (pat);
 
+  return pat;
+}
+
+/* This helper matches the font description and returns the file and the
+ * face index of the best matching font.
+ */
+static void
+fc_match_file (const gchar  *family,
+               const gchar  *style,
+               gboolean      monospaced,
+               gboolean      scalable,
+               gchar       **file,
+               gint         *face_index)
+{
+  FcPattern *pat, *match;
+  FcResult res;
+
+  /* Select the best suitable font using a pattern. */
+  pat = font_pattern_new (family, style, monospaced, scalable);
+
   /* Find the best match for the pattern. */
   match = FcFontMatch (NULL, pat, &res);
 
@@ -347,3 +486,113 @@ fc_get_font_file (const gchar  *family,
   FcPatternDestroy (pat);
 }
 
+void
+fc_get_font_file (const gchar  *family,
+                  const gchar  *style,
+                  gboolean      monospaced,
+                  gboolean      scalable,
+                  gchar       **file,
+                  gint         *face_index)
+{
+  FcFontFile *cached;
+  gchar *key;
+
+  match_cache_validate ();
+
+  key = match_key (family, style, monospaced, scalable);
+  cached = g_hash_table_lookup (file_cache, key);
+
+  if (cached == NULL)
+    {
+      cached = g_new0 (FcFontFile, 1);
+      fc_match_file (family, style, monospaced, scalable, &cached->file, &cached->face_index);
+      g_hash_table_insert (file_cache, key, cached);
+    }
+  else
+    g_free (key);
+
+  if (face_index != NULL)
+    *face_index = cached->face_index;
+
+  if (file != NULL)
+    *file = g_strdup (cached->file);
+}
+
+/* Returns the fallback chain of the font description: fonts sorted by
+ * closeness to the description, which are searched for characters the
+ * font of the description lacks.
+ */
+FcFallback*
+fc_fallback_new (const gchar *family,
+                 const gchar *style,
+                 gboolean     monospaced,
+                 gboolean     scalable)
+{
+  FcFallback *fallback;
+  FcPattern *pat;
+  FcResult res;
+
+  pat = font_pattern_new (family, style, monospaced, scalable);
+
+  fallback = g_new0 (FcFallback, 1);
+
+  /* fonts adding no characters to the fonts before them are trimmed */
+  fallback->fonts = FcFontSort (NULL, pat, FcTrue, NULL, &res);
+
+  FcPatternDestroy (pat);
+
+  return fallback;
+}
+
+void
+fc_fallback_free (FcFallback *fallback)
+{
+  g_return_if_fail (fallback != NULL);
+
+  if (fallback->fonts != NULL)
+    FcFontSetDestroy (fallback->fonts);
+
+  g_free (fallback);
+}
+
+/* Looks up the first font of the fallback chain having character uc and
+ * returns its file and face index. It returns FALSE if no font has it.
+ */
+gboolean
+fc_fallback_find (FcFallback  *fallback,
+                  gunichar     uc,
+                  gchar      **file,
+                  gint        *face_index)
+{
+  gint i;
+
+  g_return_val_if_fail (fallback != NULL, FALSE);
+
+  if (fallback->fonts == NULL)
+    return FALSE;
+
+  for (i = 0; i < fallback->fonts->nfont; i++)
+    {
+      FcPattern *font = fallback->fonts->fonts[i];
+      FcCharSet *charset;
+      gchar *tmp;
+
+      if (FcPatternGetCharSet (font, FC_CHARSET, 0, &charset) != FcResultMatch ||
+          !FcCharSetHasChar (charset, uc))
+        continue;
+
+      if (FcPatternGetString (font, FC_FILE, 0, (FcChar8 **) &tmp) != FcResultMatch)
+        continue;
+
+      if (face_index != NULL &&
+          FcPatternGetInteger (font, FC_INDEX, 0, face_index) != FcResultMatch)
+        *face_index = 0;
+
+      if (file != NULL)
+        *file = g_strdup (tmp);
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
@@ -6,6 +6,8 @@
 G_BEGIN_DECLS
 
 
+typedef struct _FcFallback FcFallback;
+
 typedef gboolean (*FcListFacesFunc) (const gchar *family,
                                      const gchar *style,
                                      gint         width,
@@ -40,6 +42,18 @@ void   fc_list_faces       (gboolean        monospaced,
                             FcListFacesFunc callback,
                             gpointer        user_data);
 
+FcFallback* fc_fallback_new  (const gchar  *family,
+                              const gchar  *style,
+                              gboolean      monospaced,
+                              gboolean      scalable);
+
+void        fc_fallback_free (FcFallback   *fallback);
+
+gboolean    fc_fallback_find (FcFallback   *fallback,
+                              gunichar      uc,
+                              gchar       **file,
+                              gint         *face_index);
+
 
 G_END_DECLS
 
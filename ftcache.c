@@ -0,0 +1,186 @@
+/* FreeType cache -- FreeType library and caches shared by the process.
+ *
+ * All consoles of the process look up glyphs in a single FreeType cache,
+ * so a glyph shown by several consoles is rasterised once. The cache is
+ * reference counted and destroyed along with its last user. Font faces
+ * are interned by font file and face index and removed from the cache
+ * when nobody uses them any more.
+ *
+ * FreeType isn't thread safe, the cache is used by the main thread only.
+ */
+#include <string.h>
+#include <glib.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_CACHE_H
+
+#include "ftcache.h"
+
+/* The cache being used, NULL if there are no users.
+ */
+static FtCache *shared_cache = NULL;
+
+/* Maximum number of bytes the cache manager keeps, zero means the FreeType
+ * default.
+ */
+static gsize shared_max_bytes = 0;
+
+/* This helper opens a font face and is called only by the cache manager
+ * when needed.
+ */
+static FT_Error
+face_requester (FTC_FaceID id, FT_Library lib, FT_Pointer data, FT_Face *aface)
+{
+  FtFace *face;
+  FT_Face ft_face;
+  FT_Error error;
+
+  g_assert (lib != NULL && id != NULL);
+  g_assert (aface != NULL);
+
+  *aface = NULL;
+
+  face = (FtFace *) id;
+
+  g_assert (face->face_index >= 0);
+  g_assert (face->font_file != NULL);
+  g_assert (face->cache->library == lib);
+
+  g_debug ("requesting font file '%s' face index %d", face->font_file, face->face_index);
+
+  error = FT_New_Face (lib, face->font_file, face->face_index, &ft_face);
+
+  if (error == 0)
+    *aface = ft_face;
+
+  return error;
+}
+
+/* Sets the memory budget of the cache manager in bytes. It takes effect
+ * when the cache is created, that is when the first user references it.
+ */
+void
+ft_cache_set_max_bytes (gsize max_bytes)
+{
+  shared_max_bytes = max_bytes;
+}
+
+/* Returns a new reference to the process cache, creating the cache if
+ * there are no other users.
+ */
+FtCache*
+ft_cache_ref (void)
+{
+  FtCache *cache;
+  gint error;
+
+  if (shared_cache != NULL)
+    {
+      shared_cache->ref_count++;
+      return shared_cache;
+    }
+
+  cache = g_new0 (FtCache, 1);
+
+  error = FT_Init_FreeType (&cache->library);
+  if (error)
+    g_error ("can't init freetype library");
+
+  error = FTC_Manager_New (cache->library, 0, 0, shared_max_bytes, face_requester, NULL, &cache->manager);
+  if (error)
+    g_error ("can't create cache manager");
+
+  error = FTC_CMapCache_New (cache->manager, &cache->cmapcache);
+  if (error)
+    g_error ("can't create cmap cache");
+
+  error = FTC_SBitCache_New (cache->manager, &cache->sbitcache);
+  if (error)
+    g_error ("can't create sbit cache");
+
+  cache->ref_count = 1;
+  cache->faces = g_hash_table_new (g_str_hash, g_str_equal);
+
+  shared_cache = cache;
+
+  return cache;
+}
+
+void
+ft_cache_unref (FtCache *cache)
+{
+  g_return_if_fail (cache != NULL);
+  g_return_if_fail (cache->ref_count > 0);
+
+  if (--cache->ref_count > 0)
+    return;
+
+  if (g_hash_table_size (cache->faces) > 0)
+    g_warning ("destroying FreeType cache with %u faces in use", g_hash_table_size (cache->faces));
+
+  /* Cache manager owns all other caches. Destroying the manager
+   * destroys other caches as well.
+   */
+  FTC_Manager_Done (cache->manager);
+  FT_Done_FreeType (cache->library);
+
+  g_hash_table_destroy (cache->faces);
+  g_free (cache);
+
+  if (shared_cache == cache)
+    shared_cache = NULL;
+}
+
+/* Returns a new reference to the face of the font file, the face is used
+ * as the face id in cache lookups.
+ */
+FtFace*
+ft_cache_face_ref (FtCache *cache, const gchar *font_file, gint face_index)
+{
+  FtFace *face;
+  gchar *key;
+
+  g_return_val_if_fail (cache != NULL, NULL);
+  g_return_val_if_fail (font_file != NULL, NULL);
+  g_return_val_if_fail (face_index >= 0, NULL);
+
+  key = g_strdup_printf ("%d:%s", face_index, font_file);
+  face = g_hash_table_lookup (cache->faces, key);
+
+  if (face != NULL)
+    {
+      g_free (key);
+      face->ref_count++;
+      return face;
+    }
+
+  face = g_new0 (FtFace, 1);
+
+  face->key = key;
+  face->font_file = key + strlen (key) - strlen (font_file);
+  face->face_index = face_index;
+  face->cache = cache;
+  face->ref_count = 1;
+
+  g_hash_table_insert (cache->faces, face->key, face);
+
+  return face;
+}
+
+void
+ft_cache_face_unref (FtFace *face)
+{
+  g_return_if_fail (face != NULL);
+  g_return_if_fail (face->ref_count > 0);
+
+  if (--face->ref_count > 0)
+    return;
+
+  /* flush the face and everything cached for it */
+  FTC_Manager_RemoveFaceID (face->cache->manager, (FTC_FaceID) face);
+
+  g_hash_table_remove (face->cache->faces, face->key);
+
+  g_free (face->key);
+  g_free (face);
+}
@@ -0,0 +1,61 @@
+/* FreeType cache -- FreeType library and caches shared by the process.
+ */
+#ifndef __FTCACHE_H__
+#define __FTCACHE_H__
+
+#include <glib.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_CACHE_H
+
+G_BEGIN_DECLS
+
+
+typedef struct _FtCache FtCache;
+typedef struct _FtFace FtFace;
+
+/* FreeType library with the cache manager and the caches. Font faces are
+ * looked up in the caches by FtFace pointers used as face ids.
+ */
+struct _FtCache
+{
+  FT_Library library;           /* FreeType library instance */
+  FTC_Manager manager;          /* FreeType cache manager */
+  FTC_CMapCache cmapcache;      /* character map cache */
+  FTC_SBitCache sbitcache;      /* small bitmap cache */
+
+  /*< private >*/
+  gint ref_count;
+  GHashTable *faces;            /* faces by font file and face index */
+};
+
+/* Font face of the cache, the same font file and face index give the same
+ * face to all users.
+ */
+struct _FtFace
+{
+  const gchar *font_file;       /* path to font file */
+  gint face_index;              /* font face index in the file */
+
+  /*< private >*/
+  FtCache *cache;
+  gint ref_count;
+  gchar *key;
+};
+
+void     ft_cache_set_max_bytes (gsize         max_bytes);
+
+FtCache* ft_cache_ref           (void);
+
+void     ft_cache_unref         (FtCache      *cache);
+
+FtFace*  ft_cache_face_ref      (FtCache      *cache,
+                                 const gchar  *font_file,
+                                 gint          face_index);
+
+void     ft_cache_face_unref    (FtFace       *face);
+
+
+G_END_DECLS
+
+#endif /* __FTCACHE_H__ */
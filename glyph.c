@@ -0,0 +1,317 @@
+/* Glyph atlas -- rasterised glyph bitmaps packed into a single A8 surface.
+ *
+ * Glyphs are packed with a simple shelf allocator: the atlas is split into
+ * horizontal shelves, each glyph goes to the lowest shelf tall enough to
+ * keep it, and a new shelf is opened at the bottom when none fits. The
+ * atlas surface grows in height when it runs out of space.
+ *
+ * Slots of glyph indices below the number of glyphs the atlas was created
+ * for are kept in an array. Larger glyph indices are valid as well, their
+ * slots are kept in a hash table.
+ */
+#include <string.h>
+#include <glib.h>
+#include <cairo.h>
+
+#include "glyph.h"
+
+/* Number of cells per atlas row used to calculate the atlas width.
+ */
+#define ATLAS_CELLS_PER_ROW     32
+
+/* Initial number of shelves the atlas surface has room for.
+ */
+#define ATLAS_INITIAL_ROWS      8
+
+/* Maximum atlas surface size, limited by 16-bit slot coordinates.
+ */
+#define ATLAS_SIZE_MAX          G_MAXUINT16
+
+/* Gap in pixels between glyph bitmaps.
+ */
+#define ATLAS_PADDING           1
+
+/* New shelf heights are rounded up to multiples of this value to
+ * let glyphs of slightly different heights share a shelf.
+ */
+#define SHELF_HEIGHT_ALIGN      4
+
+typedef struct _GlyphShelf
+{
+  gint y;                       /* top position of the shelf */
+  gint height;                  /* shelf height in pixels */
+  gint x;                       /* first unused position in the shelf */
+} GlyphShelf;
+
+struct _GlyphAtlas
+{
+  cairo_surface_t *surface;     /* A8 surface keeping glyph bitmaps */
+  gint width;                   /* atlas surface width */
+  gint height;                  /* atlas surface height */
+
+  GlyphSlot *slots;             /* glyph slots indexed by glyph index */
+  gint n_glyphs;                /* number of glyph slots */
+  GHashTable *extra_slots;      /* slots of glyph indices beyond n_glyphs */
+
+  GlyphShelf *shelves;          /* shelves allocated so far */
+  gint n_shelves;               /* number of shelves */
+  gint bottom;                  /* first row below the last shelf */
+};
+
+GlyphAtlas*
+glyph_atlas_new (gint n_glyphs, gint cell_width, gint cell_height)
+{
+  GlyphAtlas *atlas;
+
+  g_return_val_if_fail (n_glyphs > 0, NULL);
+  g_return_val_if_fail (cell_width > 0 && cell_height > 0, NULL);
+
+  atlas = g_new0 (GlyphAtlas, 1);
+
+  atlas->width = MIN (ATLAS_CELLS_PER_ROW * (cell_width + ATLAS_PADDING), ATLAS_SIZE_MAX);
+  atlas->height = MIN (ATLAS_INITIAL_ROWS * (cell_height + ATLAS_PADDING), ATLAS_SIZE_MAX);
+  atlas->surface = cairo_image_surface_create (CAIRO_FORMAT_A8, atlas->width, atlas->height);
+
+  atlas->n_glyphs = n_glyphs;
+  atlas->slots = g_new0 (GlyphSlot, n_glyphs);
+  atlas->extra_slots = NULL;
+
+  atlas->shelves = NULL;
+  atlas->n_shelves = 0;
+  atlas->bottom = 0;
+
+  return atlas;
+}
+
+void
+glyph_atlas_free (GlyphAtlas *atlas)
+{
+  g_return_if_fail (atlas != NULL);
+
+  cairo_surface_destroy (atlas->surface);
+
+  if (atlas->extra_slots != NULL)
+    g_hash_table_destroy (atlas->extra_slots);
+
+  g_free (atlas->slots);
+  g_free (atlas->shelves);
+  g_free (atlas);
+}
+
+cairo_surface_t*
+glyph_atlas_get_surface (GlyphAtlas *atlas)
+{
+  g_return_val_if_fail (atlas != NULL, NULL);
+
+  return atlas->surface;
+}
+
+gsize
+glyph_atlas_get_size (GlyphAtlas *atlas)
+{
+  gsize n_slots;
+
+  g_return_val_if_fail (atlas != NULL, 0);
+
+  n_slots = atlas->n_glyphs;
+
+  if (atlas->extra_slots != NULL)
+    n_slots += g_hash_table_size (atlas->extra_slots);
+
+  return sizeof (GlyphAtlas) + n_slots * sizeof (GlyphSlot) +
+         atlas->n_shelves * sizeof (GlyphShelf) +
+         (gsize) cairo_image_surface_get_stride (atlas->surface) * atlas->height;
+}
+
+const GlyphSlot*
+glyph_atlas_lookup (GlyphAtlas *atlas, guint glyph_index)
+{
+  GlyphSlot *slot;
+
+  g_return_val_if_fail (atlas != NULL, NULL);
+
+  if (glyph_index < atlas->n_glyphs)
+    slot = atlas->slots + glyph_index;
+  else if (atlas->extra_slots != NULL)
+    slot = g_hash_table_lookup (atlas->extra_slots, GUINT_TO_POINTER (glyph_index));
+  else
+    slot = NULL;
+
+  if (slot == NULL)
+    return NULL;
+
+  return (slot->flags & GLYPH_SLOT_VALID) ? slot : NULL;
+}
+
+/* This helper doubles the atlas surface height, keeping its contents.
+ */
+static gboolean
+atlas_grow (GlyphAtlas *atlas)
+{
+  cairo_surface_t *surface;
+  guchar *src, *dst;
+  gint height, stride;
+
+  if (atlas->height >= ATLAS_SIZE_MAX)
+    return FALSE;
+
+  height = MIN (atlas->height * 2, ATLAS_SIZE_MAX);
+
+  g_debug ("growing glyph atlas %dx%d to %dx%d", atlas->width, atlas->height, atlas->width, height);
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_A8, atlas->width, height);
+
+  cairo_surface_flush (atlas->surface);
+
+  /* Both surfaces have the same width and format, so the strides match
+   * and the old pixels can be copied in one go.
+   */
+  src = cairo_image_surface_get_data (atlas->surface);
+  dst = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  g_assert (stride == cairo_image_surface_get_stride (atlas->surface));
+
+  memcpy (dst, src, stride * atlas->height);
+  cairo_surface_mark_dirty (surface);
+
+  cairo_surface_destroy (atlas->surface);
+
+  atlas->surface = surface;
+  atlas->height = height;
+
+  return TRUE;
+}
+
+/* This helper allocates a rectangle of the given size in the atlas and
+ * returns its position. It returns FALSE if the atlas can't grow any more.
+ */
+static gboolean
+atlas_allocate (GlyphAtlas *atlas, gint width, gint height, gint *x, gint *y)
+{
+  GlyphShelf *shelf;
+  gint i, shelf_height;
+
+  if (width + ATLAS_PADDING > atlas->width)
+    return FALSE;
+
+  /* Pick the lowest shelf the bitmap fits to waste as little space as possible.
+   */
+  shelf = NULL;
+
+  for (i = 0; i < atlas->n_shelves; i++)
+    {
+      GlyphShelf *s = atlas->shelves + i;
+
+      if (s->height >= height && s->x + width + ATLAS_PADDING <= atlas->width)
+        {
+          if (shelf == NULL || s->height < shelf->height)
+            shelf = s;
+        }
+    }
+
+  /* Open a new shelf at the bottom of the atlas.
+   */
+  if (shelf == NULL)
+    {
+      shelf_height = ((height + SHELF_HEIGHT_ALIGN - 1) / SHELF_HEIGHT_ALIGN) * SHELF_HEIGHT_ALIGN;
+
+      while (atlas->bottom + shelf_height + ATLAS_PADDING > atlas->height)
+        {
+          if (!atlas_grow (atlas))
+            return FALSE;
+        }
+
+      atlas->shelves = g_renew (GlyphShelf, atlas->shelves, atlas->n_shelves + 1);
+
+      shelf = atlas->shelves + atlas->n_shelves;
+      shelf->y = atlas->bottom;
+      shelf->height = shelf_height;
+      shelf->x = 0;
+
+      atlas->bottom += shelf_height + ATLAS_PADDING;
+      atlas->n_shelves++;
+    }
+
+  *x = shelf->x;
+  *y = shelf->y;
+
+  shelf->x += width + ATLAS_PADDING;
+
+  return TRUE;
+}
+
+const GlyphSlot*
+glyph_atlas_insert (GlyphAtlas   *atlas,
+                    guint         glyph_index,
+                    const guchar *buffer,
+                    gint          width,
+                    gint          height,
+                    gint          pitch,
+                    gint          left,
+                    gint          top)
+{
+  GlyphSlot *slot;
+  gint x, y;
+
+  g_return_val_if_fail (atlas != NULL, NULL);
+  g_return_val_if_fail (width >= 0 && height >= 0, NULL);
+
+  x = y = 0;
+
+  /* Empty bitmaps (e.g. a space glyph) take no room in the atlas.
+   */
+  if (width > 0 && height > 0)
+    {
+      guchar *dst;
+      gint i, stride;
+
+      g_return_val_if_fail (buffer != NULL, NULL);
+
+      if (!atlas_allocate (atlas, width, height, &x, &y))
+        {
+          g_warning ("glyph atlas is full, can't add glyph index %u", glyph_index);
+          return NULL;
+        }
+
+      cairo_surface_flush (atlas->surface);
+
+      stride = cairo_image_surface_get_stride (atlas->surface);
+      dst = cairo_image_surface_get_data (atlas->surface) + y*stride + x;
+
+      for (i = 0; i < height; i++)
+        {
+          memcpy (dst, buffer, width);
+          buffer += pitch;
+          dst += stride;
+        }
+
+      cairo_surface_mark_dirty_rectangle (atlas->surface, x, y, width, height);
+    }
+
+  if (glyph_index < atlas->n_glyphs)
+    slot = atlas->slots + glyph_index;
+  else
+    {
+      if (atlas->extra_slots == NULL)
+        atlas->extra_slots = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+      slot = g_hash_table_lookup (atlas->extra_slots, GUINT_TO_POINTER (glyph_index));
+
+      if (slot == NULL)
+        {
+          slot = g_new0 (GlyphSlot, 1);
+          g_hash_table_insert (atlas->extra_slots, GUINT_TO_POINTER (glyph_index), slot);
+        }
+    }
+
+  slot->x = x;
+  slot->y = y;
+  slot->width = width;
+  slot->height = height;
+  slot->left = left;
+  slot->top = top;
+  slot->flags = GLYPH_SLOT_VALID;
+
+  return slot;
+}
@@ -0,0 +1,55 @@
+/* Glyph atlas -- rasterised glyph bitmaps packed into a single surface.
+ */
+#ifndef __GLYPH_H__
+#define __GLYPH_H__
+
+#include <glib.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+
+typedef struct _GlyphAtlas GlyphAtlas;
+typedef struct _GlyphSlot GlyphSlot;
+
+/* Location and metrics of a glyph bitmap stored in the atlas surface.
+ */
+struct _GlyphSlot
+{
+  guint16 x;                    /* left position of the bitmap in the atlas */
+  guint16 y;                    /* top position of the bitmap in the atlas */
+  guint16 width;                /* bitmap width in pixels */
+  guint16 height;               /* bitmap height in pixels */
+  gint16 left;                  /* horizontal distance from the pen position */
+  gint16 top;                   /* vertical distance from the baseline to the top row */
+  guint16 flags;                /* GLYPH_SLOT_xxx flags */
+};
+
+#define GLYPH_SLOT_VALID        (1 << 0)
+
+GlyphAtlas*      glyph_atlas_new         (gint            n_glyphs,
+                                          gint            cell_width,
+                                          gint            cell_height);
+
+void             glyph_atlas_free        (GlyphAtlas     *atlas);
+
+const GlyphSlot* glyph_atlas_lookup      (GlyphAtlas     *atlas,
+                                          guint           glyph_index);
+
+const GlyphSlot* glyph_atlas_insert      (GlyphAtlas     *atlas,
+                                          guint           glyph_index,
+                                          const guchar   *buffer,
+                                          gint            width,
+                                          gint            height,
+                                          gint            pitch,
+                                          gint            left,
+                                          gint            top);
+
+cairo_surface_t* glyph_atlas_get_surface (GlyphAtlas     *atlas);
+
+gsize            glyph_atlas_get_size    (GlyphAtlas     *atlas);
+
+
+G_END_DECLS
+
+#endif /* __GLYPH_H__ */
@@ -0,0 +1,349 @@
+/* Glyph cache -- rasterised glyphs and font metrics stored on disk.
+ *
+ * Rendering the first screen takes opening the font, computing metrics and
+ * rasterising every glyph on it. The glyph cache keeps the result of that
+ * in a file under the user cache directory, one file per font file, face,
+ * size, resolution and load flags. The file is mapped into memory and its
+ * glyphs are copied to a new atlas, so a cached font is displayed without
+ * FreeType. A cache file of a font file modified since is ignored.
+ *
+ * The file is written in the native byte order, it is never shared between
+ * machines. It consists of a header, the font file path, glyph entries and
+ * glyph bitmaps, all aligned to 8 bytes.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <glib.h>
+#include <cairo.h>
+
+#include "glyph.h"
+#include "glyphcache.h"
+
+/* Cache file identification, the version is bumped on format changes.
+ */
+#define GLYPH_CACHE_MAGIC       0x4778744e      /* "NtxG" */
+#define GLYPH_CACHE_VERSION     1
+
+/* Name of the cache directory inside the user cache directory.
+ */
+#define GLYPH_CACHE_DIR         "ntx"
+
+/* This macro rounds up x to multiples of 8.
+ */
+#define ALIGN8(x)               (((x) + 7) & ~7)
+
+typedef struct _GlyphCacheHeader
+{
+  guint32 magic;                /* GLYPH_CACHE_MAGIC */
+  guint32 version;              /* GLYPH_CACHE_VERSION */
+  gint64 mtime;                 /* modification time of the font file */
+  gint64 file_size;             /* size of the font file */
+  gdouble dpi;                  /* screen resolution */
+  gint32 face_index;            /* font face index */
+  gint32 font_size;             /* font size in points */
+  gint32 load_flags;            /* FreeType glyph load flags */
+  gint32 n_glyphs;              /* number of glyphs in the face */
+  gint32 char_width;            /* character width in pixels */
+  gint32 char_height;           /* character height in pixels */
+  gint32 baseline;              /* baseline position in pixels */
+  guint32 path_len;             /* font file path length without trailing zero */
+  guint32 n_chars;              /* number of glyph entries */
+  guint32 reserved;
+} GlyphCacheHeader;
+
+typedef struct _GlyphCacheEntry
+{
+  guint32 chr;                  /* unicode character */
+  guint32 glyph_index;          /* glyph index of the character */
+  guint32 offset;               /* bitmap offset from the start of bitmaps */
+  guint16 width;                /* bitmap width, it is also the bitmap pitch */
+  guint16 height;               /* bitmap height */
+  gint16 left;                  /* horizontal distance from the pen position */
+  gint16 top;                   /* vertical distance from the baseline to the top row */
+  guint32 reserved;
+} GlyphCacheEntry;
+
+/* This helper returns the cache file path for the font.
+ */
+static gchar*
+cache_file_path (const GlyphCacheInfo *info)
+{
+  gchar *key, *checksum, *name, *path;
+
+  key = g_strdup_printf ("%s:%d:%d:%.3f:%d", info->font_file, info->face_index,
+                         info->font_size, info->dpi, info->load_flags);
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, key, -1);
+  name = g_strdup_printf ("glyphs-%s", checksum);
+
+  path = g_build_filename (g_get_user_cache_dir (), GLYPH_CACHE_DIR, name, NULL);
+
+  g_free (name);
+  g_free (checksum);
+  g_free (key);
+
+  return path;
+}
+
+/* This helper fills in the header fields identifying the font.
+ */
+static gboolean
+header_init (GlyphCacheHeader *header, const GlyphCacheInfo *info)
+{
+  struct stat st;
+
+  if (stat (info->font_file, &st) == -1)
+    return FALSE;
+
+  memset (header, 0, sizeof (*header));
+
+  header->magic = GLYPH_CACHE_MAGIC;
+  header->version = GLYPH_CACHE_VERSION;
+  header->mtime = st.st_mtime;
+  header->file_size = st.st_size;
+  header->dpi = info->dpi;
+  header->face_index = info->face_index;
+  header->font_size = info->font_size;
+  header->load_flags = info->load_flags;
+  header->path_len = strlen (info->font_file);
+
+  return TRUE;
+}
+
+/* Loads glyphs of the font described by info from its cache file. On
+ * success the font metrics are stored in info, a new atlas keeping the
+ * glyphs is returned in atlas and glyph indices of the cached characters
+ * are stored in char_map. It returns FALSE if there is no valid cache file.
+ */
+gboolean
+glyph_cache_load (GlyphCacheInfo  *info,
+                  GlyphAtlas     **atlas,
+                  guint32         *char_map,
+                  gint             char_map_size)
+{
+  GlyphCacheHeader expected;
+  const GlyphCacheHeader *header;
+  const GlyphCacheEntry *entries;
+  const guint8 *data, *bitmaps;
+  GMappedFile *file;
+  gchar *path;
+  gsize length, offset;
+  guint i;
+
+  g_return_val_if_fail (info != NULL, FALSE);
+  g_return_val_if_fail (info->font_file != NULL, FALSE);
+  g_return_val_if_fail (atlas != NULL, FALSE);
+  g_return_val_if_fail (char_map != NULL, FALSE);
+
+  if (!header_init (&expected, info))
+    return FALSE;
+
+  path = cache_file_path (info);
+  file = g_mapped_file_new (path, FALSE, NULL);
+
+  if (file == NULL)
+    {
+      g_free (path);
+      return FALSE;
+    }
+
+  data = (const guint8 *) g_mapped_file_get_contents (file);
+  length = g_mapped_file_get_length (file);
+
+  header = (const GlyphCacheHeader *) data;
+  offset = sizeof (GlyphCacheHeader);
+
+  if (length < offset ||
+      header->magic != expected.magic ||
+      header->version != expected.version ||
+      header->mtime != expected.mtime ||
+      header->file_size != expected.file_size ||
+      header->dpi != expected.dpi ||
+      header->face_index != expected.face_index ||
+      header->font_size != expected.font_size ||
+      header->load_flags != expected.load_flags ||
+      header->path_len != expected.path_len ||
+      header->n_glyphs <= 0 ||
+      header->char_width <= 0 ||
+      header->char_height <= 0)
+    goto invalid;
+
+  /* file names may collide on the checksum */
+  if (length < offset + header->path_len ||
+      memcmp (data + offset, info->font_file, header->path_len) != 0)
+    goto invalid;
+
+  offset += ALIGN8 (header->path_len + 1);
+
+  if (offset > length || header->n_chars > (length - offset) / sizeof (GlyphCacheEntry))
+    goto invalid;
+
+  entries = (const GlyphCacheEntry *) (data + offset);
+  offset += ALIGN8 (header->n_chars * sizeof (GlyphCacheEntry));
+
+  if (offset > length)
+    goto invalid;
+
+  bitmaps = data + offset;
+
+  for (i = 0; i < header->n_chars; i++)
+    {
+      const GlyphCacheEntry *entry = entries + i;
+
+      if (entry->glyph_index == 0 || entry->glyph_index >= header->n_glyphs ||
+          entry->offset + (gsize) entry->width * entry->height > length - offset)
+        goto invalid;
+    }
+
+  g_debug ("loading %u glyphs from %s", header->n_chars, path);
+
+  info->n_glyphs = header->n_glyphs;
+  info->char_width = header->char_width;
+  info->char_height = header->char_height;
+  info->baseline = header->baseline;
+
+  *atlas = glyph_atlas_new (header->n_glyphs, header->char_width, header->char_height);
+
+  for (i = 0; i < header->n_chars; i++)
+    {
+      const GlyphCacheEntry *entry = entries + i;
+
+      glyph_atlas_insert (*atlas, entry->glyph_index, bitmaps + entry->offset,
+                          entry->width, entry->height, entry->width,
+                          entry->left, entry->top);
+
+      if (entry->chr < char_map_size)
+        char_map[entry->chr] = entry->glyph_index;
+    }
+
+  g_mapped_file_unref (file);
+  g_free (path);
+
+  return TRUE;
+
+invalid:
+  g_debug ("ignoring stale glyph cache %s", path);
+
+  g_mapped_file_unref (file);
+  g_free (path);
+
+  return FALSE;
+}
+
+/* Stores glyphs of characters chars with glyph indices glyph_indices kept
+ * in the atlas and the font metrics to the cache file of the font described
+ * by info. Characters missing in the atlas are skipped.
+ */
+gboolean
+glyph_cache_save (const GlyphCacheInfo *info,
+                  GlyphAtlas           *atlas,
+                  const gunichar       *chars,
+                  const guint          *glyph_indices,
+                  gint                  n_chars)
+{
+  GlyphCacheHeader header;
+  GlyphCacheEntry *entries;
+  const guint8 *pixels;
+  GString *bitmaps;
+  GString *contents;
+  GError *error = NULL;
+  gchar *path, *dir;
+  gboolean result;
+  gint i, n, stride;
+
+  g_return_val_if_fail (info != NULL, FALSE);
+  g_return_val_if_fail (info->font_file != NULL, FALSE);
+  g_return_val_if_fail (atlas != NULL, FALSE);
+  g_return_val_if_fail (n_chars >= 0, FALSE);
+
+  if (!header_init (&header, info))
+    return FALSE;
+
+  header.n_glyphs = info->n_glyphs;
+  header.char_width = info->char_width;
+  header.char_height = info->char_height;
+  header.baseline = info->baseline;
+
+  cairo_surface_flush (glyph_atlas_get_surface (atlas));
+  pixels = cairo_image_surface_get_data (glyph_atlas_get_surface (atlas));
+  stride = cairo_image_surface_get_stride (glyph_atlas_get_surface (atlas));
+
+  /* Bitmaps are stored without padding, the pitch equals the width.
+   */
+  entries = g_new0 (GlyphCacheEntry, n_chars);
+  bitmaps = g_string_new (NULL);
+
+  for (i = 0, n = 0; i < n_chars; i++)
+    {
+      const GlyphSlot *slot = glyph_atlas_lookup (atlas, glyph_indices[i]);
+      GlyphCacheEntry *entry = entries + n;
+      gint y;
+
+      if (slot == NULL)
+        continue;
+
+      entry->chr = chars[i];
+      entry->glyph_index = glyph_indices[i];
+      entry->offset = bitmaps->len;
+      entry->width = slot->width;
+      entry->height = slot->height;
+      entry->left = slot->left;
+      entry->top = slot->top;
+
+      for (y = 0; y < slot->height; y++)
+        {
+          g_string_append_len (bitmaps, (const gchar *) pixels + (slot->y + y)*stride + slot->x,
+                               slot->width);
+        }
+
+      n++;
+    }
+
+  header.n_chars = n;
+
+  contents = g_string_new (NULL);
+
+  g_string_append_len (contents, (const gchar *) &header, sizeof (header));
+  g_string_append_len (contents, info->font_file, header.path_len);
+  g_string_set_size (contents, ALIGN8 (contents->len + 1));
+  g_string_append_len (contents, (const gchar *) entries, n * sizeof (GlyphCacheEntry));
+  g_string_set_size (contents, ALIGN8 (contents->len));
+  g_string_append_len (contents, bitmaps->str, bitmaps->len);
+
+  /* zero the gaps left by the alignment */
+  memset (contents->str + sizeof (header) + header.path_len, 0,
+          ALIGN8 (sizeof (header) + header.path_len + 1) - sizeof (header) - header.path_len);
+
+  path = cache_file_path (info);
+  dir = g_path_get_dirname (path);
+
+  /* The file is replaced atomically, so a concurrently starting console
+   * never maps a partially written file.
+   */
+  if (g_mkdir_with_parents (dir, 0700) == -1)
+    {
+      g_warning ("can't create glyph cache directory %s", dir);
+      result = FALSE;
+    }
+  else if (!g_file_set_contents (path, contents->str, contents->len, &error))
+    {
+      g_warning ("can't write glyph cache: %s", error->message);
+      g_error_free (error);
+      result = FALSE;
+    }
+  else
+    {
+      g_debug ("saved %d glyphs to %s", n, path);
+      result = TRUE;
+    }
+
+  g_free (dir);
+  g_free (path);
+  g_string_free (contents, TRUE);
+  g_string_free (bitmaps, TRUE);
+  g_free (entries);
+
+  return result;
+}
@@ -0,0 +1,46 @@
+/* Glyph cache -- rasterised glyphs and font metrics stored on disk.
+ */
+#ifndef __GLYPHCACHE_H__
+#define __GLYPHCACHE_H__
+
+#include <glib.h>
+
+#include "glyph.h"
+
+G_BEGIN_DECLS
+
+
+typedef struct _GlyphCacheInfo GlyphCacheInfo;
+
+/* Font the glyphs are rendered from and its metrics. The first group of
+ * fields identifies a cache file, the second one is stored in it.
+ */
+struct _GlyphCacheInfo
+{
+  const gchar *font_file;       /* path to font file */
+  gint face_index;              /* font face index in the file */
+  gint font_size;               /* font size in points */
+  gdouble dpi;                  /* screen resolution glyphs are rendered at */
+  gint load_flags;              /* FreeType glyph load flags */
+
+  gint n_glyphs;                /* number of glyphs in the face */
+  gint char_width;              /* character width in pixels */
+  gint char_height;             /* character height in pixels */
+  gint baseline;                /* baseline position in pixels */
+};
+
+gboolean glyph_cache_load (GlyphCacheInfo        *info,
+                           GlyphAtlas           **atlas,
+                           guint32               *char_map,
+                           gint                   char_map_size);
+
+gboolean glyph_cache_save (const GlyphCacheInfo  *info,
+                           GlyphAtlas            *atlas,
+                           const gunichar        *chars,
+                           const guint           *glyph_indices,
+                           gint                   n_chars);
+
+
+G_END_DECLS
+
+#endif /* __GLYPHCACHE_H__ */
@@ -1,6 +1,7 @@
 #include <gdk/gdkkeysyms.h>
 #define GETTEXT_PACKAGE "gtk20"
 #include <glib/gi18n-lib.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "fontsel.h"
@@ -14,6 +15,10 @@
 
 #define MAXMSGBUF 128
 
+/* Number of history lines scrolled by a mouse wheel step.
+ */
+#define SCROLL_WHEEL_LINES 3
+
 GtkWidget *main_window;
 GtkWidget *console;
 
@@ -29,6 +34,7 @@ static gulong console_key_press_id;
 static gulong console_primary_text_pasted_id;
 static gulong console_clipboard_text_pasted_id;
 static gulong console_scroll_id;
+static gulong console_history_scroll_id;
 
 extern gboolean key_press_event_cb (GtkWidget *widget, GdkEventKey *event, gpointer user_data);
 extern gboolean client_in_ios_mode ();
@@ -90,6 +96,27 @@ console_scroll_event_cb (GtkWidget *widget, GdkEventScroll *event, gpointer user
   return FALSE;
 }
 
+/* This callback scrolls the console history with the mouse wheel in
+ * TELNET mode, the wheel is sent to the server in non-TELNET mode. It is
+ * blocked while the mouse is enabled, the server gets the wheel then.
+ */
+static gboolean
+console_history_scroll_event_cb (GtkWidget *widget, GdkEventScroll *event, gpointer user_data)
+{
+  g_assert (widget != NULL && IS_CONSOLE (widget));
+  g_assert (event != NULL);
+
+  if (!client_in_telnet_mode ())
+    return FALSE;
+
+  if (event->direction == GDK_SCROLL_UP)
+    console_scroll_view (CONSOLE (widget), SCROLL_WHEEL_LINES);
+  else if (event->direction == GDK_SCROLL_DOWN)
+    console_scroll_view (CONSOLE (widget), -SCROLL_WHEEL_LINES);
+
+  return TRUE;
+}
+
 static gboolean
 console_text_pasted_cb (GtkWidget *widget, const gchar *s, gpointer user_data)
 {
@@ -162,10 +189,40 @@ console_key_press_event_cb (GtkWidget *widget, GdkEventKey *event, gpointer user
   g_return_val_if_fail (event != NULL, FALSE);
   g_return_val_if_fail (IS_CONSOLE (widget), FALSE);
 
+  /* Ctrl+plus and Ctrl+minus zoom the font. Ctrl+= and Ctrl+_ aren't taken,
+   * they reach the host.
+   */
+  if ((event->state & GDK_CONTROL_MASK) != 0)
+    {
+      switch (event->keyval)
+        {
+        case GDK_plus:
+        case GDK_KP_Add:
+          console_zoom (CONSOLE (widget), 1);
+          return TRUE;
+
+        case GDK_minus:
+        case GDK_KP_Subtract:
+          console_zoom (CONSOLE (widget), -1);
+          return TRUE;
+        }
+    }
+
   if (client_in_telnet_mode())
     {
       gunichar uc;
 
+      /* Shift+PgUp and Shift+PgDn page through the history.
+       */
+      if ((event->state & GDK_SHIFT_MASK) &&
+          (event->keyval == GDK_Page_Up || event->keyval == GDK_Page_Down))
+        {
+          gint page = console_get_height (CONSOLE (widget));
+
+          console_scroll_view (CONSOLE (widget), (event->keyval == GDK_Page_Up) ? page : -page);
+          return TRUE;
+        }
+
       switch (event->keyval)
         {
         case GDK_Return:
@@ -258,6 +315,7 @@ gui_mouse_enable ()
   g_signal_handler_unblock (G_OBJECT (console), console_button_release_id);
   g_signal_handler_unblock (G_OBJECT (console), console_motion_notify_id);
   g_signal_handler_unblock (G_OBJECT (console), console_scroll_id);
+  g_signal_handler_block (G_OBJECT (console), console_history_scroll_id);
 
   mouse_enabled = TRUE;
 }
@@ -272,6 +330,7 @@ gui_mouse_disable ()
   g_signal_handler_block (G_OBJECT (console), console_button_release_id);
   g_signal_handler_block (G_OBJECT (console), console_motion_notify_id);
   g_signal_handler_block (G_OBJECT (console), console_scroll_id);
+  g_signal_handler_unblock (G_OBJECT (console), console_history_scroll_id);
 
   mouse_enabled = FALSE;
 }
@@ -284,6 +343,14 @@ gui_init (gint *argc, gchar ***argv)
   GtkWidget *status_bar;
   //GtkWidget *menu_bar;
 
+  /* The console renders and loads fonts in thread pools, glib older than
+   * 2.32 needs threads initialized before they are used.
+   */
+#if !GLIB_CHECK_VERSION (2, 32, 0)
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+#endif
+
   gtk_set_locale ();
 
   gtk_init (argc, argv);
@@ -302,6 +369,10 @@ gui_init (gint *argc, gchar ***argv)
 
   g_signal_connect (G_OBJECT(window), "destroy", G_CALLBACK (gtk_main_quit), NULL);
 
+  /* the FreeType cache is created along with the console */
+  if (getenv ("ntx_freetype_cache_size") != NULL)
+    console_set_freetype_cache_size (atoi (getenv ("ntx_freetype_cache_size")));
+
   //console = console_new ();
   console = console_new_with_size (80, 25);
 
@@ -310,6 +381,9 @@ gui_init (gint *argc, gchar ***argv)
 
   console_set_cursor_timer (CONSOLE (console), CONSOLE_BLINK_MEDIUM);
 
+  /* keep the whole session output, older lines go to disk */
+  console_set_scrollback_spill (CONSOLE (console), TRUE);
+
   g_signal_connect (GTK_WIDGET (console), "size-allocate", G_CALLBACK (console_size_allocate_cb), NULL);
 
   console_key_press_id =
@@ -320,6 +394,8 @@ gui_init (gint *argc, gchar ***argv)
     g_signal_connect (GTK_WIDGET (console), "button-press-event", G_CALLBACK (console_button_event_cb), NULL);
   console_button_release_id =
     g_signal_connect (GTK_WIDGET (console), "button-release-event", G_CALLBACK (console_button_event_cb), NULL);
+  console_history_scroll_id =
+    g_signal_connect (GTK_WIDGET (console), "scroll-event", G_CALLBACK (console_history_scroll_event_cb), NULL);
   console_scroll_id =
     g_signal_connect (GTK_WIDGET (console), "scroll-event", G_CALLBACK (console_scroll_event_cb), NULL);
   console_primary_text_pasted_id = 
@@ -0,0 +1,415 @@
+/* Raster -- software drawing primitives for 32-bit RGB images.
+ *
+ * These routines don't depend on any mutable global state, so images owned
+ * by different threads can be drawn on concurrently. Glyph masks are blended
+ * by SSE2 or AVX2 kernels when the processor supports them, the kernel is
+ * chosen once at runtime.
+ */
+#include <string.h>
+#include <glib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RASTER_X86
+#endif
+
+#include "raster.h"
+
+/* Blends a row of n mask values with the color into dst pixels.
+ */
+typedef void (*BlendRowFunc) (guint32 *dst, const guint8 *mask, gint n, guint32 color);
+
+static void blend_row_scalar (guint32 *dst, const guint8 *mask, gint n, guint32 color);
+
+static BlendRowFunc blend_row = NULL;
+static RasterImpl blend_row_impl = RASTER_IMPL_SCALAR;
+
+/* This helper clips the box to the image bounds. It returns FALSE if
+ * nothing is left, otherwise dx and dy are set to the number of pixels
+ * cut from the left and top sides of the box.
+ */
+static gboolean
+clip_box (const RasterImage *image, gint *x, gint *y, gint *width, gint *height, gint *dx, gint *dy)
+{
+  gint x2, y2;
+
+  x2 = MIN (*x + *width, image->width);
+  y2 = MIN (*y + *height, image->height);
+
+  *dx = MAX (-*x, 0);
+  *dy = MAX (-*y, 0);
+
+  *x = MAX (*x, 0);
+  *y = MAX (*y, 0);
+
+  *width = x2 - *x;
+  *height = y2 - *y;
+
+  return (*width > 0 && *height > 0);
+}
+
+/* This macro mixes two 8-bit channel values using alpha value 0..255. The
+ * division by 255 is rounded and done with shifts, SIMD kernels use the
+ * same arithmetics so all kernels produce the same pixels.
+ */
+#define BLEND_CHANNEL(d, c, a) \
+  (((((d)*(255 - (a)) + (c)*(a) + 128) >> 8) + ((d)*(255 - (a)) + (c)*(a) + 128)) >> 8)
+
+/* This helper mixes a pixel with the color using alpha value 0..255.
+ */
+static guint32
+blend_pixel (guint32 dst, guint32 color, guint alpha)
+{
+  guint r, g, b;
+
+  r = BLEND_CHANNEL ((dst >> 16) & 0xff, (color >> 16) & 0xff, alpha);
+  g = BLEND_CHANNEL ((dst >> 8) & 0xff, (color >> 8) & 0xff, alpha);
+  b = BLEND_CHANNEL (dst & 0xff, color & 0xff, alpha);
+
+  return (r << 16) | (g << 8) | b;
+}
+
+static void
+blend_row_scalar (guint32 *dst, const guint8 *mask, gint n, guint32 color)
+{
+  gint i;
+
+  for (i = 0; i < n; i++)
+    {
+      guint alpha = mask[i];
+
+      if (alpha == 0xff)
+        dst[i] = color;
+      else if (alpha != 0)
+        dst[i] = blend_pixel (dst[i], color, alpha);
+    }
+}
+
+#ifdef RASTER_X86
+
+/* This SSE2 kernel blends 4 pixels at once. Each 8-bit channel is widened
+ * to 16 bits, which is enough to keep d*(255-a) + c*a + 128.
+ */
+__attribute__ ((target ("sse2")))
+static void
+blend_row_sse2 (guint32 *dst, const guint8 *mask, gint n, guint32 color)
+{
+  __m128i zero, c, c16, c255, rgb;
+  gint i;
+
+  zero = _mm_setzero_si128 ();
+  c = _mm_set1_epi32 (color & 0x00ffffff);
+  c16 = _mm_unpacklo_epi8 (c, zero);
+  c255 = _mm_set1_epi16 (255);
+  rgb = _mm_set1_epi32 (0x00ffffff);
+
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+      __m128i a, d, a_lo, a_hi, d_lo, d_hi, t_lo, t_hi;
+      guint32 m;
+
+      memcpy (&m, mask + i, sizeof (m));
+
+      if (m == 0)
+        continue;
+
+      if (m == 0xffffffff)
+        {
+          _mm_storeu_si128 ((__m128i *) (dst + i), c);
+          continue;
+        }
+
+      /* spread alpha of each pixel over its channel bytes */
+      a = _mm_cvtsi32_si128 (m);
+      a = _mm_unpacklo_epi8 (a, a);
+      a = _mm_unpacklo_epi16 (a, a);
+
+      d = _mm_loadu_si128 ((__m128i *) (dst + i));
+
+      a_lo = _mm_unpacklo_epi8 (a, zero);
+      a_hi = _mm_unpackhi_epi8 (a, zero);
+      d_lo = _mm_unpacklo_epi8 (d, zero);
+      d_hi = _mm_unpackhi_epi8 (d, zero);
+
+      t_lo = _mm_add_epi16 (_mm_mullo_epi16 (d_lo, _mm_sub_epi16 (c255, a_lo)),
+                            _mm_mullo_epi16 (c16, a_lo));
+      t_hi = _mm_add_epi16 (_mm_mullo_epi16 (d_hi, _mm_sub_epi16 (c255, a_hi)),
+                            _mm_mullo_epi16 (c16, a_hi));
+
+      t_lo = _mm_add_epi16 (t_lo, _mm_set1_epi16 (128));
+      t_hi = _mm_add_epi16 (t_hi, _mm_set1_epi16 (128));
+      t_lo = _mm_srli_epi16 (_mm_add_epi16 (t_lo, _mm_srli_epi16 (t_lo, 8)), 8);
+      t_hi = _mm_srli_epi16 (_mm_add_epi16 (t_hi, _mm_srli_epi16 (t_hi, 8)), 8);
+
+      d = _mm_and_si128 (_mm_packus_epi16 (t_lo, t_hi), rgb);
+
+      _mm_storeu_si128 ((__m128i *) (dst + i), d);
+    }
+
+  blend_row_scalar (dst + i, mask + i, n - i, color);
+}
+
+/* This AVX2 kernel is the SSE2 one widened to 8 pixels.
+ */
+__attribute__ ((target ("avx2")))
+static void
+blend_row_avx2 (guint32 *dst, const guint8 *mask, gint n, guint32 color)
+{
+  __m256i zero, c, c16, c255, c128, rgb;
+  gint i;
+
+  zero = _mm256_setzero_si256 ();
+  c = _mm256_set1_epi32 (color & 0x00ffffff);
+  c16 = _mm256_unpacklo_epi8 (c, zero);
+  c255 = _mm256_set1_epi16 (255);
+  c128 = _mm256_set1_epi16 (128);
+  rgb = _mm256_set1_epi32 (0x00ffffff);
+
+  for (i = 0; i + 8 <= n; i += 8)
+    {
+      __m256i a, d, a_lo, a_hi, d_lo, d_hi, t_lo, t_hi;
+      guint64 m;
+
+      memcpy (&m, mask + i, sizeof (m));
+
+      if (m == 0)
+        continue;
+
+      if (m == G_GUINT64_CONSTANT (0xffffffffffffffff))
+        {
+          _mm256_storeu_si256 ((__m256i *) (dst + i), c);
+          continue;
+        }
+
+      /* widen alpha to 32 bits per pixel and copy it to all channel bytes */
+      a = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *) (mask + i)));
+      a = _mm256_or_si256 (a, _mm256_slli_epi32 (a, 8));
+      a = _mm256_or_si256 (a, _mm256_slli_epi32 (a, 16));
+
+      d = _mm256_loadu_si256 ((__m256i *) (dst + i));
+
+      a_lo = _mm256_unpacklo_epi8 (a, zero);
+      a_hi = _mm256_unpackhi_epi8 (a, zero);
+      d_lo = _mm256_unpacklo_epi8 (d, zero);
+      d_hi = _mm256_unpackhi_epi8 (d, zero);
+
+      t_lo = _mm256_add_epi16 (_mm256_mullo_epi16 (d_lo, _mm256_sub_epi16 (c255, a_lo)),
+                               _mm256_mullo_epi16 (c16, a_lo));
+      t_hi = _mm256_add_epi16 (_mm256_mullo_epi16 (d_hi, _mm256_sub_epi16 (c255, a_hi)),
+                               _mm256_mullo_epi16 (c16, a_hi));
+
+      t_lo = _mm256_add_epi16 (t_lo, c128);
+      t_hi = _mm256_add_epi16 (t_hi, c128);
+      t_lo = _mm256_srli_epi16 (_mm256_add_epi16 (t_lo, _mm256_srli_epi16 (t_lo, 8)), 8);
+      t_hi = _mm256_srli_epi16 (_mm256_add_epi16 (t_hi, _mm256_srli_epi16 (t_hi, 8)), 8);
+
+      /* unpack and pack work within 128-bit lanes, so pixels stay in place */
+      d = _mm256_and_si256 (_mm256_packus_epi16 (t_lo, t_hi), rgb);
+
+      _mm256_storeu_si256 ((__m256i *) (dst + i), d);
+    }
+
+  /* The tail is blended by the scalar code, calling the SSE2 kernel here
+   * would mix legacy SSE and AVX instructions which is slow.
+   */
+  blend_row_scalar (dst + i, mask + i, n - i, color);
+}
+
+#endif /* RASTER_X86 */
+
+/* This helper returns the blending kernel, picking the fastest one the
+ * processor supports on the first call.
+ */
+static BlendRowFunc
+get_blend_row (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      if (blend_row == NULL)
+        {
+          if (raster_impl_supported (RASTER_IMPL_AVX2))
+            raster_set_impl (RASTER_IMPL_AVX2);
+          else if (raster_impl_supported (RASTER_IMPL_SSE2))
+            raster_set_impl (RASTER_IMPL_SSE2);
+          else
+            raster_set_impl (RASTER_IMPL_SCALAR);
+        }
+
+      g_debug ("raster: using %s glyph blending", raster_impl_name (blend_row_impl));
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return blend_row;
+}
+
+gboolean
+raster_impl_supported (RasterImpl impl)
+{
+  switch (impl)
+    {
+    case RASTER_IMPL_SCALAR:
+      return TRUE;
+
+#ifdef RASTER_X86
+    case RASTER_IMPL_SSE2:
+      return __builtin_cpu_supports ("sse2");
+
+    case RASTER_IMPL_AVX2:
+      return __builtin_cpu_supports ("avx2");
+#endif
+
+    default:
+      return FALSE;
+    }
+}
+
+const gchar*
+raster_impl_name (RasterImpl impl)
+{
+  switch (impl)
+    {
+    case RASTER_IMPL_SCALAR:
+      return "scalar";
+
+    case RASTER_IMPL_SSE2:
+      return "SSE2";
+
+    case RASTER_IMPL_AVX2:
+      return "AVX2";
+
+    default:
+      return "unknown";
+    }
+}
+
+gboolean
+raster_set_impl (RasterImpl impl)
+{
+  if (!raster_impl_supported (impl))
+    return FALSE;
+
+  switch (impl)
+    {
+#ifdef RASTER_X86
+    case RASTER_IMPL_SSE2:
+      blend_row = blend_row_sse2;
+      break;
+
+    case RASTER_IMPL_AVX2:
+      blend_row = blend_row_avx2;
+      break;
+#endif
+
+    default:
+      blend_row = blend_row_scalar;
+      break;
+    }
+
+  blend_row_impl = impl;
+
+  return TRUE;
+}
+
+RasterImpl
+raster_get_impl (void)
+{
+  get_blend_row ();
+
+  return blend_row_impl;
+}
+
+guint32
+raster_color (gdouble red, gdouble green, gdouble blue)
+{
+  guint r, g, b;
+
+  r = CLAMP (red, 0.0, 1.0) * 255.0 + 0.5;
+  g = CLAMP (green, 0.0, 1.0) * 255.0 + 0.5;
+  b = CLAMP (blue, 0.0, 1.0) * 255.0 + 0.5;
+
+  return (r << 16) | (g << 8) | b;
+}
+
+void
+raster_image_clip (RasterImage *sub, const RasterImage *image, gint x, gint y, gint width, gint height)
+{
+  gint dx, dy;
+
+  g_return_if_fail (sub != NULL && image != NULL);
+
+  if (!clip_box (image, &x, &y, &width, &height, &dx, &dy))
+    {
+      sub->data = image->data;
+      sub->width = 0;
+      sub->height = 0;
+      sub->stride = image->stride;
+      return;
+    }
+
+  sub->data = image->data + y*image->stride + x*4;
+  sub->width = width;
+  sub->height = height;
+  sub->stride = image->stride;
+}
+
+void
+raster_fill_rect (RasterImage *image, gint x, gint y, gint width, gint height, guint32 color)
+{
+  guint8 *row;
+  gint dx, dy, i, j;
+
+  g_return_if_fail (image != NULL);
+
+  if (!clip_box (image, &x, &y, &width, &height, &dx, &dy))
+    return;
+
+  row = image->data + y*image->stride + x*4;
+
+  for (i = 0; i < height; i++)
+    {
+      guint32 *p = (guint32 *) row;
+
+      for (j = 0; j < width; j++)
+        p[j] = color;
+
+      row += image->stride;
+    }
+}
+
+void
+raster_blend_mask (RasterImage  *image,
+                   gint          x,
+                   gint          y,
+                   const guint8 *mask,
+                   gint          mask_stride,
+                   gint          width,
+                   gint          height,
+                   guint32       color)
+{
+  BlendRowFunc blend;
+  guint8 *row;
+  gint dx, dy, i;
+
+  g_return_if_fail (image != NULL);
+
+  if (!clip_box (image, &x, &y, &width, &height, &dx, &dy))
+    return;
+
+  g_return_if_fail (mask != NULL);
+
+  blend = get_blend_row ();
+
+  row = image->data + y*image->stride + x*4;
+  mask += dy*mask_stride + dx;
+
+  for (i = 0; i < height; i++)
+    {
+      blend ((guint32 *) row, mask, width, color);
+
+      row += image->stride;
+      mask += mask_stride;
+    }
+}
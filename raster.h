@@ -0,0 +1,69 @@
+/* Raster -- software drawing primitives for 32-bit RGB images.
+ */
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+typedef struct _RasterImage RasterImage;
+
+/* Implementations of glyph mask blending.
+ */
+typedef enum
+{
+  RASTER_IMPL_SCALAR,
+  RASTER_IMPL_SSE2,
+  RASTER_IMPL_AVX2
+} RasterImpl;
+
+/* Pixel buffer in the cairo RGB24 format, each pixel is a native endian
+ * 32-bit word with the upper byte unused.
+ */
+struct _RasterImage
+{
+  guint8 *data;                 /* top left pixel */
+  gint width;                   /* image width in pixels */
+  gint height;                  /* image height in pixels */
+  gint stride;                  /* distance between rows in bytes */
+};
+
+guint32 raster_color       (gdouble            red,
+                            gdouble            green,
+                            gdouble            blue);
+
+void    raster_image_clip  (RasterImage       *sub,
+                            const RasterImage *image,
+                            gint               x,
+                            gint               y,
+                            gint               width,
+                            gint               height);
+
+void    raster_fill_rect   (RasterImage       *image,
+                            gint               x,
+                            gint               y,
+                            gint               width,
+                            gint               height,
+                            guint32            color);
+
+void    raster_blend_mask  (RasterImage       *image,
+                            gint               x,
+                            gint               y,
+                            const guint8      *mask,
+                            gint               mask_stride,
+                            gint               width,
+                            gint               height,
+                            guint32            color);
+
+
+gboolean    raster_impl_supported (RasterImpl  impl);
+const gchar* raster_impl_name     (RasterImpl  impl);
+gboolean    raster_set_impl       (RasterImpl  impl);
+RasterImpl  raster_get_impl       (void);
+
+
+G_END_DECLS
+
+#endif /* __RASTER_H__ */
@@ -0,0 +1,844 @@
+/* Scrollback -- history of lines scrolled off the console screen.
+ *
+ * The most recent lines are kept as they are, in the hot block. Once the
+ * hot block is full its lines are packed into a cold block, which takes a
+ * fraction of the memory: a line is stored as its length, runs of cells
+ * sharing colors and attributes, and characters as variable length numbers
+ * with runs of a repeated character collapsed. Lines are read back by
+ * unpacking the whole block, the last unpacked block is kept since history
+ * is viewed in consecutive lines.
+ *
+ * The number of lines is limited, the oldest lines are dropped first,
+ * unless the history spills to disk. Then the oldest lines are moved to a
+ * spill file instead, which is never shrunk. The spill file keeps lines in
+ * slots of a fixed size, so a line is found by its number, and it is mapped
+ * to memory, so viewed lines are paged in by the system and dropped from
+ * memory when it needs the pages. A line longer than the slots moves the
+ * spilled lines to a new file having wider slots.
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "scrollback.h"
+
+/* Number of lines packed together into a cold block.
+ */
+#define SCROLLBACK_BLOCK_LINES  256
+
+/* Packed characters starting with the escape byte are runs of a repeated
+ * character: the run length and the character follow the escape. Shorter
+ * runs are stored as single characters, so is the zero character.
+ */
+#define RUN_ESCAPE              0x00
+#define RUN_LENGTH_MIN          4
+
+/* Number of lines the spill file grows by.
+ */
+#define SPILL_GROW_LINES        16384
+
+/* Directory of spill files in the user cache directory. Spill files aren't
+ * created in the temporary directory, it is often kept in memory.
+ */
+#define SPILL_DIR               "ntx"
+
+/* This macro returns the size of a spill file slot of a line of n cells:
+ * the number of cells used followed by the cells.
+ */
+#define SPILL_STRIDE(n)         (sizeof (guint64) + (n) * sizeof (ScrollbackCell))
+
+typedef struct _ScrollbackBlock
+{
+  guint n_lines;                /* number of lines in the block */
+  guint first;                  /* number of leading lines dropped from the history */
+  guint8 *data;                 /* packed lines */
+  gsize size;                   /* size of packed lines in bytes */
+} ScrollbackBlock;
+
+struct _Scrollback
+{
+  gint max_lines;               /* maximum number of lines kept */
+  gint n_lines;                 /* number of lines in the history */
+
+  GQueue blocks;                /* cold blocks, the oldest first */
+  gint cold_lines;              /* number of lines in cold blocks */
+  gsize cold_size;              /* size of packed lines in cold blocks */
+
+  GArray *hot_cells;            /* cells of lines in the hot block */
+  GArray *hot_offsets;          /* line offsets in hot_cells followed by the end offset */
+
+  ScrollbackBlock *unpacked;    /* the last unpacked cold block */
+  GArray *unpacked_cells;       /* cells of lines of the unpacked block */
+  GArray *unpacked_offsets;     /* line offsets in unpacked_cells followed by the end offset */
+
+  gint spill_fd;                /* spill file, -1 if the oldest lines are dropped */
+  gint spill_cells;             /* number of cells kept of a spilled line */
+  gint spill_cells_max;         /* number of cells spill slots are widened up to */
+  gint spill_lines;             /* number of lines in the spill file */
+  gint spill_capacity;          /* number of lines the spill file has room for */
+  guint8 *spill_map;            /* the spill file mapped to memory */
+};
+
+/* This helper appends a variable length number to the buffer, 7 bits per
+ * byte with the high bit set in all bytes but the last one.
+ */
+static void
+put_varint (GByteArray *buf, guint32 value)
+{
+  guint8 byte;
+
+  while (value >= 0x80)
+    {
+      byte = (value & 0x7f) | 0x80;
+      g_byte_array_append (buf, &byte, 1);
+      value >>= 7;
+    }
+
+  byte = value;
+  g_byte_array_append (buf, &byte, 1);
+}
+
+/* This helper reads a variable length number advancing the pointer.
+ */
+static guint32
+get_varint (const guint8 **p)
+{
+  guint32 value;
+  gint shift;
+
+  value = 0;
+  shift = 0;
+
+  while (**p & 0x80)
+    {
+      value |= (guint32) (**p & 0x7f) << shift;
+      shift += 7;
+      ++*p;
+    }
+
+  value |= (guint32) **p << shift;
+  ++*p;
+
+  return value;
+}
+
+/* This helper appends n cells packed to the buffer.
+ */
+static void
+pack_line (GByteArray *buf, const ScrollbackCell *cells, gint n)
+{
+  gint i, run;
+
+  put_varint (buf, n);
+
+  /* runs of colors and attributes */
+  for (i = 0; i < n; i += run)
+    {
+      guint8 bytes[2];
+
+      for (run = 1; i + run < n; run++)
+        {
+          if (cells[i + run].color != cells[i].color || cells[i + run].attr != cells[i].attr)
+            break;
+        }
+
+      bytes[0] = cells[i].color;
+      bytes[1] = cells[i].attr;
+
+      put_varint (buf, run);
+      g_byte_array_append (buf, bytes, 2);
+    }
+
+  /* characters */
+  for (i = 0; i < n; i += run)
+    {
+      for (run = 1; i + run < n; run++)
+        {
+          if (cells[i + run].chr != cells[i].chr)
+            break;
+        }
+
+      if (run >= RUN_LENGTH_MIN || cells[i].chr == RUN_ESCAPE)
+        {
+          guint8 escape = RUN_ESCAPE;
+
+          g_byte_array_append (buf, &escape, 1);
+          put_varint (buf, run);
+          put_varint (buf, cells[i].chr);
+        }
+      else
+        {
+          gint j;
+
+          for (j = 0; j < run; j++)
+            put_varint (buf, cells[i].chr);
+        }
+    }
+}
+
+/* This helper appends cells of a packed line to the array and returns the
+ * position of the next packed line.
+ */
+static const guint8*
+unpack_line (const guint8 *p, GArray *cells)
+{
+  ScrollbackCell *line;
+  guint start, n, i, run;
+
+  n = get_varint (&p);
+
+  start = cells->len;
+  g_array_set_size (cells, start + n);
+  line = &g_array_index (cells, ScrollbackCell, start);
+
+  for (i = 0; i < n; i += run)
+    {
+      guint j;
+
+      run = get_varint (&p);
+
+      for (j = i; j < i + run && j < n; j++)
+        {
+          line[j].color = p[0];
+          line[j].attr = p[1];
+          line[j].reserved = 0;
+        }
+
+      p += 2;
+    }
+
+  for (i = 0; i < n; i += run)
+    {
+      gunichar chr;
+      guint j;
+
+      if (*p == RUN_ESCAPE)
+        {
+          ++p;
+          run = get_varint (&p);
+        }
+      else
+        run = 1;
+
+      chr = get_varint (&p);
+
+      for (j = i; j < i + run && j < n; j++)
+        line[j].chr = chr;
+    }
+
+  return p;
+}
+
+static void block_unpack (Scrollback *sb, ScrollbackBlock *block);
+
+/* This helper packs lines of the hot block into a new cold block.
+ */
+static void
+hot_pack (Scrollback *sb)
+{
+  ScrollbackBlock *block;
+  GByteArray *buf;
+  guint i, n_lines;
+
+  n_lines = sb->hot_offsets->len - 1;
+
+  if (n_lines == 0)
+    return;
+
+  buf = g_byte_array_new ();
+
+  for (i = 0; i < n_lines; i++)
+    {
+      guint offset = g_array_index (sb->hot_offsets, guint, i);
+      guint end = g_array_index (sb->hot_offsets, guint, i + 1);
+
+      pack_line (buf, &g_array_index (sb->hot_cells, ScrollbackCell, offset), end - offset);
+    }
+
+  block = g_new0 (ScrollbackBlock, 1);
+  block->n_lines = n_lines;
+  block->first = 0;
+  block->size = buf->len;
+  block->data = g_byte_array_free (buf, FALSE);
+
+  g_queue_push_tail (&sb->blocks, block);
+  sb->cold_lines += n_lines;
+  sb->cold_size += block->size;
+
+  g_array_set_size (sb->hot_cells, 0);
+  g_array_set_size (sb->hot_offsets, 1);
+}
+
+/* This helper frees the cold block.
+ */
+static void
+block_free (Scrollback *sb, ScrollbackBlock *block)
+{
+  if (sb->unpacked == block)
+    sb->unpacked = NULL;
+
+  g_free (block->data);
+  g_free (block);
+}
+
+/* This helper creates a new spill file in the user cache directory and
+ * removes it from the file system right away, it goes when it is closed.
+ * It returns the file descriptor or -1 on error.
+ */
+static gint
+spill_file_open (GError **error)
+{
+  gchar *dir, *path;
+  gint fd, saved_errno;
+
+  dir = g_build_filename (g_get_user_cache_dir (), SPILL_DIR, NULL);
+
+  if (g_mkdir_with_parents (dir, 0700) == -1)
+    {
+      saved_errno = errno;
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                   "can't create directory %s: %s", dir, g_strerror (saved_errno));
+      g_free (dir);
+      return -1;
+    }
+
+  path = g_build_filename (dir, "scrollback-XXXXXX", NULL);
+  fd = g_mkstemp (path);
+
+  if (fd == -1)
+    {
+      saved_errno = errno;
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                   "can't create file %s: %s", path, g_strerror (saved_errno));
+    }
+  else
+    g_unlink (path);
+
+  g_free (path);
+  g_free (dir);
+
+  return fd;
+}
+
+/* This helper grows the spill file and maps it again.
+ */
+static gboolean
+spill_grow (Scrollback *sb)
+{
+  gint capacity;
+  gsize size;
+  guint8 *map;
+
+  capacity = sb->spill_capacity + SPILL_GROW_LINES;
+  size = (gsize) capacity * SPILL_STRIDE (sb->spill_cells);
+
+  if (ftruncate (sb->spill_fd, size) == -1)
+    return FALSE;
+
+  map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sb->spill_fd, 0);
+
+  if (map == MAP_FAILED)
+    return FALSE;
+
+  if (sb->spill_map != NULL)
+    munmap (sb->spill_map, (gsize) sb->spill_capacity * SPILL_STRIDE (sb->spill_cells));
+
+  sb->spill_map = map;
+  sb->spill_capacity = capacity;
+
+  return TRUE;
+}
+
+/* This helper moves the spilled lines to a new spill file having slots of
+ * line_cells cells.
+ */
+static gboolean
+spill_widen (Scrollback *sb, gint line_cells)
+{
+  gsize size;
+  guint8 *map;
+  gint fd, i;
+
+  if (sb->spill_map == NULL)
+    {
+      sb->spill_cells = line_cells;
+      return TRUE;
+    }
+
+  fd = spill_file_open (NULL);
+
+  if (fd == -1)
+    return FALSE;
+
+  size = (gsize) sb->spill_capacity * SPILL_STRIDE (line_cells);
+
+  if (ftruncate (fd, size) == -1)
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (map == MAP_FAILED)
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  /* a slot is copied with its number of cells used */
+  for (i = 0; i < sb->spill_lines; i++)
+    {
+      memcpy (map + (gsize) i * SPILL_STRIDE (line_cells),
+              sb->spill_map + (gsize) i * SPILL_STRIDE (sb->spill_cells),
+              SPILL_STRIDE (sb->spill_cells));
+    }
+
+  munmap (sb->spill_map, (gsize) sb->spill_capacity * SPILL_STRIDE (sb->spill_cells));
+  close (sb->spill_fd);
+
+  sb->spill_fd = fd;
+  sb->spill_map = map;
+  sb->spill_cells = line_cells;
+
+  return TRUE;
+}
+
+/* This helper appends a line of n cells to the spill file. It returns
+ * FALSE if the file can't grow.
+ */
+static gboolean
+spill_line (Scrollback *sb, const ScrollbackCell *cells, gint n)
+{
+  guint8 *slot;
+
+  n = MIN (n, sb->spill_cells_max);
+
+  /* Widening copies all spilled lines, so the slots are at least doubled
+   * to keep it rare. Cells beyond the slot are cut off only if the slots
+   * can't be widened.
+   */
+  if (n > sb->spill_cells &&
+      !spill_widen (sb, MIN (MAX (n, 2 * sb->spill_cells), sb->spill_cells_max)))
+    {
+      g_warning ("can't widen scrollback spill file, cutting long lines");
+      n = sb->spill_cells;
+    }
+
+  if (sb->spill_lines == sb->spill_capacity && !spill_grow (sb))
+    {
+      g_warning ("can't grow scrollback spill file, dropping old lines");
+      scrollback_spill_disable (sb);
+      return FALSE;
+    }
+
+  slot = sb->spill_map + (gsize) sb->spill_lines * SPILL_STRIDE (sb->spill_cells);
+  *(guint64 *) slot = n;
+  memcpy (slot + sizeof (guint64), cells, n * sizeof (ScrollbackCell));
+
+  sb->spill_lines++;
+
+  return TRUE;
+}
+
+/* This helper moves n lines of the cold block starting from the first line
+ * of the history to the spill file.
+ */
+static void
+spill_block (Scrollback *sb, ScrollbackBlock *block, guint n)
+{
+  guint i;
+
+  block_unpack (sb, block);
+
+  for (i = block->first; i < block->first + n && sb->spill_fd != -1; i++)
+    {
+      guint offset = g_array_index (sb->unpacked_offsets, guint, i);
+      guint end = g_array_index (sb->unpacked_offsets, guint, i + 1);
+
+      spill_line (sb, &g_array_index (sb->unpacked_cells, ScrollbackCell, offset), end - offset);
+    }
+}
+
+/* This helper drops the oldest lines beyond the maximum number of lines,
+ * they are moved to the spill file if there is one.
+ */
+static void
+trim (Scrollback *sb)
+{
+  while (sb->n_lines > sb->max_lines)
+    {
+      ScrollbackBlock *block;
+      guint excess;
+
+      excess = sb->n_lines - sb->max_lines;
+      block = g_queue_peek_head (&sb->blocks);
+
+      if (block != NULL)
+        {
+          guint n = block->n_lines - block->first;
+
+          if (sb->spill_fd != -1)
+            spill_block (sb, block, MIN (n, excess));
+
+          if (n <= excess)
+            {
+              /* the whole block goes */
+              g_queue_pop_head (&sb->blocks);
+              sb->cold_size -= block->size;
+              block_free (sb, block);
+            }
+          else
+            {
+              /* lines in the middle of a block can't be freed, they are
+               * skipped until the rest of the block goes
+               */
+              block->first += excess;
+              n = excess;
+            }
+
+          sb->cold_lines -= n;
+          sb->n_lines -= n;
+        }
+      else
+        {
+          guint offset, i;
+
+          /* The hot block holds all lines, it happens only when there are
+           * less lines allowed than a block has.
+           */
+          for (i = 0; i < excess && sb->spill_fd != -1; i++)
+            {
+              guint start = g_array_index (sb->hot_offsets, guint, i);
+              guint end = g_array_index (sb->hot_offsets, guint, i + 1);
+
+              spill_line (sb, &g_array_index (sb->hot_cells, ScrollbackCell, start), end - start);
+            }
+
+          offset = g_array_index (sb->hot_offsets, guint, excess);
+          g_array_remove_range (sb->hot_cells, 0, offset);
+          g_array_remove_range (sb->hot_offsets, 0, excess);
+
+          for (i = 0; i < sb->hot_offsets->len; i++)
+            g_array_index (sb->hot_offsets, guint, i) -= offset;
+
+          sb->n_lines -= excess;
+        }
+    }
+}
+
+/* This helper unpacks all lines of the cold block unless the block is
+ * already unpacked.
+ */
+static void
+block_unpack (Scrollback *sb, ScrollbackBlock *block)
+{
+  const guint8 *p;
+  guint i;
+
+  if (sb->unpacked == block)
+    return;
+
+  g_array_set_size (sb->unpacked_cells, 0);
+  g_array_set_size (sb->unpacked_offsets, 0);
+
+  p = block->data;
+
+  for (i = 0; i < block->n_lines; i++)
+    {
+      g_array_append_val (sb->unpacked_offsets, sb->unpacked_cells->len);
+      p = unpack_line (p, sb->unpacked_cells);
+    }
+
+  g_array_append_val (sb->unpacked_offsets, sb->unpacked_cells->len);
+
+  sb->unpacked = block;
+}
+
+/* Creates new empty history keeping at most max_lines lines.
+ */
+Scrollback*
+scrollback_new (gint max_lines)
+{
+  Scrollback *sb;
+  guint zero = 0;
+
+  g_return_val_if_fail (max_lines >= 0, NULL);
+
+  sb = g_new0 (Scrollback, 1);
+
+  sb->max_lines = max_lines;
+  sb->n_lines = 0;
+
+  g_queue_init (&sb->blocks);
+  sb->cold_lines = 0;
+  sb->cold_size = 0;
+
+  sb->hot_cells = g_array_new (FALSE, FALSE, sizeof (ScrollbackCell));
+  sb->hot_offsets = g_array_new (FALSE, FALSE, sizeof (guint));
+  g_array_append_val (sb->hot_offsets, zero);
+
+  sb->unpacked = NULL;
+  sb->unpacked_cells = g_array_new (FALSE, FALSE, sizeof (ScrollbackCell));
+  sb->unpacked_offsets = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  sb->spill_fd = -1;
+  sb->spill_cells = 0;
+  sb->spill_cells_max = 0;
+  sb->spill_lines = 0;
+  sb->spill_capacity = 0;
+  sb->spill_map = NULL;
+
+  return sb;
+}
+
+void
+scrollback_free (Scrollback *sb)
+{
+  g_return_if_fail (sb != NULL);
+
+  scrollback_clear (sb);
+  scrollback_spill_disable (sb);
+
+  g_array_free (sb->hot_cells, TRUE);
+  g_array_free (sb->hot_offsets, TRUE);
+  g_array_free (sb->unpacked_cells, TRUE);
+  g_array_free (sb->unpacked_offsets, TRUE);
+
+  g_free (sb);
+}
+
+/* Drops all lines of the history.
+ */
+void
+scrollback_clear (Scrollback *sb)
+{
+  ScrollbackBlock *block;
+
+  g_return_if_fail (sb != NULL);
+
+  while ((block = g_queue_pop_head (&sb->blocks)) != NULL)
+    block_free (sb, block);
+
+  g_array_set_size (sb->hot_cells, 0);
+  g_array_set_size (sb->hot_offsets, 1);
+
+  g_array_set_size (sb->unpacked_cells, 0);
+  g_array_set_size (sb->unpacked_offsets, 0);
+
+  sb->n_lines = 0;
+  sb->cold_lines = 0;
+  sb->cold_size = 0;
+
+  /* the spill file is reused from its start */
+  sb->spill_lines = 0;
+}
+
+void
+scrollback_set_max_lines (Scrollback *sb, gint max_lines)
+{
+  g_return_if_fail (sb != NULL);
+  g_return_if_fail (max_lines >= 0);
+
+  sb->max_lines = max_lines;
+  trim (sb);
+}
+
+gint
+scrollback_get_max_lines (Scrollback *sb)
+{
+  g_return_val_if_fail (sb != NULL, -1);
+
+  return sb->max_lines;
+}
+
+/* Returns the number of lines in the history, spilled lines included.
+ */
+gint
+scrollback_get_n_lines (Scrollback *sb)
+{
+  g_return_val_if_fail (sb != NULL, -1);
+
+  return sb->n_lines + sb->spill_lines;
+}
+
+/* Makes the history move its oldest lines to a new spill file instead of
+ * dropping them. Spill file slots have room for line_cells cells, they are
+ * widened for longer lines up to max_line_cells cells, longer lines are
+ * cut. The file is made in the user cache directory and removed from the
+ * file system right away, it goes with the history.
+ */
+gboolean
+scrollback_spill_enable (Scrollback *sb, gint line_cells, gint max_line_cells, GError **error)
+{
+  gint fd;
+
+  g_return_val_if_fail (sb != NULL, FALSE);
+  g_return_val_if_fail (line_cells > 0 && line_cells <= max_line_cells, FALSE);
+
+  if (sb->spill_fd != -1)
+    return TRUE;
+
+  fd = spill_file_open (error);
+
+  if (fd == -1)
+    return FALSE;
+
+  sb->spill_fd = fd;
+  sb->spill_cells = line_cells;
+  sb->spill_cells_max = max_line_cells;
+  sb->spill_lines = 0;
+  sb->spill_capacity = 0;
+  sb->spill_map = NULL;
+
+  return TRUE;
+}
+
+/* Drops spilled lines along with the spill file, the oldest lines are
+ * dropped from then on.
+ */
+void
+scrollback_spill_disable (Scrollback *sb)
+{
+  g_return_if_fail (sb != NULL);
+
+  if (sb->spill_fd == -1)
+    return;
+
+  if (sb->spill_map != NULL)
+    munmap (sb->spill_map, (gsize) sb->spill_capacity * SPILL_STRIDE (sb->spill_cells));
+
+  close (sb->spill_fd);
+
+  sb->spill_fd = -1;
+  sb->spill_cells = 0;
+  sb->spill_cells_max = 0;
+  sb->spill_lines = 0;
+  sb->spill_capacity = 0;
+  sb->spill_map = NULL;
+}
+
+gboolean
+scrollback_spill_is_enabled (Scrollback *sb)
+{
+  g_return_val_if_fail (sb != NULL, FALSE);
+
+  return sb->spill_fd != -1;
+}
+
+/* Returns the number of bytes taken by the history.
+ */
+gsize
+scrollback_get_size (Scrollback *sb)
+{
+  g_return_val_if_fail (sb != NULL, 0);
+
+  return sizeof (Scrollback) +
+    sb->cold_size + g_queue_get_length (&sb->blocks) * sizeof (ScrollbackBlock) +
+    (sb->hot_cells->len + sb->unpacked_cells->len) * sizeof (ScrollbackCell) +
+    (sb->hot_offsets->len + sb->unpacked_offsets->len) * sizeof (guint);
+}
+
+/* Appends a line of n_cells cells to the history as its most recent line.
+ */
+void
+scrollback_push (Scrollback *sb, const ScrollbackCell *cells, gint n_cells)
+{
+  g_return_if_fail (sb != NULL);
+  g_return_if_fail (cells != NULL || n_cells == 0);
+  g_return_if_fail (n_cells >= 0);
+
+  if (sb->max_lines == 0)
+    return;
+
+  g_array_append_vals (sb->hot_cells, cells, n_cells);
+  g_array_append_val (sb->hot_offsets, sb->hot_cells->len);
+  sb->n_lines++;
+
+  if (sb->hot_offsets->len - 1 >= SCROLLBACK_BLOCK_LINES)
+    hot_pack (sb);
+
+  trim (sb);
+}
+
+/* Copies at most max_cells cells of the line n of the history to cells,
+ * lines are counted from the most recent one. It returns the number of
+ * cells copied, cells of the line beyond it are left intact.
+ */
+gint
+scrollback_get_line (Scrollback *sb, gint n, ScrollbackCell *cells, gint max_cells)
+{
+  const ScrollbackCell *line;
+  GArray *line_cells, *line_offsets;
+  guint offset, end;
+  gint index;
+
+  g_return_val_if_fail (sb != NULL, 0);
+  g_return_val_if_fail (n >= 0 && n < sb->n_lines + sb->spill_lines, 0);
+  g_return_val_if_fail (cells != NULL, 0);
+
+  /* Spilled lines are the oldest ones, they are read from their slots.
+   */
+  if (n >= sb->n_lines)
+    {
+      const guint8 *slot;
+
+      index = sb->spill_lines - 1 - (n - sb->n_lines);
+      slot = sb->spill_map + (gsize) index * SPILL_STRIDE (sb->spill_cells);
+
+      n = MIN ((gint) *(const guint64 *) slot, max_cells);
+      memcpy (cells, slot + sizeof (guint64), n * sizeof (ScrollbackCell));
+
+      return n;
+    }
+
+  /* line index from the oldest line in memory */
+  index = sb->n_lines - 1 - n;
+
+  if (index >= sb->cold_lines)
+    {
+      index -= sb->cold_lines;
+      line_cells = sb->hot_cells;
+      line_offsets = sb->hot_offsets;
+    }
+  else
+    {
+      ScrollbackBlock *block = NULL;
+      GList *link;
+
+      /* Recent lines are viewed most, blocks are searched from the most
+       * recent one.
+       */
+      index = sb->cold_lines - 1 - index;
+
+      for (link = sb->blocks.tail; link != NULL; link = link->prev)
+        {
+          block = link->data;
+
+          if (index < (gint) (block->n_lines - block->first))
+            break;
+
+          index -= block->n_lines - block->first;
+        }
+
+      g_assert (link != NULL);
+
+      block_unpack (sb, block);
+      index = block->n_lines - 1 - index;
+      line_cells = sb->unpacked_cells;
+      line_offsets = sb->unpacked_offsets;
+    }
+
+  offset = g_array_index (line_offsets, guint, index);
+  end = g_array_index (line_offsets, guint, index + 1);
+  line = &g_array_index (line_cells, ScrollbackCell, offset);
+
+  n = MIN ((gint) (end - offset), max_cells);
+  memcpy (cells, line, n * sizeof (ScrollbackCell));
+
+  return n;
+}
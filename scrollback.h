@@ -0,0 +1,61 @@
+/* Scrollback -- history of lines scrolled off the console screen.
+ */
+#ifndef __SCROLLBACK_H__
+#define __SCROLLBACK_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+typedef struct _Scrollback Scrollback;
+typedef struct _ScrollbackCell ScrollbackCell;
+
+/* Character cell of a history line, it has the layout of console screen
+ * cells, so screen rows are stored without conversion.
+ */
+struct _ScrollbackCell
+{
+  gunichar chr;                 /* unicode symbol */
+  guint8 color;                 /* foreground and background palette indices */
+  guint8 attr;                  /* character attributes */
+  guint16 reserved;             /* unused, always zero */
+};
+
+Scrollback*  scrollback_new            (gint                   max_lines);
+
+void         scrollback_free           (Scrollback            *sb);
+
+void         scrollback_clear          (Scrollback            *sb);
+
+void         scrollback_set_max_lines  (Scrollback            *sb,
+                                        gint                   max_lines);
+
+gint         scrollback_get_max_lines  (Scrollback            *sb);
+
+gint         scrollback_get_n_lines    (Scrollback            *sb);
+
+gboolean     scrollback_spill_enable   (Scrollback            *sb,
+                                        gint                   line_cells,
+                                        gint                   max_line_cells,
+                                        GError               **error);
+
+void         scrollback_spill_disable  (Scrollback            *sb);
+
+gboolean     scrollback_spill_is_enabled (Scrollback          *sb);
+
+gsize        scrollback_get_size       (Scrollback            *sb);
+
+void         scrollback_push           (Scrollback            *sb,
+                                        const ScrollbackCell  *cells,
+                                        gint                   n_cells);
+
+gint         scrollback_get_line       (Scrollback            *sb,
+                                        gint                   n,
+                                        ScrollbackCell        *cells,
+                                        gint                   max_cells);
+
+
+G_END_DECLS
+
+#endif /* __SCROLLBACK_H__ */
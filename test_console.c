@@ -788,6 +788,67 @@ console_clear_dialog (GtkWidget *widget, gpointer user_data)
   gtk_widget_destroy (dialog);
 }
 
+/* This helper writes the test pattern the way a client repaints the screen,
+ * moving the cursor to the start of every row and writing the row out. The
+ * last column is left alone, so the cursor never wraps and scrolls.
+ */
+static void
+repaint_screen (Console *console)
+{
+  gint width, height, x, y;
+
+  width = console_get_width (console);
+  height = console_get_height (console);
+
+  for (y = 0; y < height; y++)
+    {
+      console_move_cursor_to (console, 0, y);
+
+      for (x = 0; x < width - 1; x++)
+        console_put_char (console, 'A' + (x + y) % 26);
+    }
+
+  /* paint the frame */
+  while (gtk_events_pending ())
+    gtk_main_iteration ();
+}
+
+/* An identical repaint of the screen must move the cursor only, no cell
+ * may be rendered again.
+ */
+static void
+console_repaint_check (GtkWidget *widget, gpointer user_data)
+{
+  ConsoleStats before, after;
+  Console *console;
+  gint max_fps;
+
+  g_return_if_fail (user_data != NULL);
+  g_return_if_fail (IS_CONSOLE (user_data));
+
+  console = CONSOLE (user_data);
+
+  /* frames are painted at once, not by the frame timer */
+  max_fps = console_get_max_fps (console);
+  console_set_max_fps (console, 0);
+
+  repaint_screen (console);
+  console_get_stats (console, &before);
+
+  repaint_screen (console);
+  console_get_stats (console, &after);
+
+  console_set_max_fps (console, max_fps);
+
+  g_message ("identical repaint: %" G_GUINT64_FORMAT " cells rendered, %" G_GUINT64_FORMAT " writes suppressed",
+             after.cells_rendered - before.cells_rendered,
+             after.writes_suppressed - before.writes_suppressed);
+
+  g_assert (after.cells_rendered == before.cells_rendered);
+  g_assert (after.writes_suppressed - before.writes_suppressed ==
+            (console_get_width (console) - 1) * console_get_height (console));
+}
+
 static gboolean
 console_button_press_event (GtkWidget *widget, GdkEventButton *event, gpointer user_data)
 {
@@ -965,6 +1026,14 @@ main (int argc, char *argv[])
   GSList *group = NULL;
   gint i;
 
+  /* The console renders and loads fonts in thread pools, glib older than
+   * 2.32 needs threads initialized before they are used.
+   */
+#if !GLIB_CHECK_VERSION (2, 32, 0)
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+#endif
+
   gtk_set_locale ();
 
   gtk_init (&argc, &argv);
@@ -1094,6 +1163,10 @@ main (int argc, char *argv[])
   g_signal_connect (G_OBJECT (menu_item), "activate", (GCallback) console_clear_dialog, console);
   gtk_menu_shell_append (GTK_MENU_SHELL (menu), menu_item);
 
+  menu_item = gtk_menu_item_new_with_label (_("Check identical repaint"));
+  g_signal_connect (G_OBJECT (menu_item), "activate", (GCallback) console_repaint_check, console);
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), menu_item);
+
   /* console screen size and color menu */
 
   menu_item = gtk_menu_item_new_with_label ("Screen");
@@ -0,0 +1,185 @@
+/* Tests of the glyph atlas.
+ *
+ * Glyph bitmaps of various sizes are inserted until the atlas grows a few
+ * times, then every glyph must be found with its metrics and its bitmap
+ * intact, and no two bitmaps may overlap.
+ */
+#include <string.h>
+#include <glib.h>
+#include <cairo.h>
+
+#include "glyph.h"
+
+#define N_GLYPHS        64
+#define N_INSERTED      600
+#define CELL_WIDTH      10
+#define CELL_HEIGHT     20
+
+/* Glyph indices of fallback fonts, beyond the glyphs of the atlas font.
+ */
+#define FALLBACK_INDEX(n, i)    (((n) << 16) | (i))
+
+/* This helper returns the size of the test glyph number i.
+ */
+static void
+glyph_size (guint i, gint *width, gint *height)
+{
+  *width = 1 + (i * 7) % CELL_WIDTH;
+  *height = 1 + (i * 11) % (CELL_HEIGHT + 5);
+}
+
+/* This helper returns the value of the pixel of the test glyph number i.
+ */
+static guint8
+glyph_pixel (guint i, gint x, gint y)
+{
+  return ((i * 31 + x * 7 + y * 13) & 0xff) | 1;
+}
+
+/* This helper returns the glyph index of the test glyph number i, the
+ * atlas font glyphs and fallback font ones alternate.
+ */
+static guint
+glyph_index (guint i)
+{
+  return (i % 2 == 0) ? i / 2 % N_GLYPHS : FALLBACK_INDEX (1 + i % 3, i);
+}
+
+static void
+insert_glyph (GlyphAtlas *atlas, guint i)
+{
+  const GlyphSlot *slot;
+  guint8 buffer[(CELL_WIDTH + 3) * (CELL_HEIGHT + 5)];
+  gint width, height, pitch, x, y;
+
+  glyph_size (i, &width, &height);
+  pitch = width + 3;
+
+  for (y = 0; y < height; y++)
+    {
+      for (x = 0; x < pitch; x++)
+        buffer[y*pitch + x] = (x < width) ? glyph_pixel (i, x, y) : 0xff;
+    }
+
+  slot = glyph_atlas_insert (atlas, glyph_index (i), buffer, width, height, pitch, i % 3, height - i % 4);
+
+  g_assert (slot != NULL);
+  g_assert (slot == glyph_atlas_lookup (atlas, glyph_index (i)));
+}
+
+/* This helper checks the test glyph number i is in the atlas. Pixels of
+ * its bitmap are marked in the map of used atlas pixels.
+ */
+static void
+check_glyph (GlyphAtlas *atlas, guint i, guint8 *used)
+{
+  cairo_surface_t *surface;
+  const GlyphSlot *slot;
+  const guint8 *data;
+  gint width, height, stride, x, y;
+
+  glyph_size (i, &width, &height);
+
+  slot = glyph_atlas_lookup (atlas, glyph_index (i));
+
+  g_assert (slot != NULL);
+  g_assert (slot->flags & GLYPH_SLOT_VALID);
+  g_assert (slot->width == width && slot->height == height);
+  g_assert (slot->left == i % 3 && slot->top == height - i % 4);
+
+  surface = glyph_atlas_get_surface (atlas);
+  cairo_surface_flush (surface);
+
+  data = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  g_assert (slot->x + width <= cairo_image_surface_get_width (surface));
+  g_assert (slot->y + height <= cairo_image_surface_get_height (surface));
+
+  for (y = 0; y < height; y++)
+    {
+      for (x = 0; x < width; x++)
+        {
+          gint pos = (slot->y + y) * stride + slot->x + x;
+
+          g_assert (data[pos] == glyph_pixel (i, x, y));
+          g_assert (used[pos] == 0);
+          used[pos] = 1;
+        }
+    }
+}
+
+/* Glyphs keep their bitmaps while the atlas grows, glyphs inserted again
+ * replace the old ones.
+ */
+static void
+test_insert (void)
+{
+  cairo_surface_t *surface;
+  GlyphAtlas *atlas;
+  guint8 *used;
+  gint i;
+
+  atlas = glyph_atlas_new (N_GLYPHS, CELL_WIDTH, CELL_HEIGHT);
+
+  for (i = 0; i < N_INSERTED; i++)
+    insert_glyph (atlas, i);
+
+  surface = glyph_atlas_get_surface (atlas);
+  used = g_malloc0 (cairo_image_surface_get_stride (surface) *
+                    cairo_image_surface_get_height (surface));
+
+  /* glyph indices below N_GLYPHS were inserted several times, the last
+   * insertion counts
+   */
+  for (i = 0; i < N_INSERTED; i++)
+    {
+      if (i % 2 == 0 && i + 2 * N_GLYPHS < N_INSERTED)
+        continue;
+
+      check_glyph (atlas, i, used);
+    }
+
+  /* the atlas grew */
+  g_assert (cairo_image_surface_get_height (surface) > 8 * (CELL_HEIGHT + 1));
+
+  g_free (used);
+  glyph_atlas_free (atlas);
+}
+
+/* Empty bitmaps are valid glyphs taking no room, unknown glyphs aren't
+ * found.
+ */
+static void
+test_lookup (void)
+{
+  const GlyphSlot *slot;
+  GlyphAtlas *atlas;
+
+  atlas = glyph_atlas_new (N_GLYPHS, CELL_WIDTH, CELL_HEIGHT);
+
+  g_assert (glyph_atlas_lookup (atlas, 3) == NULL);
+  g_assert (glyph_atlas_lookup (atlas, FALLBACK_INDEX (1, 3)) == NULL);
+
+  slot = glyph_atlas_insert (atlas, 3, NULL, 0, 0, 0, 0, 0);
+  g_assert (slot != NULL && slot->width == 0 && slot->height == 0);
+  g_assert (glyph_atlas_lookup (atlas, 3) == slot);
+
+  slot = glyph_atlas_insert (atlas, FALLBACK_INDEX (1, 3), NULL, 0, 0, 0, 0, 0);
+  g_assert (slot != NULL);
+  g_assert (glyph_atlas_lookup (atlas, FALLBACK_INDEX (1, 3)) == slot);
+  g_assert (glyph_atlas_lookup (atlas, FALLBACK_INDEX (2, 3)) == NULL);
+
+  glyph_atlas_free (atlas);
+}
+
+int
+main (int argc, char *argv[])
+{
+  test_insert ();
+  test_lookup ();
+
+  g_print ("glyph: all tests passed\n");
+
+  return 0;
+}
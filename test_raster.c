@@ -0,0 +1,255 @@
+/* Tests of the software drawing primitives.
+ *
+ * Every glyph blending kernel the processor supports must produce the same
+ * pixels as the scalar one, which blends with exactly rounded arithmetics.
+ * Drawing is clipped to the image, pixels around it are never touched.
+ */
+#include <string.h>
+#include <glib.h>
+
+#include "raster.h"
+
+#define IMAGE_WIDTH     64
+#define IMAGE_HEIGHT    16
+#define MASK_WIDTH      48
+#define MASK_HEIGHT     8
+
+/* Width of the guard border around test images in pixels.
+ */
+#define BORDER          8
+#define BORDER_PIXEL    0xdeadbeef
+
+static guint32 seed = 1;
+
+/* This helper returns pseudo random numbers, the same ones every run.
+ */
+static guint32
+next_random (void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+
+  return seed;
+}
+
+/* This helper fills the mask with runs of zero, full and partial coverage,
+ * so kernels take both their fast paths and the blending one.
+ */
+static void
+make_mask (guint8 *mask, gint size)
+{
+  gint i, run, kind;
+
+  for (i = 0; i < size; )
+    {
+      run = 1 + next_random () % 12;
+      kind = next_random () % 3;
+
+      for (; run > 0 && i < size; run--, i++)
+        {
+          if (kind == 0)
+            mask[i] = 0x00;
+          else if (kind == 1)
+            mask[i] = 0xff;
+          else
+            mask[i] = next_random () % 256;
+        }
+    }
+}
+
+/* This helper makes a test image inside a buffer having a guard border
+ * around it. Pixels of the image are random, the border has a pattern.
+ */
+static guint32*
+make_image (RasterImage *image)
+{
+  guint32 *buffer;
+  gint stride, x, y;
+
+  stride = IMAGE_WIDTH + 2*BORDER;
+  buffer = g_new (guint32, stride * (IMAGE_HEIGHT + 2*BORDER));
+
+  for (y = 0; y < IMAGE_HEIGHT + 2*BORDER; y++)
+    {
+      for (x = 0; x < stride; x++)
+        {
+          if (x < BORDER || x >= BORDER + IMAGE_WIDTH ||
+              y < BORDER || y >= BORDER + IMAGE_HEIGHT)
+            buffer[y*stride + x] = BORDER_PIXEL;
+          else
+            buffer[y*stride + x] = next_random () & 0x00ffffff;
+        }
+    }
+
+  image->data = (guint8 *) (buffer + BORDER*stride + BORDER);
+  image->width = IMAGE_WIDTH;
+  image->height = IMAGE_HEIGHT;
+  image->stride = stride * 4;
+
+  return buffer;
+}
+
+/* This helper checks the guard border around the image is intact.
+ */
+static void
+check_border (const guint32 *buffer)
+{
+  gint stride, x, y;
+
+  stride = IMAGE_WIDTH + 2*BORDER;
+
+  for (y = 0; y < IMAGE_HEIGHT + 2*BORDER; y++)
+    {
+      for (x = 0; x < stride; x++)
+        {
+          if (x < BORDER || x >= BORDER + IMAGE_WIDTH ||
+              y < BORDER || y >= BORDER + IMAGE_HEIGHT)
+            g_assert (buffer[y*stride + x] == BORDER_PIXEL);
+        }
+    }
+}
+
+/* The scalar kernel mixes channels with exactly rounded arithmetics.
+ */
+static void
+test_blend_rounding (void)
+{
+  RasterImage image;
+  guint32 pixel;
+  guint8 alpha;
+  guint a, d, c, expected;
+
+  raster_set_impl (RASTER_IMPL_SCALAR);
+
+  image.data = (guint8 *) &pixel;
+  image.width = 1;
+  image.height = 1;
+  image.stride = 4;
+
+  for (a = 0; a < 256; a++)
+    {
+      for (d = 0; d < 256; d++)
+        {
+          for (c = 0; c < 256; c += 15)
+            {
+              alpha = a;
+              pixel = (d << 16) | ((255 - d) << 8) | d;
+
+              raster_blend_mask (&image, 0, 0, &alpha, 1, 1, 1, (c << 16) | (c << 8) | c);
+
+              expected = (d*(255 - a) + c*a + 127) / 255;
+              g_assert (((pixel >> 16) & 0xff) == expected);
+              g_assert ((pixel & 0xff) == expected);
+
+              expected = ((255 - d)*(255 - a) + c*a + 127) / 255;
+              g_assert (((pixel >> 8) & 0xff) == expected);
+            }
+        }
+    }
+}
+
+/* SIMD kernels produce the same pixels as the scalar one for any mask
+ * width and position, clipped ones included.
+ */
+static void
+test_blend_kernels (void)
+{
+  guint8 mask[MASK_WIDTH * MASK_HEIGHT];
+  RasterImage image, reference;
+  guint32 *buffer, *reference_buffer;
+  guint32 color;
+  gsize size;
+  gint impl, width, x, y;
+
+  size = (IMAGE_WIDTH + 2*BORDER) * (IMAGE_HEIGHT + 2*BORDER) * sizeof (guint32);
+
+  for (impl = RASTER_IMPL_SSE2; impl <= RASTER_IMPL_AVX2; impl++)
+    {
+      if (!raster_impl_supported (impl))
+        {
+          g_print ("raster: %s not supported, skipped\n", raster_impl_name (impl));
+          continue;
+        }
+
+      for (width = 1; width <= MASK_WIDTH; width++)
+        {
+          for (y = -MASK_HEIGHT; y <= IMAGE_HEIGHT; y += 3)
+            {
+              for (x = -width; x <= IMAGE_WIDTH; x += 5)
+                {
+                  make_mask (mask, sizeof (mask));
+                  color = next_random () & 0x00ffffff;
+
+                  reference_buffer = make_image (&reference);
+                  buffer = g_memdup (reference_buffer, size);
+                  image = reference;
+                  image.data = (guint8 *) buffer + (reference.data - (guint8 *) reference_buffer);
+
+                  raster_set_impl (RASTER_IMPL_SCALAR);
+                  raster_blend_mask (&reference, x, y, mask, MASK_WIDTH, width, MASK_HEIGHT, color);
+
+                  raster_set_impl (impl);
+                  raster_blend_mask (&image, x, y, mask, MASK_WIDTH, width, MASK_HEIGHT, color);
+
+                  g_assert (memcmp (buffer, reference_buffer, size) == 0);
+                  check_border (buffer);
+
+                  g_free (reference_buffer);
+                  g_free (buffer);
+                }
+            }
+        }
+    }
+}
+
+/* Filling is clipped to the image and to sub-images made by clipping.
+ */
+static void
+test_fill_clip (void)
+{
+  RasterImage image, sub;
+  guint32 *buffer, *pixels;
+  gint x, y;
+
+  buffer = make_image (&image);
+
+  raster_fill_rect (&image, -5, -5, IMAGE_WIDTH + 10, IMAGE_HEIGHT + 10, 0x00123456);
+  check_border (buffer);
+
+  raster_image_clip (&sub, &image, IMAGE_WIDTH - 4, 2, 10, 3);
+  g_assert (sub.width == 4 && sub.height == 3);
+
+  raster_fill_rect (&sub, 0, 0, 10, 10, 0x00654321);
+  check_border (buffer);
+
+  pixels = (guint32 *) image.data;
+
+  for (y = 0; y < IMAGE_HEIGHT; y++)
+    {
+      for (x = 0; x < IMAGE_WIDTH; x++)
+        {
+          if (x >= IMAGE_WIDTH - 4 && y >= 2 && y < 5)
+            g_assert (pixels[y*image.stride/4 + x] == 0x00654321);
+          else
+            g_assert (pixels[y*image.stride/4 + x] == 0x00123456);
+        }
+    }
+
+  raster_image_clip (&sub, &image, IMAGE_WIDTH, 0, 4, 4);
+  g_assert (sub.width == 0 || sub.height == 0);
+
+  g_free (buffer);
+}
+
+int
+main (int argc, char *argv[])
+{
+  test_blend_rounding ();
+  test_blend_kernels ();
+  test_fill_clip ();
+
+  g_print ("raster: all tests passed\n");
+
+  return 0;
+}
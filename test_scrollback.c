@@ -0,0 +1,219 @@
+#include <string.h>
+#include <glib.h>
+
+#include "scrollback.h"
+
+#define LINE_CELLS_MAX 200
+
+/* This helper makes the test line number i. Lines have various lengths,
+ * the empty one included, zero characters, characters taking several bytes
+ * packed, runs of a repeated character both shorter and longer than a
+ * packed run and runs of colors and attributes.
+ */
+static gint
+make_line (gint i, ScrollbackCell *cells)
+{
+  gint n, k;
+
+  n = (i * 7) % 97;
+
+  for (k = 0; k < n; k++)
+    {
+      if (k % 13 == 0)
+        cells[k].chr = 0;
+      else if ((i + k / 5) % 3 == 0)
+        cells[k].chr = 'x';
+      else if (k % 11 == 0)
+        cells[k].chr = 0x1f600 + i % 16;
+      else
+        cells[k].chr = 0x400 + (i + k) % 300;
+
+      cells[k].color = (k / 10 + i) % 256;
+      cells[k].attr = (k / 3) % 2;
+      cells[k].reserved = 0;
+    }
+
+  return n;
+}
+
+/* This helper checks the history holds the n_lines most recent of total
+ * lines pushed.
+ */
+static void
+check_lines (Scrollback *sb, gint total, gint n_lines)
+{
+  ScrollbackCell expected[LINE_CELLS_MAX], cells[LINE_CELLS_MAX];
+  gint j, n, m;
+
+  g_assert (scrollback_get_n_lines (sb) == n_lines);
+
+  for (j = 0; j < n_lines; j++)
+    {
+      n = make_line (total - 1 - j, expected);
+      m = scrollback_get_line (sb, j, cells, LINE_CELLS_MAX);
+
+      g_assert (m == n);
+      g_assert (memcmp (cells, expected, n * sizeof (ScrollbackCell)) == 0);
+    }
+}
+
+/* This helper checks all of total lines pushed are in the history, lines
+ * older than the n_kept most recent ones spilled with max_cells cells at
+ * most.
+ */
+static void
+check_cut_lines (Scrollback *sb, gint total, gint n_kept, gint max_cells)
+{
+  ScrollbackCell expected[LINE_CELLS_MAX], cells[LINE_CELLS_MAX];
+  gint j, n, m;
+
+  g_assert (scrollback_get_n_lines (sb) == total);
+
+  for (j = 0; j < total; j++)
+    {
+      n = make_line (total - 1 - j, expected);
+      m = scrollback_get_line (sb, j, cells, LINE_CELLS_MAX);
+
+      if (j >= n_kept)
+        n = MIN (n, max_cells);
+
+      g_assert (m == n);
+      g_assert (memcmp (cells, expected, n * sizeof (ScrollbackCell)) == 0);
+    }
+}
+
+/* This helper pushes test lines from first to total - 1.
+ */
+static void
+push_lines (Scrollback *sb, gint first, gint total)
+{
+  ScrollbackCell cells[LINE_CELLS_MAX];
+  gint i, n;
+
+  for (i = first; i < total; i++)
+    {
+      n = make_line (i, cells);
+      scrollback_push (sb, cells, n);
+    }
+}
+
+/* Lines packed into cold blocks read back the same, the hot ones too, and
+ * lines are found across both.
+ */
+static void
+test_pack (void)
+{
+  Scrollback *sb;
+
+  sb = scrollback_new (10000);
+
+  push_lines (sb, 0, 1000);
+  check_lines (sb, 1000, 1000);
+
+  scrollback_free (sb);
+}
+
+/* Trimming drops whole cold blocks and leading lines of the oldest one.
+ */
+static void
+test_trim (void)
+{
+  Scrollback *sb;
+  gint max_lines;
+
+  /* less lines allowed than a block has, the hot block is trimmed */
+  sb = scrollback_new (100);
+  push_lines (sb, 0, 1000);
+  check_lines (sb, 1000, 100);
+  scrollback_free (sb);
+
+  /* the oldest cold block is trimmed partly */
+  for (max_lines = 300; max_lines < 1000; max_lines += 137)
+    {
+      sb = scrollback_new (max_lines);
+
+      push_lines (sb, 0, 2000);
+      check_lines (sb, 2000, max_lines);
+
+      scrollback_set_max_lines (sb, max_lines - 50);
+      check_lines (sb, 2000, max_lines - 50);
+
+      push_lines (sb, 2000, 2100);
+      check_lines (sb, 2100, max_lines - 50);
+
+      scrollback_free (sb);
+    }
+
+  /* no history at all */
+  sb = scrollback_new (0);
+  push_lines (sb, 0, 10);
+  check_lines (sb, 10, 0);
+  scrollback_free (sb);
+}
+
+/* Lines are found across the spill file, cold blocks and the hot block,
+ * the spill file grows and is mapped again.
+ */
+static void
+test_spill (void)
+{
+  Scrollback *sb;
+
+  sb = scrollback_new (300);
+  g_assert (scrollback_spill_enable (sb, LINE_CELLS_MAX, LINE_CELLS_MAX, NULL));
+
+  push_lines (sb, 0, 1000);
+  check_lines (sb, 1000, 1000);
+
+  /* more lines than the spill file has room for at first */
+  push_lines (sb, 1000, 40000);
+  check_lines (sb, 40000, 40000);
+
+  scrollback_set_max_lines (sb, 10);
+  check_lines (sb, 40000, 40000);
+
+  scrollback_spill_disable (sb);
+  check_lines (sb, 40000, 10);
+
+  scrollback_free (sb);
+}
+
+/* Spill file slots are widened for lines longer than the slots, lines
+ * spilled before keep their cells. Lines longer than the widest slots are
+ * cut.
+ */
+static void
+test_spill_widen (void)
+{
+  Scrollback *sb;
+
+  sb = scrollback_new (100);
+  g_assert (scrollback_spill_enable (sb, 10, LINE_CELLS_MAX, NULL));
+
+  push_lines (sb, 0, 20000);
+  check_lines (sb, 20000, 20000);
+
+  scrollback_free (sb);
+
+  /* lines beyond the widest slots are cut */
+  sb = scrollback_new (10);
+  g_assert (scrollback_spill_enable (sb, 10, 50, NULL));
+
+  push_lines (sb, 0, 1000);
+  check_cut_lines (sb, 1000, 10, 50);
+
+  scrollback_free (sb);
+}
+
+int
+main (int argc, char *argv[])
+{
+  test_pack ();
+  test_trim ();
+  test_spill ();
+  test_spill_widen ();
+
+  g_print ("scrollback: all tests passed\n");
+
+  return 0;
+}